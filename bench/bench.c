@@ -0,0 +1,1862 @@
+/*  A program to simulate keyboard and mouse inputs
+    Copyright (C) 2025 Anonymous1212144
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Benchmarks for the compiler and player. Built together with simulate.c so it can look at compiled programs:
+//     cc -O2 -pthread bench/bench.c -o simulate-bench
+#define SI_LIBRARY
+#include "../simulate.c"
+#ifdef _WIN32
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+// Scripts are generated from a fixed seed, so every run compiles the same thing
+uint64_t next_random(uint64_t *const state)
+{
+    *state = *state * 6364136223846793005 + 1442695040888963407;
+    return *state >> 33;
+}
+
+void append(vector *const v, const char *const text)
+{
+    for (const char *c = text; *c; c++)
+    {
+        expand(v);
+        ((char *)v->data)[v->len++] = *c;
+    }
+}
+
+void append_num(vector *const v, const uintmax_t num)
+{
+    char buffer[uintmax_digits + 1];
+    *put_num(buffer, num) = 0;
+    append(v, buffer);
+}
+
+// Top level segments of typing, clicking, and moving, in loops and arrays
+char *generate_script(const size_t size, size_t *const len)
+{
+    static const char *const text[] = {"Hello World!", "The quick brown fox jumps over the lazy dog", "a", "1234567890",
+                                       "{[()]}", "Shift + Ctrl"};
+    vector v = {NULL, 0, 0, 1, NULL};
+    uint64_t state = 1;
+    while (v.len < size)
+    {
+        switch (next_random(&state) % 6)
+        {
+        case 0:
+            append(&v, "k");
+            append(&v, text[next_random(&state) % 6]);
+            append(&v, "\n");
+            break;
+        case 1:
+            append(&v, "[k");
+            append(&v, text[next_random(&state) % 6]);
+            append(&v, "\n]");
+            append_num(&v, next_random(&state) % 4 + 1);
+            break;
+        case 2:
+            append(&v, "P");
+            append_num(&v, next_random(&state) % 65536);
+            append(&v, ",");
+            append_num(&v, next_random(&state) % 65536);
+            append(&v, "(Ll)");
+            break;
+        case 3:
+            append(&v, "{");
+            append_num(&v, next_random(&state) % 10 + 1);
+            append(&v, "p-5,5w120s1}");
+            break;
+        case 4:
+            append(&v, "S");
+            append_num(&v, next_random(&state) % 3);
+            append(&v, "C10");
+            append(&v, "[Rr]");
+            append_num(&v, next_random(&state) % 50 + 1);
+            append(&v, "c10");
+            break;
+        default:
+            append(&v, "n123+\n");
+            break;
+        }
+    }
+    *len = v.len;
+    return v.data;
+}
+
+// Arrays nested 2 to 6 deep, each repeated 2 to 4 times
+char *generate_nesting(const size_t size, size_t *const len)
+{
+    static const char *const inner[] = {"Ll", "Rr", "ka\n", "C41c41", "w120", "p1,-1"};
+    vector v = {NULL, 0, 0, 1, NULL};
+    uint64_t state = 1;
+    while (v.len < size)
+    {
+        int depth = next_random(&state) % 5 + 2;
+        for (int i = 0; i < depth; i++)
+            append(&v, "[");
+        append(&v, inner[next_random(&state) % 6]);
+        for (int i = 0; i < depth; i++)
+        {
+            append(&v, inner[next_random(&state) % 6]);
+            append(&v, "]");
+            append_num(&v, next_random(&state) % 3 + 2);
+        }
+    }
+    *len = v.len;
+    return v.data;
+}
+
+// Loops of 10 to 50, some with another loop inside, which send little but run many instructions
+char *generate_loops(const size_t size, size_t *const len)
+{
+    vector v = {NULL, 0, 0, 1, NULL};
+    uint64_t state = 1;
+    while (v.len < size)
+    {
+        append(&v, "{");
+        append_num(&v, next_random(&state) % 41 + 10);
+        if (next_random(&state) % 2)
+        {
+            append(&v, "{");
+            append_num(&v, next_random(&state) % 8 + 2);
+            append(&v, "Ll}s0");
+        }
+        else
+            append(&v, "Lls0Rr");
+        append(&v, "}");
+    }
+    *len = v.len;
+    return v.data;
+}
+
+// Long runs of small moves, jumps, and scrolls, as recorded mouse paths are
+char *generate_mouse(const size_t size, size_t *const len)
+{
+    vector v = {NULL, 0, 0, 1, NULL};
+    uint64_t state = 1;
+    while (v.len < size)
+    {
+        append(&v, "P");
+        append_num(&v, next_random(&state) % 65536);
+        append(&v, ",");
+        append_num(&v, next_random(&state) % 65536);
+        for (int i = 0; i < 32; i++)
+        {
+            append(&v, "p");
+            if (next_random(&state) % 2)
+                append(&v, "-");
+            append_num(&v, next_random(&state) % 40);
+            append(&v, ",");
+            if (next_random(&state) % 2)
+                append(&v, "-");
+            append_num(&v, next_random(&state) % 40);
+        }
+        append(&v, next_random(&state) % 4 ? "w-120" : "[p70000,1]2");
+    }
+    *len = v.len;
+    return v.data;
+}
+
+// Mouse groups of every kind, alone and inside arrays
+char *generate_groups(const size_t size, size_t *const len)
+{
+    static const char *const groups[] = {"(Ll)", "(P100,200Ll)", "(p5,-5w120)", "(Mm)", "(p-3,3Rr)", "(P0,0w-240Ll)"};
+    vector v = {NULL, 0, 0, 1, NULL};
+    uint64_t state = 1;
+    while (v.len < size)
+    {
+        int array = next_random(&state) % 3 == 0;
+        if (array)
+            append(&v, "[");
+        for (int i = next_random(&state) % 4 + 1; i; i--)
+            append(&v, groups[next_random(&state) % 6]);
+        if (array)
+        {
+            append(&v, "]");
+            append_num(&v, next_random(&state) % 5 + 1);
+        }
+    }
+    *len = v.len;
+    return v.data;
+}
+
+char *generate_prose(const size_t size, size_t *const len);
+
+// Every kind of script the suite runs, by the name used on the command line
+typedef struct
+{
+    const char *name;
+    char *(*generate)(const size_t size, size_t *const len);
+} workload;
+
+static const workload workloads[] = {{"mixed", generate_script}, {"prose", generate_prose},
+                                     {"nesting", generate_nesting}, {"loops", generate_loops},
+                                     {"mouse", generate_mouse}, {"groups", generate_groups}};
+
+enum
+{
+    workload_count = sizeof(workloads) / sizeof(workloads[0]),
+};
+
+const workload *find_workload(const char *const name)
+{
+    for (size_t i = 0; i < workload_count; i++)
+        if (!strcmp(workloads[i].name, name))
+            return &workloads[i];
+    printf("Error: Unknown workload \"%s\"\n", name);
+    return NULL;
+}
+
+int same_vector(const vector *const a, const vector *const b)
+{
+    return a->len == b->len && (!a->len || !memcmp(a->data, b->data, a->len * a->unit));
+}
+
+int same_program(const program *const a, const program *const b)
+{
+    return same_vector(&a->codes, &b->codes) && same_vector(&a->inputs, &b->inputs) &&
+           same_vector(&a->events, &b->events) && same_vector(&a->repeats, &b->repeats) &&
+           same_vector(&a->paths, &b->paths) && same_vector(&a->text, &b->text) && a->depth == b->depth &&
+           a->warnings == b->warnings;
+}
+
+size_t cpu_count()
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? n : 1;
+#endif
+}
+
+size_t peak_rss_kb()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return 0;
+    return counters.PeakWorkingSetSize / 1024;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
+}
+
+// The memory the process holds now, which unlike the peak goes down again once a layout is freed
+size_t rss_kb()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return 0;
+    return counters.WorkingSetSize / 1024;
+#elif defined(__linux__)
+    unsigned long size, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (!f)
+        return 0;
+    if (fscanf(f, "%lu %lu", &size, &resident) != 2)
+        resident = 0;
+    fclose(f);
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+#else
+    return peak_rss_kb();
+#endif
+}
+
+// Laid out like INPUT on 64 bit Windows, which is what each input used to be stored as. The union in INPUT holds a
+// pointer sized field, so the mouse part is aligned to 8 bytes after the type and the whole is 40 bytes
+typedef struct
+{
+    uint32_t type;
+    struct
+    {
+        int32_t dx;
+        int32_t dy;
+        uint32_t data;
+        uint32_t flags;
+        uint32_t time;
+        uint64_t extra;
+    } mouse;
+} wide_input;
+
+// The INPUT for an input that is not text past U+FFFF
+wide_input widen(const sink *const out, const event *const e)
+{
+    if (e->type == event_text)
+        return (wide_input){.type = 1, .mouse = {.data = e->text < 0x10000 ? e->text : 0xD800 | (e->text - 0x10000) >> 10, .flags = 4 | (e->flags & key_up)}};
+    motion m = unpack_motion(out, e);
+    return (wide_input){.type = e->type == event_key, .mouse = {.dx = m.dx, .dy = m.dy, .data = e->type == event_key ? e->key : (uint32_t)m.wheel, .flags = e->flags}};
+}
+
+typedef struct
+{
+    // Text past U+FFFF takes two INPUTs
+    wide_input staging[2 * batch_size];
+    uint64_t sent;
+    uint64_t check;
+    // The INPUTs made, which is more than the inputs sent when some are text
+    uint64_t made;
+} expander;
+
+// Turns every batch into INPUTs like the sendinput output does, so the cost of unpacking is counted
+size_t expand_send(struct sink *const out, const event *const events, const size_t len)
+{
+    expander *x = out->data;
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++, n++)
+    {
+        x->staging[n] = widen(out, &events[i]);
+        if (events[i].type == event_text && events[i].text >= 0x10000)
+            x->staging[++n] = (wide_input){.type = 1, .mouse = {.data = 0xDC00 | (events[i].text & 0x3FF), .flags = x->staging[n - 1].mouse.flags}};
+    }
+    x->sent += len;
+    x->made += n;
+    x->check += x->staging[n - 1].mouse.flags + x->staging[0].mouse.dx;
+    return len;
+}
+
+// Plays the loops, sends and sleeps of a program, which is all a generated script has, with its inputs kept one of two
+// ways: packed like programs keep them now and made into INPUTs as each batch is sent, or stored as INPUTs the way they
+// used to be and sent as they are. Both go through this one small player rather than execute, so the only difference
+// between them is the layout
+typedef struct
+{
+    sink *out;
+    // One of these is set, and the batch is copied into the staging of the same kind
+    const event *events;
+    const wide_input *inputs;
+    const repeat *repeats;
+    size_t repeats_len;
+    size_t next;
+    size_t len;
+    uint64_t sent;
+    uint64_t check;
+    event packed[batch_size];
+    wide_input staging[batch_size];
+} layout_player;
+
+// Stands in for SendInput reading the batch, after making the INPUTs when they are packed
+void send_layout(layout_player *const l)
+{
+    if (l->events)
+    {
+        for (size_t i = 0; i < l->len; i++)
+            l->staging[i] = widen(l->out, &l->packed[i]);
+    }
+    l->sent += l->len;
+    l->check += l->staging[l->len - 1].mouse.flags + l->staging[0].mouse.dx;
+    l->len = 0;
+}
+
+// Like stream, copying from whichever layout the player has
+void stream_layout(layout_player *const l, size_t begin, const size_t end)
+{
+    while (begin < end)
+    {
+        if (l->next < l->repeats_len && l->repeats[l->next].begin == begin)
+        {
+            const repeat *r = &l->repeats[l->next++];
+            size_t first = l->next;
+            for (uintmax_t i = 0; i < r->count; i++)
+            {
+                l->next = first;
+                stream_layout(l, r->begin, r->end);
+            }
+            begin = r->end;
+            continue;
+        }
+        size_t stop = end;
+        if (l->next < l->repeats_len && l->repeats[l->next].begin < end)
+            stop = l->repeats[l->next].begin;
+        while (begin < stop)
+        {
+            size_t n = stop - begin;
+            if (n > batch_size - l->len)
+                n = batch_size - l->len;
+            if (l->events)
+                memcpy(&l->packed[l->len], &l->events[begin], n * event_size);
+            else
+                memcpy(&l->staging[l->len], &l->inputs[begin], n * sizeof(wide_input));
+            l->len += n;
+            begin += n;
+            if (l->len == batch_size)
+                send_layout(l);
+        }
+    }
+}
+
+// Plays the program from the inputs given, which are either its own events or them made into INPUTs
+void play_layout(const program *const p, const event *const events, const wide_input *const inputs, layout_player *const l)
+{
+    const sequence *seq = p->inputs.data;
+    const instruction *ins = p->codes.data;
+    uintmax_t *memory = malloc(p->depth * uintmax_size + 1);
+    if (!memory)
+        handle_error("Error running benchmark");
+    size_t m = -1;
+    uint64_t deadline = now_ns();
+    for (size_t i = 0; i < p->codes.len; i++)
+    {
+        if (ins[i].opcode == 0)
+            memory[++m] = ins[i].immediate;
+        else if (ins[i].opcode == 1)
+        {
+            if (--memory[m])
+                i = ins[i].immediate;
+            else
+                m--;
+        }
+        else if (ins[i].opcode == 2)
+        {
+            const sequence *s = &seq[ins[i].immediate];
+            l->events = events ? events + s->start : NULL;
+            l->inputs = inputs ? inputs + s->start : NULL;
+            l->repeats = (const repeat *)p->repeats.data + s->repeat;
+            l->repeats_len = s->repeats;
+            l->next = 0;
+            stream_layout(l, 0, s->len);
+            if (l->len)
+                send_layout(l);
+        }
+        else if (ins[i].opcode == 3)
+            wait_sleep(l->out, &deadline, ins[i].immediate, NULL);
+    }
+    free(memory);
+}
+
+// Plays a generated script into a sink that unpacks every input, reporting the memory the inputs take up. Then plays it
+// with the inputs packed and with them stored as INPUTs like they used to be, reporting the memory held after each and
+// the speed of each. The INPUTs are made from the packed program, which is still held while they are played
+int bench_play(const size_t size, const int runs)
+{
+    size_t len;
+    char *script = generate_script(size, &len);
+    si_program *p = si_compile_buffer(script, len, NULL);
+    free(script);
+    if (!p)
+    {
+        puts("Error: generated script did not compile");
+        return 1;
+    }
+    expander *x = calloc(1, sizeof(expander));
+    layout_player *l = calloc(1, sizeof(layout_player));
+    if (!x || !l)
+        handle_error("Error running benchmark");
+    sink out = {.send = expand_send, .sleep = null_sleep, .flush = no_flush, .close = no_flush, .data = x};
+    uint64_t best = UINT64_MAX;
+    for (int run = 0; run < runs; run++)
+    {
+        x->sent = 0;
+        uint64_t start = now_ns();
+        execute(&p->p, &out, NULL);
+        uint64_t time = now_ns() - start;
+        if (time < best)
+            best = time;
+    }
+    size_t stored = p->p.events.len * event_size + p->p.motions.len * motion_size;
+    printf("play: %zu inputs stored, %llu sent per run, %zu motions\n", p->p.events.len, (unsigned long long)x->sent,
+           p->p.motions.len);
+    printf("bytes_per_input,inputs_kb,as_input_kb,peak_rss_kb,inputs_per_s\n");
+    printf("%zu,%zu,%zu,%zu,%.0f\n", sizeof(event), stored / 1024, p->p.events.len * sizeof(wide_input) / 1024,
+           peak_rss_kb(), x->sent * 1e9 / best);
+
+    out.motions = p->p.motions.data;
+    l->out = &out;
+    wide_input *inputs = NULL;
+    uint64_t sent[2] = {0};
+    printf("layout,bytes_per_input,inputs_kb,rss_kb,inputs_per_s\n");
+    for (int wide = 0; wide < 2; wide++)
+    {
+        if (wide)
+        {
+            if (!(inputs = malloc(p->p.events.len * sizeof(wide_input) + 1)))
+                handle_error("Error running benchmark");
+            for (size_t i = 0; i < p->p.events.len; i++)
+                inputs[i] = widen(&out, (const event *)p->p.events.data + i);
+        }
+        uint64_t layout_best = UINT64_MAX;
+        for (int run = 0; run < runs; run++)
+        {
+            l->sent = 0;
+            uint64_t start = now_ns();
+            play_layout(&p->p, wide ? NULL : p->p.events.data, inputs, l);
+            uint64_t time = now_ns() - start;
+            if (time < layout_best)
+                layout_best = time;
+        }
+        sent[wide] = l->sent;
+        size_t unit = wide ? sizeof(wide_input) : event_size;
+        printf("%s,%zu,%zu,%zu,%.0f\n", wide ? "wide" : "packed", unit, p->p.events.len * unit / 1024, rss_kb(),
+               l->sent * 1e9 / layout_best);
+    }
+    int failed = sent[0] != x->sent || sent[1] != x->sent;
+    if (failed)
+        puts("Error: the layouts sent a different number of inputs");
+    free(inputs);
+    free(l);
+    free(x);
+    si_program_free(p);
+    return failed;
+}
+
+// Plays a generated script into the unpacking output from one thread and with --pipeline, reporting inputs per second
+// and how long each side of the pipeline waited for the other
+int bench_pipeline(const size_t size, const int runs)
+{
+    size_t len;
+    char *script = generate_script(size, &len);
+    si_program *p = si_compile_buffer(script, len, NULL);
+    free(script);
+    if (!p)
+    {
+        puts("Error: generated script did not compile");
+        return 1;
+    }
+    expander *x = calloc(1, sizeof(expander));
+    if (!x)
+        handle_error("Error running benchmark");
+    int failed = 0;
+    uint64_t sent[2];
+    printf("mode,inputs_per_s,producer_stalls,producer_stall_us,sender_stalls,sender_stall_us\n");
+    for (int pipelined = 0; pipelined < 2; pipelined++)
+    {
+        sink out = {.send = expand_send, .sleep = null_sleep, .flush = no_flush, .close = no_flush, .data = x};
+        out.pipelined = pipelined;
+        run_stats best = {0};
+        uint64_t best_time = UINT64_MAX;
+        for (int run = 0; run < runs; run++)
+        {
+            run_stats stats = {0};
+            x->sent = 0;
+            uint64_t start = now_ns();
+            execute(&p->p, &out, &stats);
+            uint64_t time = now_ns() - start;
+            if (time < best_time)
+            {
+                best_time = time;
+                best = stats;
+            }
+        }
+        sent[pipelined] = x->sent;
+        printf("%s,%.0f,%llu,%llu,%llu,%llu\n", pipelined ? "pipelined" : "serial", x->sent * 1e9 / best_time,
+               (unsigned long long)best.producer_stalls, (unsigned long long)(best.producer_stall_ns / 1000),
+               (unsigned long long)best.sender_stalls, (unsigned long long)(best.sender_stall_ns / 1000));
+    }
+    if (sent[0] != sent[1])
+    {
+        puts("Error: the pipeline sent a different number of inputs");
+        failed = 1;
+    }
+    free(x);
+    si_program_free(p);
+    return failed;
+}
+
+// Keeps every input sent, so where a path went can be checked
+size_t keep_send(struct sink *const out, const event *const events, const size_t len)
+{
+    vector *v = out->data;
+    reserve(v, v->len + len);
+    memcpy((event *)v->data + v->len, events, len * event_size);
+    v->len += len;
+    return len;
+}
+
+// Where a path should be after step i, worked out from its points the way they are written rather than as a cubic
+double path_at(const path *const w, const int axis, const uint64_t i)
+{
+    double t = (double)i / w->steps, u = 1 - t;
+    double p0 = w->points[axis], p1 = w->points[2 + axis], p2 = w->points[4 + axis], p3 = w->points[6 + axis];
+    if (w->shape == path_linear)
+        return p0 + (p3 - p0) * t;
+    if (w->shape == path_ease)
+        return p0 + (p3 - p0) * t * t * (3 - 2 * t);
+    return u * u * u * p0 + 3 * u * u * t * p1 + 3 * u * t * t * p2 + t * t * t * p3;
+}
+
+// Plays a path and fails if it does not send one move for each step that ends at the end, or if a step is more than
+// a pixel away from where the path should be
+int check_path(const program *const p)
+{
+    vector v = {NULL, 0, 0, event_size, NULL};
+    sink out = {.send = keep_send, .sleep = null_sleep, .flush = no_flush, .close = no_flush, .data = &v};
+    execute(p, &out, NULL);
+    const path *w = p->paths.data;
+    const event *e = v.data;
+    int ok = v.len == w->steps;
+    int32_t at[2] = {w->points[0], w->points[1]};
+    for (size_t i = 0; i < v.len && ok; i++)
+    {
+        motion m = unpack_motion(&out, &e[i]);
+        at[0] = w->flags & mouse_absolute ? m.dx : at[0] + m.dx;
+        at[1] = w->flags & mouse_absolute ? m.dy : at[1] + m.dy;
+        for (int axis = 0; axis < 2; axis++)
+            ok &= at[axis] - path_at(w, axis, i + 1) <= 1 && path_at(w, axis, i + 1) - at[axis] <= 1;
+    }
+    ok &= at[0] == w->points[6] && at[1] == w->points[7];
+    free(v.data);
+    return ok;
+}
+
+// Compiles a drag of steps moves as a path of each shape and as the same moves written out in an array, and plays
+// each into the null output, which only times working out the moves, and into the unpacking output. A path should be
+// as fast as the array it replaces into the unpacking output while taking a few dozen bytes instead of one input per
+// step
+int bench_path(const uint64_t steps, const int runs)
+{
+    static const char *const names[] = {"line", "ease", "bezier", "absolute", "array"};
+    static const char *const shapes[] = {"dl3000,-2000,", "de3000,-2000,", "db1000,-3000,2000,3000,3000,-2000,",
+                                         "Dl100,60000,65000,500,"};
+    vector scripts[5] = {{NULL, 0, 0, 1, NULL}, {NULL, 0, 0, 1, NULL}, {NULL, 0, 0, 1, NULL}, {NULL, 0, 0, 1, NULL}, {NULL, 0, 0, 1, NULL}};
+    for (int i = 0; i < 4; i++)
+    {
+        append(&scripts[i], shapes[i]);
+        append_num(&scripts[i], steps);
+    }
+    // The same moves as the line, rounded the same way
+    append(&scripts[4], "[");
+    int64_t last[2] = {0, 0};
+    for (uint64_t i = 1; i <= steps; i++)
+    {
+        const int64_t end[2] = {3000, -2000};
+        append(&scripts[4], "p");
+        for (int axis = 0; axis < 2; axis++)
+        {
+            int64_t at = (int64_t)(end[axis] * (double)i * (1.0 / steps) + (end[axis] < 0 ? -0.5 : 0.5));
+            if (at - last[axis] < 0)
+                append(&scripts[4], "-");
+            append_num(&scripts[4], at - last[axis] < 0 ? last[axis] - at : at - last[axis]);
+            append(&scripts[4], axis ? "" : ",");
+            last[axis] = at;
+        }
+    }
+    append(&scripts[4], "]1");
+    expander *x = calloc(1, sizeof(expander));
+    if (!x)
+        handle_error("Error running benchmark");
+    int failed = 0;
+    printf("path,steps,program_bytes,as_input_kb,generate_per_s,play_per_s\n");
+    for (int i = 0; i < 5; i++)
+    {
+        si_program *p = si_compile_buffer(scripts[i].data, scripts[i].len, NULL);
+        free(scripts[i].data);
+        if (!p || p->p.warnings)
+        {
+            printf("Error: the %s script did not compile\n", names[i]);
+            failed = 1;
+            si_program_free(p);
+            continue;
+        }
+        if (i < 4 && !check_path(&p->p))
+        {
+            printf("Error: the %s path did not go where it should\n", names[i]);
+            failed = 1;
+        }
+        program_stats s;
+        analyze_program(&p->p, batch_size, &s);
+        uint64_t best[2] = {UINT64_MAX, UINT64_MAX};
+        for (int run = 0; run < runs; run++)
+        {
+            for (int unpack = 0; unpack < 2; unpack++)
+            {
+                sink out = {.send = unpack ? expand_send : null_send, .sleep = null_sleep, .flush = no_flush, .close = no_flush, .data = x};
+                uint64_t start = now_ns();
+                execute(&p->p, &out, NULL);
+                uint64_t time = now_ns() - start;
+                if (time < best[unpack])
+                    best[unpack] = time;
+            }
+        }
+        printf("%s,%ju,%ju,%ju,%.0f,%.0f\n", names[i], s.inputs, s.stored_bytes, s.inputs * sizeof(wide_input) / 1024,
+               s.inputs * 1e9 / best[0], s.inputs * 1e9 / best[1]);
+        si_program_free(p);
+    }
+    free(x);
+    return failed;
+}
+
+// How programs were run before they were threaded, kept to compare against
+size_t execute_switch(const program *const p, sink *const out, run_stats *const stats)
+{
+    const sequence *seq = p->inputs.data;
+    const instruction *ins = p->codes.data;
+    lateness *late = stats ? &stats->late : NULL;
+    uintmax_t *memory = malloc(p->depth * uintmax_size + 1);
+    if (!memory)
+        handle_error("Error executing");
+    out->motions = p->motions.data;
+    batch *b = new_batch(out, batch_size);
+    size_t failed = 0;
+    size_t m = -1;
+    uint64_t deadline = now_ns();
+    for (size_t i = 0; i < p->codes.len; i++)
+    {
+        switch (ins[i].opcode)
+        {
+        case 0:
+            memory[++m] = ins[i].immediate;
+            break;
+        case 1:
+            if (--memory[m])
+                i = ins[i].immediate;
+            else
+                m--;
+            break;
+        case 2:
+            failed += send_sequence(p, b, &seq[ins[i].immediate]);
+            break;
+        case 3:
+            wait_sleep(out, &deadline, ins[i].immediate, late);
+            break;
+        }
+    }
+    out->flush(out);
+    free(memory);
+    free(b);
+    return failed;
+}
+
+// Runs loop heavy scripts into the null output both ways, reporting the instructions run per second
+int bench_interp(const int runs)
+{
+    static const char *const scripts[] = {"{2000000[L]1}", "{2000000[L]1s0}", "{1000{1000Ll}}",
+                                          "{100{100{100Ls0}}}", "{500{1000[Ll]1s0Rr}}"};
+    size_t (*const runners[])(const program *, sink *, run_stats *) = {execute_switch, execute};
+    sink out = {.send = null_send, .sleep = null_sleep, .flush = no_flush, .close = no_flush, .data = NULL};
+    printf("script,instructions,switch_per_s,threaded_per_s,speedup\n");
+    for (size_t i = 0; i < sizeof(scripts) / sizeof(scripts[0]); i++)
+    {
+        si_program *p = si_compile_buffer(scripts[i], strlen(scripts[i]), NULL);
+        if (!p)
+        {
+            puts("Error: script did not compile");
+            return 1;
+        }
+        uintmax_t executed, calls;
+        count_program(&p->p, &executed, &calls);
+        uint64_t best[2] = {UINT64_MAX, UINT64_MAX};
+        for (int run = 0; run < runs; run++)
+        {
+            for (int r = 0; r < 2; r++)
+            {
+                uint64_t start = now_ns();
+                runners[r](&p->p, &out, NULL);
+                uint64_t time = now_ns() - start;
+                if (time < best[r])
+                    best[r] = time;
+            }
+        }
+        printf("\"%s\",%ju,%.0f,%.0f,%.2f\n", scripts[i], executed, executed * 1e9 / best[0], executed * 1e9 / best[1],
+               (double)best[0] / best[1]);
+        si_program_free(p);
+    }
+    return 0;
+}
+
+// Plays scripts with a rate into a trace file, failing if the rate the trace shows is more than 5% off
+int bench_rate()
+{
+    static const char *const scripts[] = {"T2000[L]2000", "T20000{20[Ll]500}", "T500{250Ls0}", "T100000[Ll]50000"};
+    static const double rates[] = {2000, 20000, 500, 100000};
+    static const char output[] = "record:simulate-bench-rate.bin";
+    const char *const path = output + 7;
+    int failed = 0;
+    printf("script,events,seconds,target_per_s,achieved_per_s\n");
+    for (size_t i = 0; i < sizeof(scripts) / sizeof(scripts[0]); i++)
+    {
+        si_program *p = si_compile_buffer(scripts[i], strlen(scripts[i]), NULL);
+        sink out;
+        if (!p || !open_sink(&out, output))
+        {
+            puts("Error: could not run script");
+            return 1;
+        }
+        execute(&p->p, &out, NULL);
+        out.close(&out);
+        si_program_free(p);
+
+        FILE *file = fopen(path, "rb");
+        trace_header header;
+        trace_record record;
+        uint64_t first = 0, last = 0;
+        size_t events = 0;
+        if (!file || fread(&header, sizeof(header), 1, file) != 1)
+        {
+            puts("Error: could not read trace");
+            return 1;
+        }
+        while (fread(&record, sizeof(record), 1, file) == 1)
+        {
+            if (!events++)
+                first = record.time;
+            last = record.time;
+        }
+        fclose(file);
+        remove(path);
+        double seconds = (last - first) / 1e9;
+        double achieved = seconds > 0 ? (events - 1) / seconds : 0;
+        printf("\"%s\",%zu,%.3f,%.0f,%.0f\n", scripts[i], events, seconds, rates[i], achieved);
+        if (achieved < rates[i] * 0.95 || achieved > rates[i] * 1.05)
+        {
+            printf("Error: rate is more than 5%% off\n");
+            failed = 1;
+        }
+    }
+    return failed;
+}
+
+// An output that holds up to capacity inputs and takes them out at a fixed rate, like a device with a small buffer
+typedef struct
+{
+    size_t capacity;
+    size_t queued;
+    uint64_t drain_ns;
+    uint64_t drained;
+    uint64_t received;
+} bounded_queue;
+
+size_t queue_send(struct sink *const out, const event *const events, size_t len)
+{
+    (void)events;
+    bounded_queue *q = out->data;
+    uint64_t now = now_ns();
+    uint64_t gone = (now - q->drained) / q->drain_ns;
+    q->queued -= gone < q->queued ? gone : q->queued;
+    q->drained = q->queued ? q->drained + gone * q->drain_ns : now;
+    if (len > q->capacity - q->queued)
+        len = q->capacity - q->queued;
+    q->queued += len;
+    q->received += len;
+    return len;
+}
+
+// Plays big arrays into small bounded queues, failing if any input is dropped on the way
+int bench_queue()
+{
+    static const size_t capacities[] = {64, 1000, 100000, 1000};
+    static const size_t max_batches[] = {0, 0, 0, 256};
+    static const char script[] = "[L]100000";
+    static const size_t inputs = 100000;
+    si_program *p = si_compile_buffer(script, sizeof(script) - 1, NULL);
+    if (!p)
+    {
+        puts("Error: script did not compile");
+        return 1;
+    }
+    int failed = 0;
+    printf("capacity,max_batch,inputs,received,sends,retries,last_batch,smallest_batch,seconds\n");
+    for (size_t i = 0; i < sizeof(capacities) / sizeof(capacities[0]); i++)
+    {
+        bounded_queue q = {capacities[i], 0, 500, now_ns(), 0};
+        sink out = {.send = queue_send, .sleep = sleep_until, .flush = no_flush, .close = close_timer, .data = &q};
+        out.max_batch = max_batches[i];
+        run_stats stats = {0};
+        uint64_t start = now_ns();
+        execute(&p->p, &out, &stats);
+        uint64_t time = now_ns() - start;
+        out.close(&out);
+        printf("%zu,%zu,%zu,%llu,%llu,%llu,%zu,%zu,%.3f\n", capacities[i], max_batches[i], inputs,
+               (unsigned long long)q.received, (unsigned long long)stats.sends, (unsigned long long)stats.retries,
+               stats.batch_last, stats.batch_min, time / 1e9);
+        if (q.received != inputs || stats.dropped)
+        {
+            puts("Error: inputs were dropped");
+            failed = 1;
+        }
+    }
+    si_program_free(p);
+    return failed;
+}
+
+// Jobs are a few clicks each, from a small set of scripts so most of them are found in the server's cache
+enum
+{
+    load_scripts = 64,
+};
+
+typedef struct
+{
+    const char *name;
+    size_t first;
+    size_t jobs;
+    uint64_t *round_trips;
+    uint64_t inputs;
+    uint64_t compile_ns;
+    uint64_t queue_ns;
+    uint64_t run_ns;
+    uint64_t hits;
+    int failed;
+} load_client;
+
+void run_load_client(void *const arg)
+{
+    load_client *l = arg;
+    channel c;
+    // The server may still be starting
+    unsigned tries = 0;
+    while (!connect_channel(&c, l->name))
+    {
+        if (++tries > 2000)
+        {
+            l->failed = 1;
+            return;
+        }
+        back_off(tries);
+    }
+    for (size_t i = 0; i < l->jobs; i++)
+    {
+        char script[32];
+        size_t clicks = (l->first + i) % load_scripts + 1;
+        int len = snprintf(script, sizeof(script), "[L]%zu", clicks);
+        serve_request q = {serve_script, serve_start, 0, len};
+        serve_reply r;
+        char *messages;
+        uint64_t start = now_ns();
+        if (!send_request(c, &q, script, &r, &messages) || r.status != serve_ok || r.failed)
+        {
+            free(messages);
+            l->failed = 1;
+            break;
+        }
+        l->round_trips[i] = now_ns() - start;
+        free(messages);
+        l->inputs += clicks;
+        l->compile_ns += r.compile_ns;
+        l->queue_ns += r.queue_ns;
+        l->run_ns += r.run_ns;
+        l->hits += r.cached;
+    }
+    close_channel(c);
+}
+
+void run_load_server(void *const arg)
+{
+    if (!serve(arg))
+        perror("Error listening");
+}
+
+int compare_u64(const void *const a, const void *const b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Starts a server in this process and fires jobs at it from clients that each keep one connection, counting every
+// input the output gets to check that none were lost. A limit on the cache makes most jobs compile again
+int bench_serve(const size_t jobs, const size_t clients, const size_t limit)
+{
+    char name[64];
+#ifdef _WIN32
+    snprintf(name, sizeof(name), "simulate-bench-%lu", (unsigned long)GetCurrentProcessId());
+#else
+    snprintf(name, sizeof(name), "/tmp/simulate-bench-%ld.sock", (long)getpid());
+#endif
+    expander *x = calloc(1, sizeof(expander));
+    load_client *l = calloc(clients, sizeof(load_client));
+    thread *workers = malloc(clients * sizeof(thread));
+    uint64_t *round_trips = calloc(jobs + 1, sizeof(uint64_t));
+    if (!x || !l || !workers || !round_trips)
+        handle_error("Error running benchmark");
+    sink out = {.send = expand_send, .sleep = null_sleep, .flush = no_flush, .close = no_flush, .data = x};
+    server s;
+    new_server(&s, name, &out);
+    s.limit = limit;
+    thread listener;
+    if (!spawn_thread(&listener, run_load_server, &s))
+        handle_error("Error starting server");
+
+    uint64_t start = now_ns();
+    for (size_t i = 0, first = 0; i < clients; i++)
+    {
+        l[i] = (load_client){.name = name, .first = first, .jobs = jobs / clients + (i < jobs % clients), .round_trips = round_trips + first};
+        first += l[i].jobs;
+        start_thread(&workers[i], run_load_client, &l[i]);
+    }
+    for (size_t i = 0; i < clients; i++)
+        join_thread(&workers[i]);
+    uint64_t time = now_ns() - start;
+
+    channel c;
+    serve_reply r;
+    char *messages = NULL;
+    serve_request q = {serve_stop, 0, 0, 0};
+    if (connect_channel(&c, name))
+    {
+        send_request(c, &q, NULL, &r, &messages);
+        close_channel(c);
+    }
+    free(messages);
+    join_thread(&listener);
+
+    int failed = 0;
+    load_client total = {0};
+    for (size_t i = 0; i < clients; i++)
+    {
+        failed |= l[i].failed;
+        total.inputs += l[i].inputs;
+        total.compile_ns += l[i].compile_ns;
+        total.queue_ns += l[i].queue_ns;
+        total.run_ns += l[i].run_ns;
+        total.hits += l[i].hits;
+    }
+    qsort(round_trips, jobs, sizeof(uint64_t), compare_u64);
+    size_t compiles = jobs - total.hits;
+    printf("jobs,clients,seconds,jobs_per_s,round_trip_p50_us,round_trip_p99_us,round_trip_max_us,compiles,"
+           "evictions,mean_compile_us,mean_queue_us,mean_run_us\n");
+    printf("%zu,%zu,%.3f,%.0f,%.1f,%.1f,%.1f,%zu,%llu,%.1f,%.1f,%.1f\n", jobs, clients, time / 1e9, jobs * 1e9 / time,
+           round_trips[jobs / 2] / 1e3, round_trips[jobs - 1 - jobs / 100] / 1e3, round_trips[jobs - 1] / 1e3,
+           compiles, (unsigned long long)s.evictions, compiles ? total.compile_ns / 1e3 / compiles : 0, total.queue_ns / 1e3 / jobs,
+           total.run_ns / 1e3 / jobs);
+    if (failed)
+        puts("Error: some jobs failed");
+    else if (x->sent != total.inputs)
+    {
+        puts("Error: the output did not get every input");
+        failed = 1;
+    }
+    free_server(&s);
+    free(round_trips);
+    free(workers);
+    free(l);
+    free(x);
+    return failed;
+}
+
+// Paragraphs of typing in the built-in layouts, with some chars outside ASCII
+char *generate_prose(const size_t size, size_t *const len)
+{
+    static const char *const words[] = {"the", "quick", "brown", "fox", "jumps", "over", "lazy", "dog", "Hello,",
+                                        "World!", "caf\xC3\xA9", "\xC3\xBC" "ber", "Gr\xC3\xB6\xC3\x9F" "e", "\xE2\x82\xAC" "5",
+                                        "(maybe)", "\"quoted\"", "user@example", "100%", "x = y + 1;"};
+    static const char *const layouts[] = {"K00000409", "K00000809", "K00000407"};
+    vector v = {NULL, 0, 0, 1, NULL};
+    uint64_t state = 1;
+    while (v.len < size)
+    {
+        append(&v, layouts[next_random(&state) % 3]);
+        append(&v, "k");
+        for (int i = 0; i < 12; i++)
+        {
+            append(&v, words[next_random(&state) % (sizeof(words) / sizeof(words[0]))]);
+            append(&v, " ");
+        }
+        append(&v, "\n");
+    }
+    *len = v.len;
+    return v.data;
+}
+
+// The US layout can not type every word, so its warnings are dropped
+void ignore_message(void *const user, const char *const message)
+{
+    (void)user;
+    (void)message;
+}
+
+size_t layout_lookups()
+{
+    size_t lookups = 0;
+    lock_layouts();
+    for (const key_table *t = layouts; t; t = t->next)
+        lookups += t->lookups;
+    unlock_layouts();
+    return lookups;
+}
+
+// Compiles typing of 1 up to max megabytes. Layouts are looked up once per process, so the chars looked up should not
+// grow with the size
+int bench_keys(const size_t max)
+{
+    printf("megabytes,inputs,layout_lookups,best_us,mb_per_s\n");
+    for (size_t size = 1; size <= max; size <<= 1)
+    {
+        size_t len;
+        char *script = generate_prose(size << 20, &len);
+        uint64_t best = UINT64_MAX;
+        size_t lookups = layout_lookups();
+        size_t inputs = 0;
+        si_options options = {0, ignore_message, NULL, 1};
+        for (int run = 0; run < 3; run++)
+        {
+            uint64_t start = now_ns();
+            si_program *p = si_compile_buffer(script, len, &options);
+            uint64_t time = now_ns() - start;
+            if (!p)
+            {
+                puts("Error: generated script did not compile");
+                return 1;
+            }
+            if (time < best)
+                best = time;
+            inputs = p->p.events.len;
+            si_program_free(p);
+        }
+        free(script);
+        printf("%zu,%zu,%zu,%llu,%.1f\n", size, inputs, layout_lookups() - lookups, (unsigned long long)(best / 1000),
+               len * 1000.0 / best);
+    }
+    return 0;
+}
+
+// Counts the chars "k" could not type
+void count_invalid(void *const user, const char *const message)
+{
+    if (strstr(message, "Invalid key"))
+        ++*(size_t *)user;
+}
+
+#ifdef __linux__
+// Plays a program into the uinput output with a file in place of its devices, and returns the key presses and releases
+// it wrote
+size_t uinput_keys(const program *const p)
+{
+    FILE *file = tmpfile();
+    if (!file)
+        handle_error("Error running benchmark");
+    uinput_state u = {.staging = {NULL, 0, 0, sizeof(struct input_event), NULL}, .fd = fileno(file), .keys = fileno(file), .pointer = fileno(file)};
+    sink out = {.send = uinput_send, .sleep = null_sleep, .flush = no_flush, .close = no_flush, .data = &u};
+    execute(p, &out, NULL);
+    free(u.staging.data);
+    rewind(file);
+    size_t keys = 0;
+    struct input_event e;
+    while (fread(&e, sizeof(e), 1, file) == 1)
+        keys += e.type == EV_KEY;
+    fclose(file);
+    return keys;
+}
+#endif
+
+// Compiles generated typing with "k" and the same text with "u", and plays each into the same output as play. Prints
+// the chars "k" dropped, the size of the program and, per char typed, the inputs sent, the INPUTs SendInput would be given, and on Linux the key
+// presses and releases uinput would get, along with inputs per second
+int bench_text(const size_t size, const int runs)
+{
+    size_t len;
+    char *script = generate_prose(size, &len);
+    expander *x = calloc(1, sizeof(expander));
+    if (!x)
+        handle_error("Error running benchmark");
+    // Every line is a layout, then "k" and the text to type
+    uintmax_t chars = 0;
+    for (size_t i = 0; i < len; i++)
+        for (i += 10; script[i] != '\n'; chars++)
+        {
+            uint32_t c;
+            i += next_char((const uint8_t *)script + i, len - i, 0, &c);
+        }
+    int failed = 0;
+    printf("command,chars,dropped,program_kb,inputs_per_char,sendinput_per_char,uinput_keys_per_char,inputs_per_s\n");
+    for (int text = 0; text < 2; text++)
+    {
+        if (text)
+            for (size_t i = 0; i < len; i = (const char *)memchr(script + i, '\n', len - i) - script + 1)
+                script[i + 9] = 'u';
+        size_t dropped = 0;
+        si_options options = {0, count_invalid, &dropped, 1};
+        si_program *p = si_compile_buffer(script, len, &options);
+        if (!p)
+        {
+            puts("Error: generated script did not compile");
+            failed = 1;
+            break;
+        }
+        sink out = {.send = expand_send, .sleep = null_sleep, .flush = no_flush, .close = no_flush, .data = x};
+        uint64_t best = UINT64_MAX;
+        for (int run = 0; run < runs; run++)
+        {
+            x->sent = x->made = 0;
+            uint64_t start = now_ns();
+            execute(&p->p, &out, NULL);
+            uint64_t time = now_ns() - start;
+            if (time < best)
+                best = time;
+        }
+        program_stats stats;
+        analyze_program(&p->p, batch_size, &stats);
+        size_t keys = 0;
+#ifdef __linux__
+        keys = uinput_keys(&p->p);
+#endif
+        printf("%s,%ju,%zu,%ju,%.2f,%.2f,%.2f,%.0f\n", text ? "u" : "k", chars, dropped, stats.stored_bytes / 1024,
+               (double)x->sent / chars,
+               (double)x->made / chars, (double)keys / chars, x->sent * 1e9 / best);
+        if (text && (dropped || x->sent != chars * 2))
+        {
+            puts("Error: u did not send a press and a release for every char");
+            failed = 1;
+        }
+        si_program_free(p);
+    }
+    free(x);
+    free(script);
+    return failed;
+}
+
+// The char sets of the arguments after each command, in the order of the states, with P and p reading two numbers
+static const int lex_sets[22] = {1, 1, 1, 1, 1, -1, -1, -1, -1, -1, -1, 2, 0, 3, 3, 3, -1, -1, -1, 1, 1, -1};
+
+// How the lexer classified chars before it used tables, kept to compare against
+int range_char(const char c, const int char_set, const int first)
+{
+    if (c == '\n' || c == '\r')
+        return 0;
+    switch (char_set)
+    {
+    case 1:
+        return !((c < 48 && !(first && c == 45)) || c > 57);
+    case 2:
+        return !(c < 42 || c > 57);
+    case 3:
+        return (c >= 48 && c < 58) || (c >= 65 && c < 71) || (c >= 97 && c < 103);
+    }
+    return 1;
+}
+
+size_t range_len(const char *const data, const size_t len, const size_t at, const int char_set)
+{
+    size_t i = at;
+    while (i < len && range_char(data[i], char_set, i == at))
+        i++;
+    return i - at;
+}
+
+// Splits the script into commands and arguments one char at a time, returning the number of arguments
+size_t lex_ranges(const char *const data, const size_t len)
+{
+    static const char words[] = "SswPpLlMmRrnkKCc()[]{}";
+    size_t args = 0;
+    for (size_t at = 0; at < len;)
+    {
+        char c = data[at++];
+        int state;
+        for (state = 0; c != words[state] && state < 22; state++)
+            ;
+        if (state == 22 || lex_sets[state] < 0)
+            continue;
+        at += range_len(data, len, at, lex_sets[state]);
+        if (state == 3 || state == 4)
+        {
+            at += at < len;
+            at += range_len(data, len, at, 1);
+        }
+        args++;
+    }
+    return args;
+}
+
+// The same with the tables and vector scans the compiler uses
+size_t lex_tables(const char *const data, const size_t len)
+{
+    size_t args = 0;
+    for (size_t at = 0; at < len;)
+    {
+        int state = commands[(uint8_t)data[at++]] - 1;
+        if (state < 0 || lex_sets[state] < 0)
+            continue;
+        at += arg_len(data, len, at, lex_sets[state]);
+        if (state == 3 || state == 4)
+        {
+            at += at < len;
+            at += arg_len(data, len, at, 1);
+        }
+        args++;
+    }
+    return args;
+}
+
+// Lexes a generated script both ways, failing if they find different arguments
+int bench_lex(const size_t size, const int runs)
+{
+    size_t len;
+    char *script = generate_script(size, &len);
+    size_t (*const lexers[])(const char *, size_t) = {lex_ranges, lex_tables};
+    static const char *const names[] = {"ranges", "tables"};
+    size_t args[2];
+    printf("lex: %zu bytes\n", len);
+    printf("lexer,best_us,mb_per_s\n");
+    for (int i = 0; i < 2; i++)
+    {
+        uint64_t best = UINT64_MAX;
+        for (int run = 0; run < runs; run++)
+        {
+            uint64_t start = now_ns();
+            args[i] = lexers[i](script, len);
+            uint64_t time = now_ns() - start;
+            if (time < best)
+                best = time;
+        }
+        printf("%s,%llu,%.1f\n", names[i], (unsigned long long)(best / 1000), len * 1000.0 / best);
+    }
+    free(script);
+    if (args[0] != args[1])
+    {
+        printf("Error: the lexers found %zu and %zu arguments\n", args[0], args[1]);
+        return 1;
+    }
+    return 0;
+}
+
+// Compiles scripts of 1 up to max megabytes, reporting how often the heap was called and the most memory held. Heap
+// calls should grow with the log of the size rather than with the number of inputs
+int bench_alloc(const size_t max)
+{
+    printf("megabytes,inputs,heap_calls,peak_kb,optimized_heap_calls,optimized_peak_kb\n");
+    for (size_t size = 1; size <= max; size <<= 1)
+    {
+        size_t len;
+        char *script = generate_script(size << 20, &len);
+        si_program *p = si_compile_buffer(script, len, NULL);
+        si_options options = {1, NULL, NULL, 1};
+        si_program *o = si_compile_buffer(script, len, &options);
+        free(script);
+        if (!p || !o)
+        {
+            puts("Error: generated script did not compile");
+            return 1;
+        }
+        printf("%zu,%zu,%zu,%zu,%zu,%zu\n", size, p->p.events.len, p->p.memory->heap_calls, p->p.memory->peak / 1024,
+               o->p.memory->heap_calls, o->p.memory->peak / 1024);
+        si_program_free(p);
+        si_program_free(o);
+    }
+    return 0;
+}
+
+// Compiles the same script with 1 to max threads, checking each result is the same as compiling on one thread
+int bench_compile(const size_t size, const size_t max, const int runs)
+{
+    size_t len;
+    char *script = generate_script(size, &len);
+    si_program *serial = si_compile_buffer(script, len, NULL);
+    if (!serial)
+    {
+        puts("Error: generated script did not compile");
+        return 1;
+    }
+    printf("compile: %zu bytes, %zu instructions, %zu inputs\n", len, serial->p.codes.len, serial->p.events.len);
+    printf("threads,best_us,mb_per_s,speedup\n");
+    uint64_t base = 0;
+    int failed = 0;
+    for (size_t threads = 1; threads <= max; threads++)
+    {
+        si_options options = {0, NULL, NULL, threads};
+        uint64_t best = UINT64_MAX;
+        for (int run = 0; run < runs; run++)
+        {
+            uint64_t start = now_ns();
+            si_program *p = si_compile_buffer(script, len, &options);
+            uint64_t time = now_ns() - start;
+            if (time < best)
+                best = time;
+            if (!same_program(&p->p, &serial->p))
+            {
+                printf("Error: %zu threads compiled a different program\n", threads);
+                failed = 1;
+            }
+            si_program_free(p);
+        }
+        if (threads == 1)
+            base = best;
+        printf("%zu,%llu,%.1f,%.2f\n", threads, (unsigned long long)(best / 1000), len * 1000.0 / best,
+               (double)base / best);
+    }
+    si_program_free(serial);
+    free(script);
+    return failed;
+}
+
+typedef struct
+{
+    char **scripts;
+    size_t *lens;
+    si_program **serial;
+    size_t count;
+    // Where in the scripts this thread starts, so the threads compile different scripts at the same time
+    size_t first;
+    size_t mismatches;
+    size_t compiled;
+} compile_worker;
+
+// Odd scripts are optimized, so both the compiler and the optimizer run on many threads at once
+si_options stress_options(const size_t i)
+{
+    return (si_options){i & 1, ignore_message, NULL, 1};
+}
+
+void run_compile_worker(void *const arg)
+{
+    compile_worker *w = arg;
+    for (size_t k = 0; k < w->count; k++)
+    {
+        size_t i = (w->first + k) % w->count;
+        si_options options = stress_options(i);
+        si_program *p = si_compile_buffer(w->scripts[i], w->lens[i], &options);
+        if (!p || !same_program(&p->p, &w->serial[i]->p))
+            w->mismatches++;
+        w->compiled++;
+        si_program_free(p);
+    }
+}
+
+// Compiles count generated scripts of every workload on one thread, then compiles all of them again on each of
+// threads threads at once, and fails if any program differs from the one compiled alone. Compiles share only the
+// keyboard layouts, so this checks that nothing else is shared by accident
+int bench_compile_mt(const size_t count, const size_t threads)
+{
+    char **scripts = malloc(count * sizeof(char *));
+    size_t *lens = malloc(count * sizet_size);
+    si_program **serial = malloc(count * sizeof(si_program *));
+    compile_worker *workers = malloc(threads * sizeof(compile_worker));
+    thread *pool = malloc(threads * sizeof(thread));
+    if (!scripts || !lens || !serial || !workers || !pool)
+        handle_error("Error running benchmark");
+    int failed = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        scripts[i] = workloads[i % workload_count].generate(((i * 7 % 16) + 1) << 10, &lens[i]);
+        si_options options = stress_options(i);
+        serial[i] = si_compile_buffer(scripts[i], lens[i], &options);
+        if (!serial[i])
+        {
+            puts("Error: generated script did not compile");
+            failed = 1;
+        }
+    }
+    size_t mismatches = 0, compiled = 0;
+    uint64_t start = now_ns();
+    if (!failed)
+    {
+        for (size_t t = 0; t < threads; t++)
+        {
+            workers[t] = (compile_worker){.scripts = scripts, .lens = lens, .serial = serial, .count = count, .first = t * count / threads};
+            start_thread(&pool[t], run_compile_worker, &workers[t]);
+        }
+        for (size_t t = 0; t < threads; t++)
+        {
+            join_thread(&pool[t]);
+            mismatches += workers[t].mismatches;
+            compiled += workers[t].compiled;
+        }
+    }
+    uint64_t time = now_ns() - start;
+    printf("scripts,threads,compiles,mismatches,compiles_per_s\n");
+    printf("%zu,%zu,%zu,%zu,%.0f\n", count, threads, compiled, mismatches, compiled * 1e9 / (time ? time : 1));
+    if (mismatches)
+    {
+        printf("Error: %zu compiles on several threads gave a different program than on one\n", mismatches);
+        failed = 1;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        si_program_free(serial[i]);
+        free(scripts[i]);
+    }
+    free(scripts);
+    free(lens);
+    free(serial);
+    free(workers);
+    free(pool);
+    return failed;
+}
+
+// Writes a generated script to stdout, so it can be given to simulate or kept
+int bench_generate(const char *const name, const size_t size)
+{
+    const workload *w = find_workload(name);
+    if (!w)
+        return 1;
+    size_t len;
+    char *script = w->generate(size, &len);
+#ifdef _WIN32
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    int failed = fwrite(script, 1, len, stdout) != len;
+    free(script);
+    return failed;
+}
+
+// Compiles and plays every workload, or only the one named, into the output that unpacks every input, printing one
+// line of CSV for each. Peak RSS is the most the process has used so far, so it is only for that workload when it is
+// run on its own
+int bench_suite(const size_t size, const char *const name, const int runs)
+{
+    const workload *only = name ? find_workload(name) : NULL;
+    if (name && !only)
+        return 1;
+    si_options options = {0, ignore_message, NULL, 1};
+    expander *x = calloc(1, sizeof(expander));
+    if (!x)
+        handle_error("Error running benchmark");
+    printf("workload,bytes,compile_mb_per_s,program_kb,peak_rss_kb,instructions,instructions_per_s,inputs,inputs_per_s\n");
+    for (const workload *w = only ? only : workloads; w < (only ? only + 1 : workloads + workload_count); w++)
+    {
+        size_t len;
+        char *script = w->generate(size, &len);
+        si_program *p = NULL;
+        uint64_t compile_best = UINT64_MAX;
+        for (int run = 0; run < runs; run++)
+        {
+            si_program_free(p);
+            uint64_t start = now_ns();
+            p = si_compile_buffer(script, len, &options);
+            uint64_t time = now_ns() - start;
+            if (!p)
+            {
+                printf("Error: %s did not compile\n", w->name);
+                return 1;
+            }
+            if (time < compile_best)
+                compile_best = time;
+        }
+        free(script);
+        uintmax_t executed, calls;
+        count_program(&p->p, &executed, &calls);
+        sink out = {.send = expand_send, .sleep = null_sleep, .flush = no_flush, .close = no_flush, .data = x};
+        uint64_t run_best = UINT64_MAX;
+        for (int run = 0; run < runs; run++)
+        {
+            x->sent = 0;
+            uint64_t start = now_ns();
+            execute(&p->p, &out, NULL);
+            uint64_t time = now_ns() - start;
+            if (time < run_best)
+                run_best = time;
+        }
+        printf("%s,%zu,%.1f,%zu,%zu,%ju,%.0f,%llu,%.0f\n", w->name, len, len * 1000.0 / compile_best,
+               p->p.memory->peak / 1024, peak_rss_kb(), executed, executed * 1e9 / run_best,
+               (unsigned long long)x->sent, x->sent * 1e9 / run_best);
+        si_program_free(p);
+    }
+    free(x);
+    return 0;
+}
+
+typedef struct
+{
+    uint64_t hash;
+    uint64_t sent;
+    uint64_t first_sleep;
+    uint64_t sleeps;
+} hasher;
+
+void hash_words(hasher *const h, const uint64_t *const words, const size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+        h->hash = (h->hash ^ words[i]) * 0x100000001b3;
+}
+
+// Hashes every input as it is unpacked, so two programs can be checked to send the same thing
+size_t hash_send(struct sink *const out, const event *const events, const size_t len)
+{
+    hasher *h = out->data;
+    for (size_t i = 0; i < len; i++)
+    {
+        motion m = unpack_motion(out, &events[i]);
+        const uint64_t words[] = {events[i].type, events[i].type == event_key ? events[i].key : events[i].type == event_text ? events[i].text : 0, events[i].flags,
+                                  (uint32_t)m.dx, (uint32_t)m.dy, (uint32_t)m.wheel};
+        hash_words(h, words, sizeof(words) / sizeof(words[0]));
+    }
+    h->sent += len;
+    return len;
+}
+
+// Sleeps are hashed from the first one, since they are timed from when the run started
+uint64_t hash_sleep(struct sink *const out, const uint64_t until)
+{
+    hasher *h = out->data;
+    if (!h->sleeps++)
+        h->first_sleep = until;
+    const uint64_t words[] = {UINT64_MAX, until - h->first_sleep};
+    hash_words(h, words, 2);
+    return 0;
+}
+
+// Whether two programs play the same inputs with the same sleeps between them
+int same_playback(const program *const a, const program *const b)
+{
+    hasher h[2] = {{0}};
+    const program *const p[2] = {a, b};
+    for (int i = 0; i < 2; i++)
+    {
+        sink out = {.send = hash_send, .sleep = hash_sleep, .flush = no_flush, .close = no_flush, .data = &h[i]};
+        execute(p[i], &out, NULL);
+    }
+    return h[0].hash == h[1].hash && h[0].sent == h[1].sent && h[0].sleeps == h[1].sleeps && a->depth == b->depth &&
+           a->warnings == b->warnings;
+}
+
+// The last place before at where nothing is open, so an edit there keeps the script valid
+size_t top_level(const char *const data, const size_t len, const size_t at)
+{
+    split_state s = {0, 0, 0, 0, NULL, 0};
+    size_t last = 0;
+    for (size_t pos = 0; pos < at && pos < len;)
+    {
+        if (!s.group && !s.brackets && !s.loops)
+            last = pos;
+        scan_command(&s, data, len, &pos);
+    }
+    return last;
+}
+
+// Keeps a generated script compiled while edits of growing size are made in its middle and then undone, timing each
+// update against compiling the whole script and checking the result plays the same as a fresh compile
+int bench_watch(const size_t size)
+{
+    size_t len;
+    char *script = generate_script(size, &len);
+    si_options options = {0, ignore_message, NULL, 1};
+    uint64_t start = now_ns();
+    si_program *fresh = si_compile_buffer(script, len, &options);
+    uint64_t full = now_ns() - start;
+    if (!fresh)
+    {
+        puts("Error: generated script did not compile");
+        return 1;
+    }
+    si_program_free(fresh);
+    watch w;
+    new_watch(&w);
+    w.report = ignore_message;
+    char *data = malloc(len);
+    if (!data)
+        handle_error("Error running benchmark");
+    memcpy(data, script, len);
+    start = now_ns();
+    update_watch(&w, data, len);
+    printf("watch: %zu bytes, %zu segments, full compile %llu us, first update %llu us\n", len, w.count,
+           (unsigned long long)(full / 1000), (unsigned long long)((now_ns() - start) / 1000));
+    printf("edit,edit_bytes,compiled_bytes,segments,update_us,same\n");
+    int failed = 0;
+    static const size_t sizes[] = {16, 1 << 10, 1 << 16, 1 << 20};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        size_t insert_len;
+        char *insert = generate_script(sizes[i], &insert_len);
+        size_t at = top_level(script, len, len / 2);
+        for (int undo = 0; undo < 2; undo++)
+        {
+            size_t edited_len = undo ? len : len + insert_len;
+            char *edited = malloc(edited_len);
+            if (!edited)
+                handle_error("Error running benchmark");
+            memcpy(edited, script, at);
+            if (!undo)
+                memcpy(edited + at, insert, insert_len);
+            memcpy(edited + edited_len - (len - at), script + at, len - at);
+            si_program *p = si_compile_buffer(edited, edited_len, &options);
+            start = now_ns();
+            int ok = update_watch(&w, edited, edited_len);
+            uint64_t time = now_ns() - start;
+            int same = ok && p && same_playback(&w.p, &p->p);
+            failed |= !same;
+            printf("%s,%zu,%zu,%zu,%llu,%s\n", undo ? "undo" : "insert", insert_len, w.compiled_bytes,
+                   w.compiled_segments, (unsigned long long)(time / 1000), same ? "yes" : "no");
+            si_program_free(p);
+        }
+        free(insert);
+    }
+    free_watch(&w);
+    free(script);
+    return failed;
+}
+
+// Whether a program file, changed by damage, still loads. The file is read into memory, so the damage does not touch
+// the file itself
+int loads_damaged(const char *const path, void (*const damage)(char *data, const program_header *header))
+{
+    FILE *file = fopen(path, "rb");
+    vector v = {NULL, 0, 0, 1, NULL};
+    char buffer[4096];
+    for (size_t n; file && (n = fread(buffer, 1, sizeof(buffer), file));)
+    {
+        reserve(&v, v.len + n);
+        memcpy((char *)v.data + v.len, buffer, n);
+        v.len += n;
+    }
+    if (file)
+        fclose(file);
+    if (v.len < sizeof(program_header))
+        handle_error("Error running benchmark");
+    program_header header;
+    memcpy(&header, v.data, sizeof(header));
+    if (damage)
+        damage(v.data, &header);
+    mapping m = {v.data, v.len};
+    program p;
+    int loaded = load_program(&p, &m, 0);
+    free(v.data);
+    return loaded;
+}
+
+// The loop ends of the program, which has two
+void loop_ends(char *const data, const program_header *const header, instruction **const ends)
+{
+    instruction *codes = (instruction *)(data + header->offsets[0]);
+    for (size_t i = 0, n = 0; i < header->lens[0]; i++)
+        if (codes[i].opcode == 1 && n < 2)
+            ends[n++] = &codes[i];
+}
+
+// Makes the loops cross, with the inner end going back to the outer start and the other way around
+void cross_loops(char *const data, const program_header *const header)
+{
+    instruction *ends[2];
+    loop_ends(data, header, ends);
+    uintmax_t inner = ends[0]->immediate;
+    ends[0]->immediate = ends[1]->immediate;
+    ends[1]->immediate = inner;
+}
+
+// Points both loop ends at the outer start, leaving the inner loop open
+void share_start(char *const data, const program_header *const header)
+{
+    instruction *ends[2];
+    loop_ends(data, header, ends);
+    ends[0]->immediate = ends[1]->immediate;
+}
+
+// Leaves room for one loop counter when two loops are open at once
+void shallow(char *const data, const program_header *const header)
+{
+    (void)header;
+    uint64_t depth = 1;
+    memcpy(data + offsetof(program_header, depth), &depth, sizeof(depth));
+}
+
+// Writes a program with two nested loops and checks that it loads as written and that each damaged copy is rejected,
+// since --run-compiled and --serve run whatever file they are given once it loads
+int bench_load()
+{
+    static const char *const names[] = {"as written", "crossed loops", "shared loop start", "too shallow"};
+    void (*const damages[])(char *, const program_header *) = {NULL, cross_loops, share_start, shallow};
+    char path[64];
+#ifdef _WIN32
+    snprintf(path, sizeof(path), "simulate-bench-%lu.sip", (unsigned long)GetCurrentProcessId());
+#else
+    snprintf(path, sizeof(path), "/tmp/simulate-bench-%ld.sip", (long)getpid());
+#endif
+    si_program *p = si_compile_buffer("{2{2L}}", 7, NULL);
+    if (!p || !write_program(&p->p, 0, path))
+    {
+        puts("Error: could not write the program");
+        si_program_free(p);
+        return 1;
+    }
+    si_program_free(p);
+    int failed = 0;
+    printf("program,loaded,expected\n");
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    {
+        int loaded = loads_damaged(path, damages[i]);
+        printf("%s,%s,%s\n", names[i], loaded ? "yes" : "no", i ? "no" : "yes");
+        failed |= loaded != !i;
+    }
+    remove(path);
+    return failed;
+}
+
+int main(const int argc, const char **const argv)
+{
+    if (argc < 2)
+    {
+        puts("Usage: simulate-bench compile [megabytes] [threads]\n"
+             "       simulate-bench compile-mt [scripts] [threads]\n"
+             "       simulate-bench play [megabytes]\n"
+             "       simulate-bench alloc [megabytes]\n"
+             "       simulate-bench lex [megabytes]\n"
+             "       simulate-bench keys [megabytes]\n"
+             "       simulate-bench interp\n"
+             "       simulate-bench rate\n"
+             "       simulate-bench queue\n"
+             "       simulate-bench pipeline [megabytes]\n"
+             "       simulate-bench suite [megabytes] [workload]\n"
+             "       simulate-bench generate <workload> [megabytes]\n"
+             "       simulate-bench serve [jobs] [clients] [cache_kilobytes]\n"
+             "       simulate-bench watch [megabytes]\n"
+             "       simulate-bench path [steps]\n"
+             "       simulate-bench text [megabytes]\n"
+             "       simulate-bench load\n"
+             "Workloads: mixed, prose, nesting, loops, mouse, groups");
+        return 1;
+    }
+    if (!strcmp(argv[1], "compile"))
+    {
+        size_t size = argc > 2 ? strtoul(argv[2], NULL, 10) : 32;
+        size_t max = argc > 3 ? strtoul(argv[3], NULL, 10) : cpu_count();
+        return bench_compile(size << 20, max ? max : 1, 3);
+    }
+    if (!strcmp(argv[1], "compile-mt"))
+    {
+        size_t count = argc > 2 ? strtoul(argv[2], NULL, 10) : 300;
+        size_t threads = argc > 3 ? strtoul(argv[3], NULL, 10) : cpu_count() * 2;
+        return bench_compile_mt(count ? count : 1, threads ? threads : 1);
+    }
+    if (!strcmp(argv[1], "play"))
+        return bench_play((argc > 2 ? strtoul(argv[2], NULL, 10) : 32) << 20, 3);
+    if (!strcmp(argv[1], "lex"))
+        return bench_lex((argc > 2 ? strtoul(argv[2], NULL, 10) : 32) << 20, 5);
+    if (!strcmp(argv[1], "rate"))
+        return bench_rate();
+    if (!strcmp(argv[1], "suite"))
+        return bench_suite((argc > 2 ? strtoul(argv[2], NULL, 10) : 1) << 20, argc > 3 ? argv[3] : NULL, 3);
+    if (!strcmp(argv[1], "generate") && argc > 2)
+        return bench_generate(argv[2], (argc > 3 ? strtoul(argv[3], NULL, 10) : 1) << 20);
+    if (!strcmp(argv[1], "pipeline"))
+        return bench_pipeline((argc > 2 ? strtoul(argv[2], NULL, 10) : 32) << 20, 3);
+    if (!strcmp(argv[1], "queue"))
+        return bench_queue();
+    if (!strcmp(argv[1], "serve"))
+    {
+        size_t jobs = argc > 2 ? strtoul(argv[2], NULL, 10) : 10000;
+        size_t clients = argc > 3 ? strtoul(argv[3], NULL, 10) : 8;
+        size_t limit = argc > 4 ? strtoul(argv[4], NULL, 10) << 10 : 0;
+        return bench_serve(jobs ? jobs : 1, clients ? clients : 1, limit);
+    }
+    if (!strcmp(argv[1], "watch"))
+        return bench_watch((argc > 2 ? strtoul(argv[2], NULL, 10) : 10) << 20);
+    if (!strcmp(argv[1], "path"))
+    {
+        uint64_t steps = argc > 2 ? strtoull(argv[2], NULL, 10) : 10000;
+        return bench_path(steps ? steps : 1, 5);
+    }
+    if (!strcmp(argv[1], "load"))
+        return bench_load();
+    if (!strcmp(argv[1], "text"))
+        return bench_text((argc > 2 ? strtoul(argv[2], NULL, 10) : 1) << 20, 3);
+    if (!strcmp(argv[1], "interp"))
+        return bench_interp(5);
+    if (!strcmp(argv[1], "keys"))
+        return bench_keys(argc > 2 ? strtoul(argv[2], NULL, 10) : 32);
+    if (!strcmp(argv[1], "alloc"))
+        return bench_alloc(argc > 2 ? strtoul(argv[2], NULL, 10) : 32);
+    puts("Error: Unknown benchmark");
+    return 1;
+}
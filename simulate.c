@@ -1,742 +1,7167 @@
-/*  A program to simulate keyboard and mouse inputs
-    Copyright (C) 2025 Anonymous1212144
-
-    This program is free software: you can redistribute it and/or modify
-    it under the terms of the GNU General Public License as published by
-    the Free Software Foundation, either version 3 of the License, or
-    (at your option) any later version.
-
-    This program is distributed in the hope that it will be useful,
-    but WITHOUT ANY WARRANTY; without even the implied warranty of
-    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
-    GNU General Public License for more details.
-
-    You should have received a copy of the GNU General Public License
-    along with this program.  If not, see <https://www.gnu.org/licenses/>.
-*/
-
-#include <stdlib.h>
-#include <stdint.h>
-#include <stdio.h>
-#include <string.h>
-#include <windows.h>
-
-typedef struct
-{
-    int opcode;
-    uintmax_t immediate;
-} instruction;
-
-typedef struct
-{
-    INPUT *input;
-    size_t len;
-} sequence;
-
-typedef struct
-{
-    void *data;
-    size_t len;
-    size_t cap;
-    size_t unit;
-} vector;
-
-enum
-{
-    instruction_size = sizeof(instruction),
-    sequence_size = sizeof(sequence),
-    input_obj_size = sizeof(INPUT),
-    sizet_size = sizeof(size_t),
-    uintmax_size = sizeof(uintmax_t),
-};
-
-vector inputs = {NULL, 0, 0, sequence_size};
-vector codes = {NULL, 0, 0, instruction_size};
-int crash = 0;
-uintmax_t *memory;
-
-void handle_error(const char *const prompt)
-{
-    perror(prompt);
-    exit(EXIT_FAILURE);
-}
-
-void expand(vector *v)
-{
-    if (v->len == v->cap)
-    {
-        if (!v->cap)
-            v->cap++;
-        else
-        {
-            v->cap <<= 1;
-            if (!v->cap)
-                v->cap--;
-        }
-        v->data = realloc(v->data, v->cap * v->unit);
-        if (!v->data)
-            handle_error("Error compiling");
-    }
-}
-
-char *put_num(char *buffer, const uintmax_t num)
-{
-    if (num >= 10)
-        buffer = put_num(buffer, num / 10);
-    *buffer = '0' + num % 10;
-    return buffer + 1;
-}
-
-void print_num(const char *const prefix, const char *const suffix, const size_t prefix_len, const size_t suffix_len, const uintmax_t num)
-{
-    char *buffer = malloc(prefix_len + suffix_len + uintmax_size - 1);
-    memcpy(buffer, prefix, prefix_len - 1);
-    memcpy(put_num(buffer + prefix_len - 1, num), suffix, suffix_len);
-    puts(buffer);
-    free(buffer);
-}
-
-void print_msg(const char *const prefix, const char *const suffix, const size_t prefix_len, const size_t suffix_len, const char c, const size_t index)
-{
-    char *buffer = malloc(prefix_len + suffix_len - 1);
-    memcpy(buffer, prefix, prefix_len - 1);
-    if (c)
-        buffer[index] = c;
-    memcpy(buffer + prefix_len - 1, suffix, suffix_len);
-    puts(buffer);
-    free(buffer);
-}
-
-void error(const char *const prompt, const size_t prompt_len, const char c)
-{
-    print_msg("Error reading \"c\": ", prompt, 20, prompt_len, c, 15);
-    exit(EXIT_FAILURE);
-}
-
-void warn(const char *const prompt, const size_t prompt_len, const char c)
-{
-    if (c)
-        print_msg("Warning for character \"c\": ", prompt, 28, prompt_len, c, 23);
-    else
-        print_msg("Warning for EOF: ", prompt, 18, prompt_len, 0, 0);
-    if (crash)
-        crash++;
-}
-
-size_t read(const char *const chars, const int char_set)
-{
-    // 0 for all, 1 for 0-9, 2 for numpad, 3 for 0-9a-fA-F
-    int first = 1;
-    const char *ptr = chars;
-    int exit = 0;
-    for (; *ptr != '\n' && *ptr != '\r'; ptr++)
-    {
-        switch (char_set)
-        {
-        case 1:
-            if ((*ptr < 48 && !(first && *ptr == 45)) || *ptr > 57)
-                exit = 1;
-            break;
-        case 2:
-            if (*ptr < 42 || *ptr > 57)
-                exit = 1;
-            break;
-        case 3:
-            if (*ptr < 71)
-            {
-                if (*ptr < 58)
-                {
-                    if (*ptr < 48)
-                        exit = 1;
-                }
-                else if (*ptr < 65)
-                    exit = 1;
-            }
-            else if (*ptr < 103)
-            {
-                if (*ptr < 97)
-                    exit = 1;
-            }
-            else
-                exit = 1;
-            break;
-        }
-        if (exit)
-            break;
-        first = 0;
-    }
-    if (!(ptr - chars))
-        warn("Nothing read", 13, *(ptr - 1));
-    return ptr - chars;
-}
-
-uintmax_t parse_num(const char *chars, const size_t len, const int type)
-{
-    // type is 0 for base10 and 1 for base16
-    uintmax_t output = 0;
-    int cof = 1;
-    if (type)
-    {
-        for (size_t i = 0; i < len; i++, chars++)
-        {
-            output <<= 4;
-            char c = *chars;
-            if (c < 58)
-                output |= c - 48;
-            else if (c < 91)
-                output |= c - 55;
-            else
-                output |= c - 87;
-        }
-    }
-    else
-    {
-        for (size_t i = 0; i < len; i++, chars++)
-        {
-            output *= 10;
-            char c = *chars;
-            if (c == '-')
-                cof = -1;
-            else
-                output += c - 48;
-        }
-    }
-    return cof * output;
-}
-
-void add_code(const int opcode, const uintmax_t immediate)
-{
-    expand(&codes);
-    ((instruction *)codes.data)[codes.len].opcode = opcode;
-    ((instruction *)codes.data)[codes.len].immediate = immediate;
-    codes.len++;
-}
-
-void add_event(const int type, const uintmax_t *const data)
-{
-    static size_t mem_needed = 0;
-
-    static vector loop = {NULL, 0, 0, sizet_size};
-    static vector stack = {NULL, 0, 0, input_obj_size};
-    static vector repeats = {NULL, 0, 0, sizet_size};
-    uintmax_t num_repeat = 0;
-
-    static int group_state = 9;
-    static uintmax_t sleep = 0;
-
-    switch (type)
-    {
-    case 0:
-        // begin loop
-        if (group_state & 4)
-        {
-            warn("Missing \")\", added automatically", 33, '}');
-            add_event(5, (uintmax_t[]){1});
-        }
-        while (repeats.len)
-        {
-            warn("Missing \"]\", added automatically", 33, '}');
-            add_event(6, (uintmax_t[]){1});
-        }
-
-        expand(&loop);
-        if (++loop.len > mem_needed)
-            mem_needed = loop.len;
-        ((size_t *)loop.data)[loop.len - 1] = codes.len;
-        if (!data[0])
-        {
-            warn("Invalid loop count, assuming loop of 1", 39, '{');
-            add_code(type, 1);
-        }
-        else
-            add_code(type, data[0]);
-        break;
-    case 1:
-        // end loop
-        if (group_state & 4)
-        {
-            warn("Missing \")\", added automatically", 33, '}');
-            add_event(5, (uintmax_t[]){1});
-        }
-        while (repeats.len)
-        {
-            warn("Missing \")\", added automatically", 33, '}');
-            add_event(6, (uintmax_t[]){1});
-        }
-
-        loop.len--;
-        add_code(type, ((size_t *)loop.data)[loop.len]);
-        break;
-    case 2:
-        // execute
-        if (data[0] && group_state & 4)
-        {
-            warn("Keyboard commands for mouse, ignored", 37, '(');
-            break;
-        }
-        if (group_state & 1)
-        {
-            if (group_state & 8)
-            {
-                stack.data = calloc(1, stack.unit);
-                if (!stack.data)
-                    handle_error("Error compiling");
-                stack.len = 0;
-                stack.cap = 1;
-                group_state |= 16;
-                group_state &= ~8;
-            }
-            size_t old_cap = stack.cap;
-            expand(&stack);
-            if (old_cap != stack.cap)
-                memset(&((INPUT *)stack.data)[old_cap], 0, (stack.cap - old_cap) * stack.unit);
-            group_state |= 2;
-            group_state &= ~1;
-        }
-
-        INPUT *curr = &((INPUT *)stack.data)[stack.len];
-
-        if (data[0])
-        {
-            curr->type = INPUT_KEYBOARD;
-            curr->ki.wVk = data[1];
-            if (data[2])
-                curr->ki.dwFlags = KEYEVENTF_KEYUP;
-        }
-        else
-        {
-            curr->mi.dwFlags |= data[1];
-            if (data[1] == MOUSEEVENTF_WHEEL)
-            {
-                curr->mi.mouseData = data[2];
-            }
-            else if (data[1] == MOUSEEVENTF_MOVE)
-            {
-                curr->mi.dx = data[2];
-                curr->mi.dy = data[3];
-                if (data[4])
-                    curr->mi.dwFlags |= MOUSEEVENTF_ABSOLUTE;
-            }
-        }
-        break;
-    case 3:
-        // sleep
-        if (repeats.len)
-            warn("Sleep command in arrayed inputs, ignored", 41, 's');
-        else
-            add_code(type, data[0]);
-        break;
-    case 4:
-        // repeated sleep
-        sleep = data[0];
-        break;
-    case 5:
-        // simultaneous mouse events
-        if (data[0])
-        {
-            if (!(group_state & 2))
-                warn("No instructions", 16, ')');
-            if (group_state & 4)
-                group_state &= ~4;
-            else
-                warn("Mismatched brackets, ignored", 29, ')');
-        }
-        else
-        {
-            if (group_state & 4)
-                warn("Nested brackets, ignored", 25, '(');
-            else
-                group_state |= 4;
-        }
-        break;
-    case 6:
-        // repeated/copied and arrayed events
-        if (data[0])
-        {
-            if (!repeats.len)
-            {
-                warn("Mismatched brackets, ignored", 29, ']');
-                break;
-            }
-            if (group_state & 4)
-            {
-                warn("Missing \")\", added automatically", 33, ']');
-                add_event(5, (uintmax_t[]){1});
-            }
-            if (!(num_repeat = data[1]))
-                warn("Invalid copy count, assuming copy of 1", 39, ']');
-            repeats.len--;
-            if (!repeats.len)
-                group_state &= ~32;
-
-            size_t i0 = ((size_t *)repeats.data)[repeats.len];
-            size_t si = stack.len - i0;
-            if (!si)
-            {
-                warn("No instructions", 16, ']');
-                break;
-            }
-            if (num_repeat > 1)
-            {
-                size_t i1 = si * num_repeat + i0;
-                size_t size = si * stack.unit;
-                size_t dlen = si * num_repeat * stack.unit;
-
-                if (((size_t)-1) / size < num_repeat)
-                    error("Too many instructions", 23, ']');
-                stack.data = realloc(stack.data, i1 * stack.unit);
-                if (!stack.data)
-                    handle_error("Error compiling");
-
-                char *start = (char *)stack.data + i0 * stack.unit;
-                char *index = (char *)stack.data + stack.len * stack.unit;
-
-                while (1)
-                {
-                    memcpy(index, start, size);
-                    index += size;
-                    size <<= 1;
-                    if ((size << 1) > dlen)
-                    {
-                        if (dlen - size)
-                            memcpy(index, start, dlen - size);
-                        break;
-                    }
-                }
-                stack.len = i1;
-                stack.cap = i1;
-            }
-        }
-        else
-        {
-            if (group_state & 4)
-            {
-                warn("Missing \")\", added automatically", 33, ']');
-                add_event(5, (uintmax_t[]){1});
-            }
-
-            expand(&repeats);
-            if (!repeats.len)
-                stack.len = 0;
-            ((size_t *)repeats.data)[repeats.len] = stack.len;
-            repeats.len++;
-            group_state |= 32;
-        }
-        break;
-    case 7:
-        // finalize
-        if (group_state & 4)
-        {
-            warn("Missing \")\", added automatically", 33, 0);
-            add_event(5, (uintmax_t[]){1});
-        }
-        while (repeats.len)
-        {
-            warn("Missing \"]\", added automatically", 33, 0);
-            add_event(6, (uintmax_t[]){1, 0});
-        }
-        while (loop.len--)
-        {
-            warn("Missing \"}\", added automatically", 33, 0);
-            add_code(1, ((size_t *)loop.data)[loop.len]);
-        }
-
-        free(loop.data);
-        free(repeats.data);
-        memory = malloc(mem_needed * uintmax_size);
-        return;
-    }
-
-    if (!(group_state & 4))
-    {
-        if ((group_state & 6) == 2)
-        {
-            stack.len++;
-            group_state &= ~2;
-            group_state |= 1;
-        }
-        if ((group_state & 48) == 16)
-        {
-            expand(&inputs);
-            ((sequence *)inputs.data)[inputs.len].input = stack.data;
-            ((sequence *)inputs.data)[inputs.len].len = stack.len;
-            add_code(2, inputs.len);
-            if (sleep)
-                add_code(3, sleep);
-            inputs.len++;
-            group_state &= ~16;
-            group_state |= 8;
-        }
-    }
-}
-
-void parse_keys(const char *chars, const size_t len, const HKL layout)
-{
-    int state = 0;
-    for (size_t i = 0; i < len; i++, chars++)
-    {
-        int key = VkKeyScanExA(*chars, layout);
-        if (key == 0xFFFF)
-        {
-            warn("Invalid key, ignored", 21, *chars);
-            continue;
-        }
-        int state_new = (key >> 8) & 255;
-        int state2 = state_new ^ state;
-        char low = key & 255;
-        if (state2)
-        {
-            if (state2 & 1)
-                add_event(2, (uintmax_t[]){1, VK_SHIFT, state & 1});
-            if (state2 & 2)
-                add_event(2, (uintmax_t[]){1, VK_CONTROL, state & 2});
-            if (state2 & 4)
-                add_event(2, (uintmax_t[]){1, VK_MENU, state & 4});
-            if (state2 >> 3)
-                warn("Keys other than shift, control, or alt required, skipped those keys", 68, *chars);
-        }
-        add_event(2, (uintmax_t[]){1, low, 0});
-        add_event(2, (uintmax_t[]){1, low, 1});
-        state = state_new;
-    }
-    if (state)
-    {
-        if (state & 1)
-            add_event(2, (uintmax_t[]){1, VK_SHIFT, 1});
-        if (state & 2)
-            add_event(2, (uintmax_t[]){1, VK_CONTROL, 1});
-        if (state & 4)
-            add_event(2, (uintmax_t[]){1, VK_MENU, 1});
-    }
-}
-
-void compile(const char *const code, const size_t chars)
-{
-    static HKL layout = NULL;
-    static const char words[] = "SswPpLlMmRrnkKCc()[]{}";
-    static const int mouse[] = {MOUSEEVENTF_LEFTDOWN, MOUSEEVENTF_LEFTUP, MOUSEEVENTF_MIDDLEDOWN, MOUSEEVENTF_MIDDLEUP, MOUSEEVENTF_RIGHTDOWN, MOUSEEVENTF_RIGHTUP};
-    const char *ptr = code;
-    while (ptr - code < chars)
-    {
-        char c = *(ptr++);
-        if (c == '\n' || c == '\r')
-            continue;
-        int state;
-        for (state = 0; c != words[state] && state < 22; state++)
-            ;
-        if (state == 22)
-        {
-            warn("Unknown command, ignored", 25, c);
-            continue;
-        }
-        if (state < 11)
-        {
-            if (state < 5)
-            {
-                size_t read_len = read(ptr, 1);
-                uintmax_t num = parse_num(ptr, read_len, 0);
-                ptr += read_len;
-                switch (state)
-                {
-                case 0:
-                    add_event(4, (uintmax_t[]){num});
-                    break;
-                case 1:
-                    add_event(3, (uintmax_t[]){num});
-                    break;
-                case 2:
-                    add_event(2, (uintmax_t[]){0, MOUSEEVENTF_WHEEL, num});
-                    break;
-                default:
-                {
-                    ptr++;
-                    read_len = read(ptr, 1);
-                    uintmax_t num2 = parse_num(ptr, read_len, 0);
-                    ptr += read_len;
-                    add_event(2, (uintmax_t[]){0, MOUSEEVENTF_MOVE, num, num2, state == 3});
-                    break;
-                }
-                }
-            }
-            else
-                add_event(2, (uintmax_t[]){0, mouse[state - 5]});
-        }
-        else
-        {
-            if (state < 16)
-            {
-                if (state == 11)
-                {
-                    size_t read_len = read(ptr, 2);
-                    for (size_t j = 0; j < read_len; j++, ptr++)
-                    {
-                        int key = *ptr;
-                        if (key < 48)
-                            key = key - 42 + VK_MULTIPLY;
-                        else
-                            key = key - 48 + VK_NUMPAD0;
-                        add_event(2, (uintmax_t[]){1, *ptr - 48 + VK_NUMPAD0, 0});
-                        add_event(2, (uintmax_t[]){1, *ptr - 48 + VK_NUMPAD0, 1});
-                    }
-                }
-                else if (state == 12)
-                {
-                    size_t read_len = read(ptr, 0);
-                    if (!layout)
-                        layout = LoadKeyboardLayoutA("00000409", 0);
-                    parse_keys(ptr, read_len, layout);
-                    ptr += read_len;
-                }
-                else
-                {
-                    size_t read_len = read(ptr, 3);
-                    if (state == 13)
-                    {
-                        char *slice = malloc(read_len + 1);
-                        memcpy(slice, ptr, read_len);
-                        slice[read_len] = 0;
-                        layout = LoadKeyboardLayoutA(slice, 0);
-                        free(slice);
-                        ptr += read_len;
-                    }
-                    else
-                    {
-                        if (read_len & 1)
-                        {
-                            add_event(2, (uintmax_t[]){1, parse_num(ptr, 1, 1), state == 15});
-                            ptr++;
-                        }
-                        read_len >>= 1;
-                        for (size_t j = 0; j < read_len; j++, ptr += 2)
-                            add_event(2, (uintmax_t[]){1, parse_num(ptr, 2, 1), state == 15});
-                    }
-                }
-            }
-            else
-            {
-                if (state == 16)
-                    add_event(5, (uintmax_t[]){0});
-                else if (state == 17)
-                    add_event(5, (uintmax_t[]){1});
-                else if (state == 18)
-                    add_event(6, (uintmax_t[]){0});
-                else if (state == 19)
-                {
-                    size_t read_len = read(ptr, 1);
-                    uintmax_t num = parse_num(ptr, read_len, 0);
-                    ptr += read_len;
-                    add_event(6, (uintmax_t[]){1, num});
-                }
-                else if (state == 20)
-                {
-                    size_t read_len = read(ptr, 1);
-                    uintmax_t num = parse_num(ptr, read_len, 0);
-                    ptr += read_len;
-                    add_event(0, (uintmax_t[]){num});
-                }
-                else
-                    add_event(1, NULL);
-            }
-        }
-    }
-    add_event(7, NULL);
-}
-
-void execute()
-{
-    sequence *seq = (sequence *)inputs.data;
-    instruction *ins = (instruction *)codes.data;
-    size_t m = -1;
-    for (size_t i = 0; i < codes.len; i++)
-    {
-        switch (ins[i].opcode)
-        {
-        case 0:
-            memory[++m] = ins[i].immediate;
-            break;
-        case 1:
-            if (--memory[m])
-                i = ins[i].immediate;
-            else
-                m--;
-            break;
-        case 2:
-            sequence input = seq[ins[i].immediate];
-            if (SendInput(input.len, input.input, input_obj_size) != input.len)
-                puts("Warning: some inputs failed to send");
-            break;
-        case 3:
-            Sleep(ins[i].immediate);
-            break;
-        default:
-            puts("Error: Internal error while executing, please submit the input file with a bug report");
-            exit(EXIT_FAILURE);
-            break;
-        }
-    }
-}
-
-int main(const int argc, const char **const argv)
-{
-    if (argc < 2)
-    {
-        puts("No file entered, defaulting to \"keys.txt\"");
-        argv[1] = "keys.txt";
-    }
-    const char *flag = "-W";
-    int unknowns = 0;
-    for (int i = 2; i < argc; i++)
-    {
-        size_t j = 0;
-        int match = 0;
-        char c;
-        while ((c = argv[i][j]))
-        {
-            if (c == flag[j])
-                match++;
-            else
-                break;
-            j++;
-        }
-        if (match == 2)
-        {
-            puts("Enabled error for warnings");
-            crash = 1;
-        }
-        else
-            unknowns++;
-    }
-    if (unknowns)
-        print_num("Ignored ", " unknown flags", 9, 15, unknowns);
-
-    FILE *file = fopen(argv[1], "rb");
-    if (file == NULL)
-        handle_error("Error opening file");
-    size_t keys_file_len;
-    fseek(file, 0, SEEK_END);
-    keys_file_len = ftell(file);
-    rewind(file);
-
-    // Allocate memory to store the file content
-    char *keys_file = malloc(keys_file_len + 1);
-    if (!keys_file)
-        handle_error("Error loading file");
-
-    // Read the file into the buffer
-    fread(keys_file, 1, keys_file_len, file);
-    keys_file[keys_file_len] = '\n';
-    fclose(file);
-    print_num("Read length: ", "\nCompiling...", 14, 15, keys_file_len);
-
-    compile(keys_file, keys_file_len);
-    if (crash > 1)
-    {
-        print_num("Error: ", " warnings generated", 8, 20, crash - 1);
-        exit(EXIT_FAILURE);
-    }
-    free(keys_file);
-    puts("Done compiling, press Enter to run");
-    int c = getchar();
-    if (c == '\r' || c == '\n')
-        execute();
-}
+/*  A program to simulate keyboard and mouse inputs
+    Copyright (C) 2025 Anonymous1212144
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+#include <setjmp.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "simulate.h"
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#endif
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <linux/uinput.h>
+#endif
+#endif
+
+// As a library only the si_ functions in simulate.h are visible, so nothing in here clashes with the program using it
+#if defined(SI_LIBRARY) && defined(__GNUC__) && !defined(_WIN32)
+#pragma GCC visibility push(hidden)
+#endif
+
+// Flags and key codes use the values of their Windows counterparts, so compiled programs are the same on every platform
+enum
+{
+    key_up = 0x0002,
+    mouse_move = 0x0001,
+    mouse_left_down = 0x0002,
+    mouse_left_up = 0x0004,
+    mouse_right_down = 0x0008,
+    mouse_right_up = 0x0010,
+    mouse_middle_down = 0x0020,
+    mouse_middle_up = 0x0040,
+    mouse_wheel = 0x0800,
+    mouse_absolute = 0x8000,
+    vk_shift = 0x10,
+    vk_control = 0x11,
+    vk_menu = 0x12,
+    vk_numpad0 = 0x60,
+    vk_multiply = 0x6A,
+};
+
+typedef struct
+{
+    int opcode;
+    uintmax_t immediate;
+} instruction;
+
+enum
+{
+    event_mouse,
+    event_key,
+    event_motion,
+    // A press or release of a Unicode char, only made as text is sent and never stored in a program
+    event_text,
+};
+
+// Inputs are packed into 8 bytes and only turned into what the output takes right before sending. Mouse movement is
+// kept in the input when it fits in 16 bits, otherwise the input is an event_motion and points into the motions
+typedef struct
+{
+    uint16_t flags;
+    uint8_t type;
+    uint8_t key;
+    union
+    {
+        int32_t wheel;
+        struct
+        {
+            uint16_t dx;
+            uint16_t dy;
+        } move;
+        uint32_t motion;
+        uint32_t text;
+    };
+} event;
+
+typedef struct
+{
+    int32_t dx;
+    int32_t dy;
+    int32_t wheel;
+} motion;
+
+enum
+{
+    path_linear,
+    path_ease,
+    path_bezier,
+};
+
+// A mouse path, which is stored once and only turned into moves as it is sent. The points are the start, the two
+// control points and the end, where the start of a relative path is 0,0 and only a Bézier curve uses the control
+// points. The steps are spread over duration microseconds, or sent at once when it is 0
+typedef struct
+{
+    int32_t points[8];
+    uint64_t steps;
+    uint64_t duration;
+    uint16_t flags;
+    uint8_t shape;
+    uint8_t reserved[5];
+} path;
+
+// The body of a "[]" is stored once and repeated as it is sent, begin and end are relative to the sequence
+typedef struct
+{
+    size_t begin;
+    size_t end;
+    uintmax_t count;
+} repeat;
+
+typedef struct
+{
+    size_t start;
+    size_t len;
+    size_t repeat;
+    size_t repeats;
+} sequence;
+
+// Everything a compile stores comes from one arena and is released together. Small allocations are packed into
+// shared blocks, big ones get a block each so they can still grow in place
+typedef struct block
+{
+    struct block *prev;
+    struct block *next;
+    size_t size;
+    size_t used;
+} block;
+
+typedef struct
+{
+    block *small;
+    block *large;
+    size_t heap_calls;
+    size_t reserved;
+    size_t peak;
+} arena;
+
+// Vectors with an arena grow inside it instead of on the heap
+typedef struct
+{
+    void *data;
+    size_t len;
+    size_t cap;
+    size_t unit;
+    arena *arena;
+} vector;
+
+// A compiled program, the vectors point into the program file instead when it is loaded from one
+typedef struct
+{
+    vector codes;
+    vector inputs;
+    vector events;
+    vector repeats;
+    vector motions;
+    vector paths;
+    // The UTF-8 of every "u", each ended by a 0
+    vector text;
+    size_t depth;
+    size_t warnings;
+    arena *memory;
+} program;
+
+typedef struct
+{
+    uint16_t c;
+    uint16_t key;
+} key_entry;
+
+// A keyboard layout with the VkKeyScanEx result of every char in the Basic Multilingual Plane, found a page of 256
+// chars at a time the first time one of them is typed. Layouts are shared by every compile and kept until exit
+typedef struct key_table
+{
+    struct key_table *next;
+    uint32_t id;
+#ifdef _WIN32
+    HKL handle;
+#else
+    const key_entry *keys;
+    size_t len;
+#endif
+    size_t lookups;
+    uint16_t *pages[256];
+} key_table;
+
+typedef key_table *keymap;
+
+#ifndef _WIN32
+// VkKeyScanExA results for the US layout, for platforms without one
+static const unsigned short us_keys[128] = {
+    [8] = 0x0008, [9] = 0x0009, [13] = 0x000D, [27] = 0x02DB, [28] = 0x02DC, [29] = 0x02DD, [32] = 0x0020,
+    ['!'] = 0x0131, ['"'] = 0x01DE, ['#'] = 0x0133, ['$'] = 0x0134, ['%'] = 0x0135, ['&'] = 0x0137, ['\''] = 0x00DE,
+    ['('] = 0x0139, [')'] = 0x0130, ['*'] = 0x0138, ['+'] = 0x01BB, [','] = 0x00BC, ['-'] = 0x00BD, ['.'] = 0x00BE,
+    ['/'] = 0x00BF, [':'] = 0x01BA, [';'] = 0x00BA, ['<'] = 0x01BC, ['='] = 0x00BB, ['>'] = 0x01BE, ['?'] = 0x01BF,
+    ['@'] = 0x0132, ['['] = 0x00DB, ['\\'] = 0x00DC, [']'] = 0x00DD, ['^'] = 0x0136, ['_'] = 0x01BD, ['`'] = 0x00C0,
+    ['{'] = 0x01DB, ['|'] = 0x01DC, ['}'] = 0x01DD, ['~'] = 0x01C0, [127] = 0x0208};
+
+// Chars the UK layout types differently from the US one, 6 in the high byte is AltGr
+static const key_entry uk_keys[] = {
+    {'"', 0x0132}, {0xA3, 0x0133}, {'@', 0x01C0}, {'\'', 0x00C0}, {'#', 0x00DE}, {'~', 0x01DE}, {'`', 0x00DF},
+    {0xAC, 0x01DF}, {0xA6, 0x06DF}, {'\\', 0x00E2}, {'|', 0x01E2}, {0x20AC, 0x0634}, {0xE1, 0x0641}, {0xE9, 0x0645},
+    {0xED, 0x0649}, {0xF3, 0x064F}, {0xFA, 0x0655}, {0xC1, 0x0741}, {0xC9, 0x0745}, {0xCD, 0x0749}, {0xD3, 0x074F},
+    {0xDA, 0x0755}};
+
+// Chars the German layout types differently from the US one
+static const key_entry de_keys[] = {
+    {'^', 0x00DC}, {0xB0, 0x01DC}, {'"', 0x0132}, {0xA7, 0x0133}, {'&', 0x0136}, {'/', 0x0137}, {'(', 0x0138},
+    {')', 0x0139}, {'=', 0x0130}, {0xDF, 0x00DB}, {'?', 0x01DB}, {0xB4, 0x00DD}, {'`', 0x01DD}, {0xFC, 0x00BA},
+    {0xDC, 0x01BA}, {'+', 0x00BB}, {'*', 0x01BB}, {'~', 0x06BB}, {0xF6, 0x00C0}, {0xD6, 0x01C0}, {0xE4, 0x00DE},
+    {0xC4, 0x01DE}, {'#', 0x00BF}, {'\'', 0x01BF}, {'<', 0x00E2}, {'>', 0x01E2}, {'|', 0x06E2}, {';', 0x01BC},
+    {':', 0x01BE}, {'_', 0x01BD}, {'@', 0x0651}, {0x20AC, 0x0645}, {'{', 0x0637}, {'[', 0x0638}, {']', 0x0639},
+    {'}', 0x0630}, {'\\', 0x06DB}, {0xB2, 0x0632}, {0xB3, 0x0633}, {0xB5, 0x064D}};
+
+typedef struct
+{
+    uint32_t id;
+    const key_entry *keys;
+    size_t len;
+} builtin_layout;
+
+static const builtin_layout builtin_layouts[] = {
+    {0x409, NULL, 0},
+    {0x809, uk_keys, sizeof(uk_keys) / sizeof(key_entry)},
+    {0x407, de_keys, sizeof(de_keys) / sizeof(key_entry)},
+};
+#endif
+
+// Where compile time went with --profile, in nanoseconds. Lexing is everything compile does that is not one of the
+// others, expansion is closing arrays and loops, and finalizing is ending the program, joining chunks and optimizing
+enum
+{
+    phase_read,
+    phase_lex,
+    phase_keys,
+    phase_expand,
+    phase_finalize,
+    phase_count,
+};
+
+typedef struct
+{
+    uint64_t ns[phase_count];
+} compile_profile;
+
+// Sequences by the hash of what they send, so one that sends the same as an earlier one can point at it instead
+typedef struct
+{
+    uint64_t hash;
+    size_t index;
+} shared_entry;
+
+typedef struct
+{
+    shared_entry *entries;
+    size_t cap;
+    size_t len;
+} sequence_table;
+
+// Tracks are compiled into code of their own, which is put together when the compile ends
+typedef struct
+{
+    uintmax_t number;
+    vector codes;
+    uintmax_t sleep;
+} track_code;
+
+// Everything a compile needs, so several can run at once
+typedef struct
+{
+    program p;
+    vector loop;
+    vector brackets;
+    vector slice;
+    size_t start;
+    size_t first_repeat;
+    size_t first_motion;
+    sequence_table shared;
+    // Sequences compiled, counting the ones that were the same as an earlier one, and the bytes those did not take up
+    uintmax_t sequences;
+    uintmax_t shared_bytes;
+    int group_state;
+    event pending;
+    motion pending_motion;
+    uintmax_t sleep;
+    // The code of every track once a "t" is read, with the one being compiled in p
+    vector tracks;
+    size_t track;
+    keymap layout;
+    // The pages of layout this compile has looked up, so the lock is only taken for new pages
+    const uint16_t *pages[256];
+    const char *key_cache;
+    void (*report)(void *user, const char *message);
+    void *user;
+    // Only timed when this is not NULL
+    compile_profile *profile;
+    jmp_buf fail;
+} compiler;
+
+enum
+{
+    instruction_size = sizeof(instruction),
+    sequence_size = sizeof(sequence),
+    event_size = sizeof(event),
+    repeat_size = sizeof(repeat),
+    motion_size = sizeof(motion),
+    path_size = sizeof(path),
+    // Codes, inputs, events, repeats, motions, paths, and text
+    section_count = 7,
+    sizet_size = sizeof(size_t),
+    uintmax_size = sizeof(uintmax_t),
+    uintmax_digits = 20,
+    message_size = 128,
+    arena_align = 16,
+    arena_first = 1 << 12,
+    arena_large = 1 << 16,
+};
+
+typedef struct
+{
+    const char *data;
+    size_t len;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE map;
+#endif
+} mapping;
+
+struct si_program
+{
+    program p;
+    mapping map;
+    // 1 if the program points into a mapped file, 2 if into a copy of the file read into memory
+    int mapped;
+};
+
+#ifdef _MSC_VER
+#define thread_local_var __declspec(thread)
+#else
+#define thread_local_var _Thread_local
+#endif
+
+// Where a failure jumps back to on this thread when a library call is running, so the library never ends the process
+// it is loaded into. The program itself leaves it unset and exits
+thread_local_var jmp_buf *recover;
+
+void handle_error(const char *const prompt)
+{
+    if (recover)
+        longjmp(*recover, 1);
+    perror(prompt);
+    exit(EXIT_FAILURE);
+}
+
+void count_block(arena *const a, const size_t old_size, const size_t size)
+{
+    a->heap_calls++;
+    a->reserved += size - old_size;
+    if (a->reserved > a->peak)
+        a->peak = a->reserved;
+}
+
+// The arena itself is the first thing in its first block
+arena *new_arena()
+{
+    block *b = malloc(sizeof(block) + arena_first);
+    if (!b)
+        handle_error("Error compiling");
+    *b = (block){NULL, NULL, arena_first, sizeof(arena)};
+    arena *a = (arena *)(b + 1);
+    *a = (arena){b, NULL, 0, 0, 0};
+    count_block(a, 0, arena_first);
+    return a;
+}
+
+void *arena_alloc(arena *const a, size_t size)
+{
+    size = (size + arena_align - 1) / arena_align * arena_align;
+    if (size >= arena_large)
+    {
+        block *b = malloc(sizeof(block) + size);
+        if (!b)
+            handle_error("Error compiling");
+        *b = (block){NULL, a->large, size, size};
+        if (a->large)
+            a->large->prev = b;
+        a->large = b;
+        count_block(a, 0, size);
+        return b + 1;
+    }
+    if (a->small->size - a->small->used < size)
+    {
+        size_t block_size = a->small->size < arena_large ? a->small->size * 2 : arena_large;
+        if (block_size < size)
+            block_size = arena_large;
+        block *b = malloc(sizeof(block) + block_size);
+        if (!b)
+            handle_error("Error compiling");
+        *b = (block){NULL, a->small, block_size, 0};
+        a->small = b;
+        count_block(a, 0, block_size);
+    }
+    void *p = (char *)(a->small + 1) + a->small->used;
+    a->small->used += size;
+    return p;
+}
+
+// Moves an allocation of old_size bytes to one of size bytes, which is done in place when it is big or the last
+// allocation of its block
+void *arena_grow(arena *const a, void *const p, const size_t old_size, const size_t size)
+{
+    size_t old_rounded = (old_size + arena_align - 1) / arena_align * arena_align;
+    size_t rounded = (size + arena_align - 1) / arena_align * arena_align;
+    if (p && old_rounded >= arena_large)
+    {
+        block *b = realloc((block *)p - 1, sizeof(block) + rounded);
+        if (!b)
+            handle_error("Error compiling");
+        if (b->prev)
+            b->prev->next = b;
+        else
+            a->large = b;
+        if (b->next)
+            b->next->prev = b;
+        count_block(a, b->size, rounded);
+        b->size = rounded;
+        b->used = rounded;
+        return b + 1;
+    }
+    block *b = a->small;
+    if (p && rounded < arena_large && (char *)p + old_rounded == (char *)(b + 1) + b->used &&
+        b->size - b->used >= rounded - old_rounded)
+    {
+        b->used += rounded - old_rounded;
+        return p;
+    }
+    void *moved = arena_alloc(a, size);
+    if (old_size)
+        memcpy(moved, p, old_size);
+    return moved;
+}
+
+void free_arena(arena *const a)
+{
+    for (block *b = a->large, *next; b; b = next)
+    {
+        next = b->next;
+        free(b);
+    }
+    for (block *b = a->small, *next; b; b = next)
+    {
+        next = b->next;
+        free(b);
+    }
+}
+
+void expand(vector *v)
+{
+    if (v->len == v->cap)
+    {
+        size_t old = v->cap;
+        if (!v->cap)
+            v->cap++;
+        else
+        {
+            v->cap <<= 1;
+            if (!v->cap)
+                v->cap--;
+        }
+        if (v->arena)
+        {
+            v->data = arena_grow(v->arena, v->data, old * v->unit, v->cap * v->unit);
+            return;
+        }
+        v->data = realloc(v->data, v->cap * v->unit);
+        if (!v->data)
+            handle_error("Error compiling");
+    }
+}
+
+void reserve(vector *v, const size_t len)
+{
+    if (v->cap < len)
+    {
+        // At least doubles so adding a little at a time does not copy every time
+        size_t cap = len < v->cap * 2 ? v->cap * 2 : len;
+        if (v->arena)
+            v->data = arena_grow(v->arena, v->data, v->cap * v->unit, cap * v->unit);
+        else
+            v->data = realloc(v->data, cap * v->unit);
+        v->cap = cap;
+        if (!v->data)
+            handle_error("Error executing");
+    }
+}
+
+char *put_num(char *buffer, const uintmax_t num)
+{
+    if (num >= 10)
+        buffer = put_num(buffer, num / 10);
+    *buffer = '0' + num % 10;
+    return buffer + 1;
+}
+
+void print_num(const char *const prefix, const char *const suffix, const size_t prefix_len, const size_t suffix_len, const uintmax_t num)
+{
+    char buffer[message_size];
+    memcpy(buffer, prefix, prefix_len - 1);
+    memcpy(put_num(buffer + prefix_len - 1, num), suffix, suffix_len);
+    puts(buffer);
+}
+
+void report(const compiler *const com, const char *const message)
+{
+    if (com->report)
+        com->report(com->user, message);
+    else
+        puts(message);
+}
+
+void print_msg(const compiler *const com, const char *const prefix, const char *const suffix, const size_t prefix_len, const size_t suffix_len, const char c, const size_t index)
+{
+    char buffer[message_size];
+    memcpy(buffer, prefix, prefix_len - 1);
+    if (c)
+        buffer[index] = c;
+    memcpy(buffer + prefix_len - 1, suffix, suffix_len);
+    report(com, buffer);
+}
+
+// Stops the compile, which returns to where it was started
+void error(compiler *const com, const char *const prompt, const size_t prompt_len, const char c)
+{
+    print_msg(com, "Error reading \"c\": ", prompt, 20, prompt_len, c, 15);
+    longjmp(com->fail, 1);
+}
+
+void warn(compiler *const com, const char *const prompt, const size_t prompt_len, const char c)
+{
+    if (c)
+        print_msg(com, "Warning for character \"c\": ", prompt, 28, prompt_len, c, 23);
+    else
+        print_msg(com, "Warning for EOF: ", prompt, 18, prompt_len, 0, 0);
+    com->p.warnings++;
+}
+
+// Like warn for a char read as UTF-8, which can take more than one byte, so it is shown whole along with its code
+// point, or by its code point alone when it can't be printed
+void warn_char(compiler *const com, const char *const prompt, const uint32_t c)
+{
+    if (c >= 0x20 && c < 0x7F)
+    {
+        warn(com, prompt, strlen(prompt) + 1, c);
+        return;
+    }
+    char bytes[5] = {0};
+    if (c >= 0xA0 && c < 0x800)
+        memcpy(bytes, (char[]){0xC0 | c >> 6, 0x80 | (c & 0x3F)}, 2);
+    else if (c >= 0xA0 && c < 0x10000)
+        memcpy(bytes, (char[]){0xE0 | c >> 12, 0x80 | (c >> 6 & 0x3F), 0x80 | (c & 0x3F)}, 3);
+    else if (c >= 0x10000)
+        memcpy(bytes, (char[]){0xF0 | c >> 18, 0x80 | (c >> 12 & 0x3F), 0x80 | (c >> 6 & 0x3F), 0x80 | (c & 0x3F)}, 4);
+    char buffer[message_size];
+    if (*bytes)
+        snprintf(buffer, sizeof(buffer), "Warning for character \"%s\" (U+%04X): %s", bytes, (unsigned)c, prompt);
+    else
+        snprintf(buffer, sizeof(buffer), "Warning for character U+%04X: %s", (unsigned)c, prompt);
+    report(com, buffer);
+    com->p.warnings++;
+}
+
+// Program files are a header followed by the code, sequence, event and repeat tables, each aligned to 16 bytes
+enum
+{
+    program_version = 7,
+    program_align = 16,
+};
+
+int map_file(mapping *const m, const char *const path)
+{
+    m->data = "";
+    m->len = 0;
+#ifdef _WIN32
+    LARGE_INTEGER size;
+    m->map = NULL;
+    m->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (m->file == INVALID_HANDLE_VALUE)
+        return 0;
+    if (GetFileSizeEx(m->file, &size) && !(m->len = size.QuadPart))
+        return 1;
+    if (m->len && (m->map = CreateFileMappingA(m->file, NULL, PAGE_READONLY, 0, 0, NULL)))
+    {
+        if ((m->data = MapViewOfFile(m->map, FILE_MAP_READ, 0, 0, 0)))
+            return 1;
+        CloseHandle(m->map);
+    }
+    CloseHandle(m->file);
+    return 0;
+#else
+    struct stat info;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    if (fstat(fd, &info) || !S_ISREG(info.st_mode))
+    {
+        close(fd);
+        return 0;
+    }
+    m->len = info.st_size;
+    if (m->len)
+    {
+        void *data = mmap(NULL, m->len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            close(fd);
+            return 0;
+        }
+        m->data = data;
+    }
+    close(fd);
+#endif
+    return 1;
+}
+
+void unmap_file(mapping *const m)
+{
+#ifdef _WIN32
+    if (m->len)
+        UnmapViewOfFile(m->data);
+    if (m->map)
+        CloseHandle(m->map);
+    CloseHandle(m->file);
+#else
+    if (m->len)
+        munmap((void *)m->data, m->len);
+#endif
+}
+
+uint64_t hash(uint64_t h, const void *const data, const size_t len)
+{
+    // FNV-1a
+    for (size_t i = 0; i < len; i++)
+    {
+        h ^= ((const unsigned char *)data)[i];
+        h *= 0x100000001B3;
+    }
+    return h;
+}
+
+uint64_t key_prefix(const int optimize)
+{
+#ifdef _WIN32
+    static const char platform[] = "windows";
+#else
+    static const char platform[] = "portable";
+#endif
+    static const uint32_t version = program_version;
+    uint64_t h = hash(0xCBF29CE484222325, &version, sizeof(version));
+    h = hash(h, platform, sizeof(platform));
+    h = hash(h, &optimize, sizeof(optimize));
+    return hash(h, "00000409", 8);
+}
+
+// Scripts are compiled from a window over the source, which is either the whole file mapped into memory or a fixed
+// size buffer that is refilled from a stream
+enum
+{
+    source_window = 1 << 16,
+};
+
+typedef struct
+{
+    const char *data;
+    size_t len;
+    size_t offset;
+    size_t released;
+    char *buffer;
+    FILE *file;
+    mapping map;
+    int mapped;
+    int eof;
+    uint64_t key;
+} source;
+
+void open_source(source *const src, const char *const path)
+{
+    memset(src, 0, sizeof(source));
+    if (strcmp(path, "-") && map_file(&src->map, path))
+    {
+        src->data = src->map.data;
+        src->len = src->map.len;
+        src->mapped = 1;
+        src->eof = 1;
+#ifndef _WIN32
+        if (src->len)
+            madvise((void *)src->data, src->len, MADV_SEQUENTIAL);
+#endif
+        return;
+    }
+    if (strcmp(path, "-"))
+        src->file = fopen(path, "rb");
+    else
+    {
+#ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+#endif
+        src->file = stdin;
+    }
+    if (!src->file)
+        handle_error("Error opening file");
+    src->buffer = malloc(source_window);
+    if (!src->buffer)
+        handle_error("Error loading file");
+    src->data = src->buffer;
+}
+
+void open_buffer(source *const src, const char *const data, const size_t len)
+{
+    memset(src, 0, sizeof(source));
+    src->data = data;
+    src->len = len;
+    src->eof = 1;
+}
+
+void close_source(source *const src)
+{
+    if (src->mapped)
+        unmap_file(&src->map);
+    if (src->file && src->file != stdin)
+        fclose(src->file);
+    free(src->buffer);
+}
+
+// Lets the system drop pages of a mapped source once the compiler is a window past them
+void release_source(source *const src, const size_t at)
+{
+#ifndef _WIN32
+    if (src->mapped && at - src->released >= source_window)
+    {
+        size_t page = sysconf(_SC_PAGESIZE);
+        size_t end = at / page * page;
+        madvise((char *)src->data + src->released, end - src->released, MADV_DONTNEED);
+        src->released = end;
+    }
+#endif
+}
+
+// Moves everything from keep onwards to the start of the window and reads more after it, returns how far it moved
+size_t refill(source *const src, const size_t keep)
+{
+    if (src->eof)
+        return 0;
+    memmove(src->buffer, src->buffer + keep, src->len - keep);
+    src->len -= keep;
+    src->offset += keep;
+    size_t n = fread(src->buffer + src->len, 1, source_window - src->len, src->file);
+    src->key = hash(src->key, src->buffer + src->len, n);
+    src->eof = n < source_window - src->len;
+    src->len += n;
+    return keep;
+}
+
+// The state of each command char plus one, 0 for chars that are not commands
+static const uint8_t commands[256] = {
+    ['S'] = 1, ['s'] = 2, ['w'] = 3, ['P'] = 4, ['p'] = 5, ['L'] = 6, ['l'] = 7, ['M'] = 8, ['m'] = 9, ['R'] = 10,
+    ['r'] = 11, ['n'] = 12, ['k'] = 13, ['K'] = 14, ['C'] = 15, ['c'] = 16, ['('] = 17, [')'] = 18, ['['] = 19,
+    [']'] = 20, ['{'] = 21, ['}'] = 22, ['T'] = 23, ['t'] = 24, ['|'] = 25, ['D'] = 26, ['d'] = 27, ['u'] = 28,
+};
+
+// Bit 1 << char_set is set for the chars in char_set 1 to 4, bit 1 is set for the chars that end every argument
+static const uint8_t arg_sets[256] = {
+    ['\n'] = 1, ['\r'] = 1, ['*'] = 4, ['+'] = 4, [','] = 4, ['-'] = 4, ['.'] = 20, ['/'] = 4,
+    ['0'] = 30, ['1'] = 30, ['2'] = 30, ['3'] = 30, ['4'] = 30, ['5'] = 30, ['6'] = 30, ['7'] = 30, ['8'] = 30, ['9'] = 30,
+    ['A'] = 8, ['B'] = 8, ['C'] = 8, ['D'] = 8, ['E'] = 8, ['F'] = 8,
+    ['a'] = 8, ['b'] = 8, ['c'] = 8, ['d'] = 8, ['e'] = 8, ['f'] = 8,
+};
+
+// Whether c can be part of an argument, char_set is 0 for all, 1 for 0-9, 2 for numpad, 3 for 0-9a-fA-F, and 4 for
+// 0-9 and "."
+int arg_char(const char c, const int char_set, const int first)
+{
+    uint8_t set = arg_sets[(uint8_t)c];
+    if (!char_set)
+        return !(set & 1);
+    return (set >> char_set & 1) || (first && (char_set == 1 || char_set == 4) && c == '-');
+}
+
+// Arguments are scanned a vector of chars at a time where the compiler targets SSE2 or AVX2
+#if defined(__AVX2__)
+typedef __m256i lanes;
+#define lane_count 32
+#define all_lanes 0xFFFFFFFF
+#define load_lanes(p) _mm256_loadu_si256((const __m256i *)(p))
+#define set_lanes(c) _mm256_set1_epi8(c)
+#define equal_lanes(a, b) _mm256_cmpeq_epi8(a, b)
+#define greater_lanes(a, b) _mm256_cmpgt_epi8(a, b)
+#define or_lanes(a, b) _mm256_or_si256(a, b)
+#define and_lanes(a, b) _mm256_and_si256(a, b)
+#define xor_lanes(a, b) _mm256_xor_si256(a, b)
+#define lane_mask(v) (uint32_t)_mm256_movemask_epi8(v)
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+typedef __m128i lanes;
+#define lane_count 16
+#define all_lanes 0xFFFF
+#define load_lanes(p) _mm_loadu_si128((const __m128i *)(p))
+#define set_lanes(c) _mm_set1_epi8(c)
+#define equal_lanes(a, b) _mm_cmpeq_epi8(a, b)
+#define greater_lanes(a, b) _mm_cmpgt_epi8(a, b)
+#define or_lanes(a, b) _mm_or_si128(a, b)
+#define and_lanes(a, b) _mm_and_si128(a, b)
+#define xor_lanes(a, b) _mm_xor_si128(a, b)
+#define lane_mask(v) (uint32_t)_mm_movemask_epi8(v)
+#endif
+
+#ifdef lane_count
+int first_bit(const uint32_t mask)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+// Lanes with chars from low to high. Chars are compared signed, so both sides are moved down by 128 first
+lanes in_range(const lanes chars, const char low, const char high)
+{
+    return and_lanes(greater_lanes(chars, set_lanes((char)((low - 1) ^ 0x80))),
+                     greater_lanes(set_lanes((char)((high + 1) ^ 0x80)), chars));
+}
+
+// Bit i is set if char i is not in char_set
+uint32_t run_ends(const char *const data, const int char_set)
+{
+    lanes chars = load_lanes(data);
+    if (!char_set)
+        return lane_mask(or_lanes(equal_lanes(chars, set_lanes('\n')), equal_lanes(chars, set_lanes('\r'))));
+    chars = xor_lanes(chars, set_lanes((char)0x80));
+    lanes in;
+    if (char_set == 1)
+        in = in_range(chars, '0', '9');
+    else if (char_set == 2)
+        in = in_range(chars, '*', '9');
+    else if (char_set == 4)
+        in = or_lanes(in_range(chars, '0', '9'), equal_lanes(chars, set_lanes((char)('.' ^ 0x80))));
+    else
+        in = or_lanes(in_range(chars, '0', '9'), or_lanes(in_range(chars, 'A', 'F'), in_range(chars, 'a', 'f')));
+    return ~lane_mask(in) & all_lanes;
+}
+#endif
+
+// Length of the run at the start of data that is in char_set, not counting the minus a number can start with
+size_t scan_run(const char *const data, const size_t len, const int char_set)
+{
+    size_t i = 0;
+#ifdef lane_count
+    for (; i + lane_count <= len; i += lane_count)
+    {
+        uint32_t ends = run_ends(data + i, char_set);
+        if (ends)
+            return i + first_bit(ends);
+    }
+#endif
+    while (i < len && arg_char(data[i], char_set, 0))
+        i++;
+    return i;
+}
+
+// Reads the argument starting at *at, refilling the window if it runs past the end. The command is kept in the
+// window for messages, so *at can move
+size_t read_arg(compiler *const com, source *const src, size_t *const at, const int char_set)
+{
+    int first = 1;
+    size_t i = *at;
+    while (1)
+    {
+        if (i == src->len)
+        {
+            if (src->eof)
+                break;
+            if (*at == 1 && src->len == source_window)
+                error(com, "Argument too long", 18, src->data[0]);
+            size_t moved = refill(src, *at - 1);
+            *at -= moved;
+            i -= moved;
+            continue;
+        }
+        if (first)
+        {
+            if (!arg_char(src->data[i], char_set, 1))
+                break;
+            first = 0;
+            i++;
+            continue;
+        }
+        i += scan_run(src->data + i, src->len - i, char_set);
+        if (i < src->len)
+            break;
+    }
+    if (i == *at)
+        warn(com, "Nothing read", 13, src->data[*at - 1]);
+    return i - *at;
+}
+
+// Skips the char between two arguments and reads the second, like the "," in "P100,200"
+size_t next_arg(compiler *const com, source *const src, size_t *const at, const int char_set)
+{
+    if (*at == src->len)
+        *at -= refill(src, *at - 1);
+    *at += *at < src->len;
+    return read_arg(com, src, at, char_set);
+}
+
+// Numbers that do not fit are warned about when com is given and saturate, to the largest number or to the smallest
+// negative one
+uintmax_t parse_num(compiler *const com, const char *chars, const size_t len, const int type)
+{
+    // type is 0 for base10 and 1 for base16
+    const char *const start = chars;
+    uintmax_t output = 0;
+    int cof = 1;
+    int overflow = 0;
+    if (type)
+    {
+        for (size_t i = 0; i < len; i++, chars++)
+        {
+            output <<= 4;
+            char c = *chars;
+            if (c < 58)
+                output |= c - 48;
+            else if (c < 91)
+                output |= c - 55;
+            else
+                output |= c - 87;
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < len; i++, chars++)
+        {
+            char c = *chars;
+            if (c == '-')
+            {
+                cof = -1;
+                continue;
+            }
+            uintmax_t digit = c - 48;
+            overflow |= output > (UINTMAX_MAX - digit) / 10;
+            output = output * 10 + digit;
+        }
+    }
+    if (cof < 0 && output > (uintmax_t)INTMAX_MAX + 1)
+        overflow = 1;
+    if (!overflow)
+        return cof * output;
+    if (com)
+        warn(com, "Number out of range, using the closest one", 43, *start);
+    return cof < 0 ? (uintmax_t)INTMAX_MAX + 1 : UINTMAX_MAX;
+}
+
+// Sleeps are in milliseconds with up to 3 decimals, and are stored in microseconds
+uintmax_t parse_sleep(compiler *const com, const char *const chars, const size_t len)
+{
+    size_t whole = 0;
+    while (whole < len && chars[whole] != '.')
+        whole++;
+    uintmax_t ms = parse_num(com, chars, whole, 0);
+    uintmax_t us = 0;
+    size_t digits = 0;
+    for (size_t i = whole + 1; i < len && digits < 3 && chars[i] != '.'; i++, digits++)
+        us = us * 10 + chars[i] - 48;
+    for (; digits < 3; digits++)
+        us *= 10;
+    if (ms > (UINTMAX_MAX - 999) / 1000)
+    {
+        // parse_num has already warned about numbers that do not fit at all
+        if (com && ms != UINTMAX_MAX && ms != (uintmax_t)INTMAX_MAX + 1)
+            warn(com, "Number out of range, using the closest one", 43, *chars);
+        return UINTMAX_MAX;
+    }
+    return ms * 1000 + us;
+}
+
+void add_code(vector *const codes, const int opcode, const uintmax_t immediate)
+{
+    expand(codes);
+    // Cleared so the padding is the same in every compiled file
+    memset(&((instruction *)codes->data)[codes->len], 0, codes->unit);
+    ((instruction *)codes->data)[codes->len].opcode = opcode;
+    ((instruction *)codes->data)[codes->len].immediate = immediate;
+    codes->len++;
+}
+
+int fits_move(const int32_t value, const int absolute)
+{
+    return absolute ? value >= 0 && value <= UINT16_MAX : value >= INT16_MIN && value <= INT16_MAX;
+}
+
+// Packs the input that was being built onto the end of the events
+void push_event(compiler *const com)
+{
+    event *e = &com->pending;
+    const motion *m = &com->pending_motion;
+    if (e->type == event_mouse)
+    {
+        int absolute = e->flags & mouse_absolute;
+        if (e->flags & mouse_wheel ? !m->dx && !m->dy : fits_move(m->dx, absolute) && fits_move(m->dy, absolute))
+        {
+            if (e->flags & mouse_wheel)
+                e->wheel = m->wheel;
+            else
+            {
+                e->move.dx = m->dx;
+                e->move.dy = m->dy;
+            }
+        }
+        else
+        {
+            e->type = event_motion;
+            e->motion = com->p.motions.len;
+            expand(&com->p.motions);
+            ((motion *)com->p.motions.data)[com->p.motions.len++] = *m;
+        }
+    }
+    expand(&com->p.events);
+    ((event *)com->p.events.data)[com->p.events.len++] = *e;
+}
+
+// A path as a cubic a + bt + ct^2 + dt^3 in t from 0 to 1, for x and y side by side. Linear and ease in and out
+// paths are written this way too, so every shape is worked out the same way
+typedef struct
+{
+    double a[2];
+    double b[2];
+    double c[2];
+    double d[2];
+} cubic;
+
+cubic path_cubic(const path *const w)
+{
+    cubic k;
+    for (int i = 0; i < 2; i++)
+    {
+        double p0 = w->points[i], p1 = w->points[2 + i], p2 = w->points[4 + i], p3 = w->points[6 + i];
+        k.a[i] = p0;
+        if (w->shape == path_linear)
+        {
+            k.b[i] = p3 - p0;
+            k.c[i] = k.d[i] = 0;
+        }
+        else if (w->shape == path_ease)
+        {
+            // 3t^2 - 2t^3, which starts and ends at rest
+            k.b[i] = 0;
+            k.c[i] = 3 * (p3 - p0);
+            k.d[i] = -2 * (p3 - p0);
+        }
+        else
+        {
+            k.b[i] = 3 * (p1 - p0);
+            k.c[i] = 3 * (p0 - 2 * p1 + p2);
+            k.d[i] = p3 - 3 * p2 + 3 * p1 - p0;
+        }
+    }
+    return k;
+}
+
+double magnitude(const double x)
+{
+    return x < 0 ? -x : x;
+}
+
+// Whether every point of a path fits in 32 bits and every step of a relative one fits in an input. A step moves by
+// no more than the steepest slope of the curve divided by the steps, plus 1 for rounding
+int path_fits(const path *const w)
+{
+    if (!w->steps || w->shape > path_bezier || (w->flags & ~mouse_absolute) != mouse_move)
+        return 0;
+    cubic k = path_cubic(w);
+    for (int i = 0; i < 2; i++)
+    {
+        if (magnitude(k.a[i]) + magnitude(k.b[i]) + magnitude(k.c[i]) + magnitude(k.d[i]) >= INT32_MAX)
+            return 0;
+        if (!(w->flags & mouse_absolute) &&
+            (magnitude(k.b[i]) + 2 * magnitude(k.c[i]) + 3 * magnitude(k.d[i])) / w->steps + 1 > INT16_MAX)
+            return 0;
+    }
+    return 1;
+}
+
+uint64_t mix_word(const uint64_t h, const uint64_t word)
+{
+    uint64_t x = (h ^ word) * 0x9E3779B97F4A7C15;
+    return x ^ x >> 29;
+}
+
+// Works a word at a time since it runs for every sequence compiled. Moves kept in motions are hashed and compared by
+// value, so sequences that move the same way match
+uint64_t sequence_hash(const program *const p, const sequence *const s)
+{
+    const event *e = (const event *)p->events.data + s->start;
+    const repeat *r = (const repeat *)p->repeats.data + s->repeat;
+    uint64_t h = mix_word(0xCBF29CE484222325, s->len);
+    for (size_t i = 0; i < s->len; i++)
+    {
+        event x = e[i];
+        if (x.type == event_motion)
+        {
+            const motion *m = (const motion *)p->motions.data + x.motion;
+            h = mix_word(h, (uint64_t)(uint32_t)m->dx << 32 | (uint32_t)m->dy);
+            h = mix_word(h, (uint32_t)m->wheel);
+            x.motion = 0;
+        }
+        uint64_t word;
+        memcpy(&word, &x, sizeof(word));
+        h = mix_word(h, word);
+    }
+    for (size_t i = 0; i < s->repeats; i++)
+        h = mix_word(mix_word(mix_word(h, r[i].begin), r[i].end), r[i].count);
+    // The table only looks at the low bits, and moves are in the high half of an input
+    h = (h ^ h >> 33) * 0xFF51AFD7ED558CCD;
+    return h ^ h >> 33;
+}
+
+int same_sequence(const program *const p, const sequence *const a, const sequence *const b)
+{
+    const event *events = p->events.data;
+    const motion *motions = p->motions.data;
+    if (a->len != b->len || a->repeats != b->repeats ||
+        (a->repeats && memcmp((const repeat *)p->repeats.data + a->repeat, (const repeat *)p->repeats.data + b->repeat, a->repeats * repeat_size)))
+        return 0;
+    for (size_t i = 0; i < a->len; i++)
+    {
+        const event *x = &events[a->start + i];
+        const event *y = &events[b->start + i];
+        if (x->type == event_motion ? y->type != event_motion || x->flags != y->flags || x->key != y->key || memcmp(&motions[x->motion], &motions[y->motion], motion_size)
+                                    : memcmp(x, y, event_size))
+            return 0;
+    }
+    return 1;
+}
+
+// Returns the index of an earlier sequence that is the same as s, or adds s as index and returns it
+size_t share_sequence(sequence_table *const t, const program *const p, const sequence *const s, const size_t index)
+{
+    const sequence *seq = p->inputs.data;
+    if (t->len * 2 >= t->cap)
+    {
+        size_t cap = t->cap ? t->cap * 2 : 64;
+        shared_entry *entries = calloc(cap, sizeof(shared_entry));
+        if (!entries)
+            handle_error("Error compiling");
+        for (size_t i = 0; i < t->cap; i++)
+        {
+            if (!t->entries[i].index)
+                continue;
+            size_t at = t->entries[i].hash & (cap - 1);
+            while (entries[at].index)
+                at = (at + 1) & (cap - 1);
+            entries[at] = t->entries[i];
+        }
+        free(t->entries);
+        t->entries = entries;
+        t->cap = cap;
+    }
+    uint64_t h = sequence_hash(p, s);
+    size_t at = h & (t->cap - 1);
+    // Indices are stored plus 1 so 0 is an empty slot
+    for (; t->entries[at].index; at = (at + 1) & (t->cap - 1))
+        if (t->entries[at].hash == h && same_sequence(p, &seq[t->entries[at].index - 1], s))
+            return t->entries[at].index - 1;
+    t->entries[at] = (shared_entry){h, index + 1};
+    t->len++;
+    return index;
+}
+
+// Removes sequences that are the same as an earlier one and moves the rest together, pointing every send at the
+// sequence that is kept. Returns the bytes that were saved
+uintmax_t share_program(program *const p)
+{
+    sequence *seq = p->inputs.data;
+    event *events = p->events.data;
+    repeat *repeats = p->repeats.data;
+    motion *motions = p->motions.data;
+    // After optimizing, sends of the same sequence were copied apart but still point at the same motions
+    size_t *map = malloc(p->inputs.len * sizet_size + 1);
+    motion *moved = malloc(p->events.len * motion_size + 1);
+    if (!map || !moved)
+        handle_error("Error compiling");
+    sequence_table t = {NULL, 0, 0};
+    for (size_t i = 0; i < p->inputs.len; i++)
+        map[i] = share_sequence(&t, p, &seq[i], i);
+    free(t.entries);
+
+    uintmax_t saved = 0;
+    size_t n = 0, e = 0, r = 0, m = 0;
+    for (size_t i = 0; i < p->inputs.len; i++)
+    {
+        sequence s = seq[i];
+        if (map[i] != i)
+        {
+            saved += sequence_size + s.len * event_size + s.repeats * repeat_size;
+            for (size_t j = 0; j < s.len; j++)
+                saved += events[s.start + j].type == event_motion ? motion_size : 0;
+            map[i] = map[map[i]];
+            continue;
+        }
+        if (s.len)
+            memmove(&events[e], &events[s.start], s.len * event_size);
+        for (size_t j = e; j < e + s.len; j++)
+        {
+            if (events[j].type == event_motion)
+            {
+                moved[m] = motions[events[j].motion];
+                events[j].motion = m++;
+            }
+        }
+        if (s.repeats)
+            memmove(&repeats[r], &repeats[s.repeat], s.repeats * repeat_size);
+        seq[n] = (sequence){e, s.len, r, s.repeats};
+        map[i] = n++;
+        e += s.len;
+        r += s.repeats;
+    }
+    reserve(&p->motions, m);
+    if (m)
+        memcpy(p->motions.data, moved, m * motion_size);
+    p->inputs.len = n;
+    p->events.len = e;
+    p->repeats.len = r;
+    p->motions.len = m;
+    instruction *ins = p->codes.data;
+    for (size_t i = 0; i < p->codes.len; i++)
+        if (ins[i].opcode == 2)
+            ins[i].immediate = map[ins[i].immediate];
+    free(map);
+    free(moved);
+    return saved;
+}
+
+// Keeps the code compiled so far with its track and carries on with the code of track number, which starts empty the
+// first time. Code from before the first "t" is track 0, and each track keeps its own "S"
+void switch_track(compiler *const com, const uintmax_t number)
+{
+    if (!com->tracks.len)
+    {
+        expand(&com->tracks);
+        ((track_code *)com->tracks.data)[com->tracks.len++] = (track_code){0};
+    }
+    track_code *tracks = com->tracks.data;
+    tracks[com->track].codes = com->p.codes;
+    tracks[com->track].sleep = com->sleep;
+    size_t i = 0;
+    while (i < com->tracks.len && tracks[i].number != number)
+        i++;
+    if (i == com->tracks.len)
+    {
+        expand(&com->tracks);
+        tracks = com->tracks.data;
+        tracks[com->tracks.len++] = (track_code){number, {NULL, 0, 0, instruction_size, com->p.memory}, 0};
+    }
+    com->track = i;
+    com->p.codes = tracks[i].codes;
+    com->sleep = tracks[i].sleep;
+}
+
+// Puts the code of every track one after another in the order they first appear, each after an instruction that
+// starts it except track 0, which comes first
+void join_tracks(compiler *const com)
+{
+    track_code *tracks = com->tracks.data;
+    tracks[com->track].codes = com->p.codes;
+    vector codes = {NULL, 0, 0, instruction_size, com->p.memory};
+    size_t len = com->tracks.len - 1;
+    for (size_t i = 0; i < com->tracks.len; i++)
+        len += tracks[i].codes.len;
+    reserve(&codes, len);
+    for (size_t i = 0; i < com->tracks.len; i++)
+    {
+        if (i)
+            add_code(&codes, 6, tracks[i].number);
+        instruction *to = (instruction *)codes.data + codes.len;
+        if (tracks[i].codes.len)
+            memcpy(to, tracks[i].codes.data, tracks[i].codes.len * instruction_size);
+        for (size_t j = 0; j < tracks[i].codes.len; j++)
+            if (to[j].opcode == 1)
+                to[j].immediate += codes.len;
+        codes.len += tracks[i].codes.len;
+    }
+    com->p.codes = codes;
+}
+
+void add_event(compiler *const com, const int type, const uintmax_t *const data)
+{
+    uintmax_t num_repeat = 0;
+
+    switch (type)
+    {
+    case 0:
+        // begin loop
+        if (com->group_state & 4)
+        {
+            warn(com, "Missing \")\", added automatically", 33, '}');
+            add_event(com, 5, (uintmax_t[]){1});
+        }
+        while (com->brackets.len)
+        {
+            warn(com, "Missing \"]\", added automatically", 33, '}');
+            add_event(com, 6, (uintmax_t[]){1, 0});
+        }
+
+        expand(&com->loop);
+        if (++com->loop.len > com->p.depth)
+            com->p.depth = com->loop.len;
+        ((size_t *)com->loop.data)[com->loop.len - 1] = com->p.codes.len;
+        if (!data[0])
+        {
+            warn(com, "Invalid loop count, assuming loop of 1", 39, '{');
+            add_code(&com->p.codes, type, 1);
+        }
+        else
+            add_code(&com->p.codes, type, data[0]);
+        break;
+    case 1:
+        // end loop
+        if (!com->loop.len)
+        {
+            warn(com, "Extra \"}\", ignored", 19, '}');
+            break;
+        }
+        if (com->group_state & 4)
+        {
+            warn(com, "Missing \")\", added automatically", 33, '}');
+            add_event(com, 5, (uintmax_t[]){1});
+        }
+        while (com->brackets.len)
+        {
+            warn(com, "Missing \")\", added automatically", 33, '}');
+            add_event(com, 6, (uintmax_t[]){1, 0});
+        }
+
+        com->loop.len--;
+        add_code(&com->p.codes, type, ((size_t *)com->loop.data)[com->loop.len]);
+        break;
+    case 2:
+        // execute
+        if (data[0] && com->group_state & 4)
+        {
+            warn(com, "Keyboard commands for mouse, ignored", 37, '(');
+            break;
+        }
+        if (com->group_state & 1)
+        {
+            if (com->group_state & 8)
+            {
+                com->start = com->p.events.len;
+                com->first_motion = com->p.motions.len;
+                com->group_state |= 16;
+                com->group_state &= ~8;
+            }
+            memset(&com->pending, 0, sizeof(event));
+            memset(&com->pending_motion, 0, sizeof(motion));
+            com->group_state |= 2;
+            com->group_state &= ~1;
+        }
+
+        event *curr = &com->pending;
+
+        if (data[0])
+        {
+            curr->type = event_key;
+            curr->key = data[1];
+            if (data[2])
+                curr->flags = key_up;
+        }
+        else
+        {
+            curr->flags |= data[1];
+            if (data[1] == mouse_wheel)
+            {
+                com->pending_motion.wheel = data[2];
+            }
+            else if (data[1] == mouse_move)
+            {
+                com->pending_motion.dx = data[2];
+                com->pending_motion.dy = data[3];
+                if (data[4])
+                    curr->flags |= mouse_absolute;
+            }
+        }
+        break;
+    case 3:
+        // sleep
+        if (com->brackets.len)
+            warn(com, "Sleep command in arrayed inputs, ignored", 41, 's');
+        else
+            add_code(&com->p.codes, type, data[0]);
+        break;
+    case 4:
+        // repeated sleep
+        com->sleep = data[0];
+        break;
+    case 8:
+        // rate
+        if (com->brackets.len)
+            warn(com, "Rate command in arrayed inputs, ignored", 40, 'T');
+        else
+            add_code(&com->p.codes, 4, data[0]);
+        break;
+    case 9:
+        // switch track
+        if (com->group_state & 4)
+        {
+            warn(com, "Missing \")\", added automatically", 33, 't');
+            add_event(com, 5, (uintmax_t[]){1});
+        }
+        while (com->brackets.len)
+        {
+            warn(com, "Missing \"]\", added automatically", 33, 't');
+            add_event(com, 6, (uintmax_t[]){1, 0});
+        }
+        while (com->loop.len)
+        {
+            warn(com, "Missing \"}\", added automatically", 33, 't');
+            add_event(com, 1, NULL);
+        }
+        switch_track(com, data[0]);
+        break;
+    case 10:
+        // barrier
+        if (com->brackets.len)
+            warn(com, "Barrier in arrayed inputs, ignored", 35, '|');
+        else
+            add_code(&com->p.codes, 7, 0);
+        break;
+    case 11:
+    {
+        // path, which is sent on its own like a sequence and gets the same "S" after it
+        char c = data[1] ? 'D' : 'd';
+        if (com->group_state & 4 || com->brackets.len)
+        {
+            warn(com, "Path in mouse group or arrayed inputs, ignored", 47, c);
+            break;
+        }
+        path w = {.steps = data[2], .duration = data[3], .flags = mouse_move | (data[1] ? mouse_absolute : 0), .shape = data[0]};
+        for (int i = 0; i < 8; i++)
+            w.points[i] = data[4 + i];
+        // Without steps, a path with a duration moves once a millisecond
+        if (!w.steps)
+            w.steps = w.duration / 1000 + (w.duration % 1000 != 0);
+        if (!w.steps)
+        {
+            warn(com, "Invalid step count, assuming 1 step", 36, c);
+            w.steps = 1;
+        }
+        if (!path_fits(&w))
+        {
+            warn(com, "Path moves too far in one step, ignored", 40, c);
+            break;
+        }
+        expand(&com->p.paths);
+        ((path *)com->p.paths.data)[com->p.paths.len++] = w;
+        add_code(&com->p.codes, 8, com->p.paths.len - 1);
+        if (com->sleep)
+            add_code(&com->p.codes, 3, com->sleep);
+        break;
+    }
+    case 12:
+        // text, which read_text has already put in the text section from data[0] on
+        expand(&com->p.text);
+        ((char *)com->p.text.data)[com->p.text.len++] = 0;
+        add_code(&com->p.codes, 9, data[0]);
+        if (com->sleep)
+            add_code(&com->p.codes, 3, com->sleep);
+        break;
+    case 5:
+        // simultaneous mouse events
+        if (data[0])
+        {
+            if (!(com->group_state & 2))
+                warn(com, "No instructions", 16, ')');
+            if (com->group_state & 4)
+                com->group_state &= ~4;
+            else
+                warn(com, "Mismatched brackets, ignored", 29, ')');
+        }
+        else
+        {
+            if (com->group_state & 4)
+                warn(com, "Nested brackets, ignored", 25, '(');
+            else
+                com->group_state |= 4;
+        }
+        break;
+    case 6:
+        // repeated/copied and arrayed events
+        if (data[0])
+        {
+            if (!com->brackets.len)
+            {
+                warn(com, "Mismatched brackets, ignored", 29, ']');
+                break;
+            }
+            if (com->group_state & 4)
+            {
+                warn(com, "Missing \")\", added automatically", 33, ']');
+                add_event(com, 5, (uintmax_t[]){1});
+            }
+            if (!(num_repeat = data[1]))
+            {
+                warn(com, "Invalid copy count, assuming copy of 1", 39, ']');
+                num_repeat = 1;
+            }
+            com->brackets.len--;
+            if (!com->brackets.len)
+                com->group_state &= ~32;
+
+            size_t i0 = ((size_t *)com->brackets.data)[com->brackets.len];
+            repeat *r = &((repeat *)com->p.repeats.data)[i0];
+            r->end = com->p.events.len;
+            r->count = num_repeat;
+            if (r->begin == r->end)
+            {
+                warn(com, "No instructions", 16, ']');
+                com->p.repeats.len = i0;
+            }
+            else if (num_repeat == 1 && i0 == com->p.repeats.len - 1)
+                com->p.repeats.len = i0;
+        }
+        else
+        {
+            if (com->group_state & 4)
+            {
+                warn(com, "Missing \")\", added automatically", 33, ']');
+                add_event(com, 5, (uintmax_t[]){1});
+            }
+
+            expand(&com->brackets);
+            ((size_t *)com->brackets.data)[com->brackets.len] = com->p.repeats.len;
+            com->brackets.len++;
+            expand(&com->p.repeats);
+            ((repeat *)com->p.repeats.data)[com->p.repeats.len].begin = com->p.events.len;
+            com->p.repeats.len++;
+            com->group_state |= 32;
+        }
+        break;
+    case 7:
+        // finalize
+        if (com->group_state & 4)
+        {
+            warn(com, "Missing \")\", added automatically", 33, 0);
+            add_event(com, 5, (uintmax_t[]){1});
+        }
+        while (com->brackets.len)
+        {
+            warn(com, "Missing \"]\", added automatically", 33, 0);
+            add_event(com, 6, (uintmax_t[]){1, 0});
+        }
+        while (com->loop.len--)
+        {
+            warn(com, "Missing \"}\", added automatically", 33, 0);
+            add_code(&com->p.codes, 1, ((size_t *)com->loop.data)[com->loop.len]);
+        }
+        if (com->tracks.len)
+            join_tracks(com);
+
+        return;
+    }
+
+    if (!(com->group_state & 4))
+    {
+        if ((com->group_state & 6) == 2)
+        {
+            push_event(com);
+            com->group_state &= ~2;
+            com->group_state |= 1;
+        }
+        if ((com->group_state & 48) == 16)
+        {
+            expand(&com->p.inputs);
+            sequence *s = &((sequence *)com->p.inputs.data)[com->p.inputs.len];
+            s->start = com->start;
+            s->len = com->p.events.len - com->start;
+            s->repeat = com->first_repeat;
+            s->repeats = com->p.repeats.len - com->first_repeat;
+            for (repeat *r = &((repeat *)com->p.repeats.data)[com->first_repeat]; r < &((repeat *)com->p.repeats.data)[com->p.repeats.len]; r++)
+            {
+                r->begin -= com->start;
+                r->end -= com->start;
+            }
+            com->first_repeat = com->p.repeats.len;
+            com->sequences++;
+            size_t index = share_sequence(&com->shared, &com->p, s, com->p.inputs.len);
+            add_code(&com->p.codes, 2, index);
+            if (com->sleep)
+                add_code(&com->p.codes, 3, com->sleep);
+            if (index == com->p.inputs.len)
+                com->p.inputs.len++;
+            else
+            {
+                // The same as an earlier sequence, so what it added is taken back off
+                com->shared_bytes += sequence_size + (com->p.events.len - com->start) * event_size +
+                                     (com->p.repeats.len - s->repeat) * repeat_size +
+                                     (com->p.motions.len - com->first_motion) * motion_size;
+                com->p.events.len = com->start;
+                com->p.repeats.len = com->first_repeat = s->repeat;
+                com->p.motions.len = com->first_motion;
+            }
+            com->group_state &= ~16;
+            com->group_state |= 8;
+        }
+    }
+}
+
+// Layouts are made once per process and shared, which is the only state compiles share
+#ifdef _WIN32
+static SRWLOCK layouts_lock = SRWLOCK_INIT;
+#else
+static pthread_mutex_t layouts_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+static key_table *layouts = NULL;
+
+void lock_layouts()
+{
+#ifdef _WIN32
+    AcquireSRWLockExclusive(&layouts_lock);
+#else
+    pthread_mutex_lock(&layouts_lock);
+#endif
+}
+
+void unlock_layouts()
+{
+#ifdef _WIN32
+    ReleaseSRWLockExclusive(&layouts_lock);
+#else
+    pthread_mutex_unlock(&layouts_lock);
+#endif
+}
+
+// Asks the system, or the built-in layout elsewhere, which keys type c
+int scan_key(const key_table *const t, const uint32_t c)
+{
+#ifdef _WIN32
+    return c >= 0xD800 && c < 0xE000 ? 0xFFFF : (uint16_t)VkKeyScanExW((WCHAR)c, t->handle);
+#else
+    for (size_t i = 0; i < t->len; i++)
+        if (t->keys[i].c == c)
+            return t->keys[i].key;
+    if (c >= 128)
+        return 0xFFFF;
+    if (c >= '0' && c <= '9')
+        return c;
+    if (c >= 'A' && c <= 'Z')
+        return 0x100 | c;
+    if (c >= 'a' && c <= 'z')
+        return c - 32;
+    if (c > 0 && c < 27 && !us_keys[c])
+        return 0x200 | (c + 64);
+    if (c > 0 && us_keys[c])
+        return us_keys[c];
+    return 0xFFFF;
+#endif
+}
+
+void fill_page(key_table *const t, const size_t page, uint16_t *const keys)
+{
+    for (uint32_t i = 0; i < 256; i++)
+        keys[i] = scan_key(t, page << 8 | i);
+    t->lookups += 256;
+    t->pages[page] = keys;
+}
+
+// Tables are saved as the id followed by every key, in the same folder as cached programs
+char *key_file(const char *const dir, const uint32_t id)
+{
+    size_t dir_len = strlen(dir);
+    char *path = malloc(dir_len + 15);
+    if (!path)
+        handle_error("Error opening cache");
+    memcpy(path, dir, dir_len);
+    path[dir_len] = '/';
+    for (int i = 0; i < 8; i++)
+        path[dir_len + 1 + i] = "0123456789abcdef"[id >> (28 - 4 * i) & 15];
+    memcpy(path + dir_len + 9, ".keys", 6);
+    return path;
+}
+
+// Loads every page of t from the cache, or looks them all up and saves them if it is not there yet
+void cache_layout(key_table *const t, const char *const dir)
+{
+    uint16_t *keys = malloc(65536 * sizeof(uint16_t));
+    if (!keys)
+        handle_error("Error compiling");
+    char *path = key_file(dir, t->id);
+    FILE *file = fopen(path, "rb");
+    uint32_t id = 0;
+    int loaded = file && fread(&id, sizeof(id), 1, file) == 1 && id == t->id &&
+                 fread(keys, sizeof(uint16_t), 65536, file) == 65536;
+    if (file)
+        fclose(file);
+    if (loaded)
+    {
+        for (size_t page = 0; page < 256; page++)
+            t->pages[page] = keys + (page << 8);
+    }
+    else
+    {
+        for (size_t page = 0; page < 256; page++)
+            fill_page(t, page, keys + (page << 8));
+#ifdef _WIN32
+        CreateDirectoryA(dir, NULL);
+#else
+        mkdir(dir, 0777);
+#endif
+        file = fopen(path, "wb");
+        if (file)
+        {
+            fwrite(&t->id, sizeof(t->id), 1, file);
+            fwrite(keys, sizeof(uint16_t), 65536, file);
+            fclose(file);
+        }
+    }
+    free(path);
+}
+
+// Returns the layout, making it the first time it is used. With a cache folder its table is read from there
+keymap find_keymap(const char *const name, const char *const cache)
+{
+    uint32_t id = strtoul(name, NULL, 16);
+    lock_layouts();
+    key_table *t = layouts;
+    while (t && t->id != id)
+        t = t->next;
+    if (!t)
+    {
+        t = calloc(1, sizeof(key_table));
+        if (!t)
+            handle_error("Error compiling");
+        t->id = id;
+#ifdef _WIN32
+        t->handle = LoadKeyboardLayoutA(name, 0);
+#else
+        // Layouts that are not built in are typed with the US one, which has no keys listed
+        for (size_t i = 0; i < sizeof(builtin_layouts) / sizeof(builtin_layout); i++)
+        {
+            if (builtin_layouts[i].id == id)
+            {
+                t->keys = builtin_layouts[i].keys;
+                t->len = builtin_layouts[i].len;
+            }
+        }
+#endif
+        if (cache)
+            cache_layout(t, cache);
+        t->next = layouts;
+        layouts = t;
+    }
+    unlock_layouts();
+    return t;
+}
+
+// Switches the compile to a layout, its pages are looked up again as they are used
+void use_keymap(compiler *const com, const keymap layout)
+{
+    com->layout = layout;
+    memset(com->pages, 0, sizeof(com->pages));
+}
+
+void load_keymap(compiler *const com, const char *const name)
+{
+#ifndef _WIN32
+    uint32_t id = strtoul(name, NULL, 16);
+    size_t i = 0;
+    while (i < sizeof(builtin_layouts) / sizeof(builtin_layout) && builtin_layouts[i].id != id)
+        i++;
+    if (i == sizeof(builtin_layouts) / sizeof(builtin_layout))
+        warn(com, "Keyboard layout not available, using 00000409", 46, 'K');
+#endif
+    use_keymap(com, find_keymap(name, com->key_cache));
+}
+
+const uint16_t *key_page(compiler *const com, const size_t page)
+{
+    if (!com->pages[page])
+    {
+        lock_layouts();
+        if (!com->layout->pages[page])
+        {
+            uint16_t *keys = malloc(256 * sizeof(uint16_t));
+            if (!keys)
+                handle_error("Error compiling");
+            fill_page(com->layout, page, keys);
+        }
+        com->pages[page] = com->layout->pages[page];
+        unlock_layouts();
+    }
+    return com->pages[page];
+}
+
+// Reads a UTF-8 char into *c and returns its length. Bytes that are not UTF-8 are read as Latin-1, and 0 is returned
+// if the char is cut off by the end and more may follow
+size_t next_char(const uint8_t *const chars, const size_t len, const int more, uint32_t *const c)
+{
+    uint8_t b = chars[0];
+    size_t n = b >= 0xF0 && b < 0xF5 ? 4 : b >= 0xE0 && b < 0xF0 ? 3 : b >= 0xC2 && b < 0xE0 ? 2 : 1;
+    *c = b;
+    if (n == 1)
+        return 1;
+    if (len < n && more)
+    {
+        size_t i = 1;
+        while (i < len && (chars[i] & 0xC0) == 0x80)
+            i++;
+        if (i == len)
+            return 0;
+    }
+    if (len < n)
+        return 1;
+    uint32_t code = b & (0x7F >> n);
+    for (size_t i = 1; i < n; i++)
+    {
+        if ((chars[i] & 0xC0) != 0x80)
+            return 1;
+        code = code << 6 | (chars[i] & 0x3F);
+    }
+    // Overlong forms, surrogates, and chars past U+10FFFF are not UTF-8
+    if ((n == 3 && code < 0x800) || (n == 4 && (code < 0x10000 || code > 0x10FFFF)) || (code >= 0xD800 && code < 0xE000))
+        return 1;
+    *c = code;
+    return n;
+}
+
+// Whether text is only UTF-8 and every string in it is ended by a 0, so it can be sent without checking it again
+int text_fits(const char *const text, const size_t len)
+{
+    if (len && text[len - 1])
+        return 0;
+    for (size_t i = 0; i < len;)
+    {
+        uint32_t c;
+        size_t n = next_char((const uint8_t *)text + i, len - i, 0, &c);
+        if (n == 1 && c >= 0x80)
+            return 0;
+        i += n;
+    }
+    return 1;
+}
+
+// The number of inputs a text is sent as, a press and a release for each char
+uintmax_t text_events(const char *const text)
+{
+    uintmax_t n = 0;
+    for (const uint8_t *at = (const uint8_t *)text; *at; at++)
+        n += (*at & 0xC0) != 0x80;
+    return n * 2;
+}
+
+// Modifiers stay held between calls so a "k" can be split over several windows. Returns how much was typed, which
+// stops before a char cut off by the end when more follows
+size_t parse_keys(compiler *const com, const char *const chars, const size_t len, const int more, int *const modifiers)
+{
+    int state = *modifiers;
+    size_t i = 0;
+    while (i < len)
+    {
+        uint32_t c;
+        size_t n = next_char((const uint8_t *)chars + i, len - i, more, &c);
+        if (!n)
+            break;
+        int key = c < 65536 ? key_page(com, c >> 8)[c & 255] : 0xFFFF;
+        if (key == 0xFFFF)
+        {
+            warn_char(com, "Invalid key, ignored", c);
+            i += n;
+            continue;
+        }
+        int state_new = (key >> 8) & 255;
+        int state2 = state_new ^ state;
+        unsigned char low = key & 255;
+        if (state2)
+        {
+            if (state2 & 1)
+                add_event(com, 2, (uintmax_t[]){1, vk_shift, state & 1});
+            if (state2 & 2)
+                add_event(com, 2, (uintmax_t[]){1, vk_control, state & 2});
+            if (state2 & 4)
+                add_event(com, 2, (uintmax_t[]){1, vk_menu, state & 4});
+            if (state2 >> 3)
+                warn_char(com, "Keys other than shift, control, or alt required, skipped those keys", c);
+        }
+        add_event(com, 2, (uintmax_t[]){1, low, 0});
+        add_event(com, 2, (uintmax_t[]){1, low, 1});
+        state = state_new;
+        i += n;
+    }
+    *modifiers = state;
+    return i;
+}
+
+void release_keys(compiler *const com, const int state)
+{
+    if (state & 1)
+        add_event(com, 2, (uintmax_t[]){1, vk_shift, 1});
+    if (state & 2)
+        add_event(com, 2, (uintmax_t[]){1, vk_control, 1});
+    if (state & 4)
+        add_event(com, 2, (uintmax_t[]){1, vk_menu, 1});
+}
+
+// Copies len chars into a string that is reused by every call
+const char *to_string(compiler *const com, const char *const chars, const size_t len)
+{
+    while (com->slice.cap <= len)
+    {
+        com->slice.len = com->slice.cap;
+        expand(&com->slice);
+    }
+    memcpy(com->slice.data, chars, len);
+    ((char *)com->slice.data)[len] = 0;
+    return com->slice.data;
+}
+
+// Reads what follows "D" or "d": "l" for a line, "e" to ease in and out along a line, or "b" for a cubic Bézier
+// curve, then the points separated like the ones of "P" and the number of steps, and after a "," the duration in
+// milliseconds. "D" starts from a position given first, "d" from where the mouse is, and a curve has its two control
+// points before the end
+void read_path(compiler *const com, source *const src, size_t *const at, const int absolute)
+{
+    // The shape, whether it is absolute, the steps, the duration, and the points
+    uintmax_t data[12] = {path_linear, absolute};
+    if (*at == src->len)
+        *at -= refill(src, *at - 1);
+    char c = *at < src->len ? src->data[*at] : 0;
+    if (c == 'l' || c == 'e' || c == 'b')
+    {
+        data[0] = c == 'l' ? path_linear : c == 'e' ? path_ease : path_bezier;
+        (*at)++;
+    }
+    else
+        warn(com, "Unknown path shape, assuming a line", 36, absolute ? 'D' : 'd');
+    // Where each number read goes in the points
+    static const int ends[] = {6, 7}, curves[] = {2, 3, 4, 5, 6, 7};
+    const int *order = data[0] == path_bezier ? curves : ends;
+    size_t count = data[0] == path_bezier ? 6 : 2;
+    for (size_t i = 0; i < count + (absolute ? 2 : 0); i++)
+    {
+        size_t read_len = i ? next_arg(com, src, at, 1) : read_arg(com, src, at, 1);
+        data[4 + (!absolute ? order[i] : i < 2 ? (int)i : order[i - 2])] = parse_num(com, src->data + *at, read_len, 0);
+        *at += read_len;
+    }
+    size_t read_len = next_arg(com, src, at, 1);
+    data[2] = parse_num(com, src->data + *at, read_len, 0);
+    *at += read_len;
+    if (*at == src->len)
+        *at -= refill(src, *at - 1);
+    if (*at < src->len && src->data[*at] == ',')
+    {
+        read_len = next_arg(com, src, at, 4);
+        data[3] = parse_sleep(com, src->data + *at, read_len);
+        *at += read_len;
+    }
+    add_event(com, 11, data);
+}
+
+uint64_t now_ns()
+{
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER t;
+    if (!freq.QuadPart)
+        QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&t);
+    return (uint64_t)(t.QuadPart / freq.QuadPart) * 1000000000 + (uint64_t)(t.QuadPart % freq.QuadPart) * 1000000000 / freq.QuadPart;
+#else
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+#endif
+}
+
+uint64_t phase_start(const compiler *const com)
+{
+    return com->profile ? now_ns() : 0;
+}
+
+void phase_end(const compiler *const com, const int phase, const uint64_t start)
+{
+    if (com->profile)
+        com->profile->ns[phase] += now_ns() - start;
+}
+
+// Types the rest of the line with the keys of the layout. Text is typed a window at a time, so it can be longer than
+// the window
+void read_keys(compiler *const com, source *const src, size_t *const at, const char c)
+{
+    if (!com->layout)
+        load_keymap(com, "00000409");
+    int modifiers = 0;
+    size_t read_len = 0;
+    while (1)
+    {
+        size_t end = *at + scan_run(src->data + *at, src->len - *at, 0);
+        int more = end == src->len && !src->eof;
+        uint64_t keys_start = phase_start(com);
+        size_t typed = parse_keys(com, src->data + *at, end - *at, more, &modifiers);
+        phase_end(com, phase_keys, keys_start);
+        read_len += typed;
+        *at += typed;
+        if (!more)
+            break;
+        *at -= refill(src, *at - 1);
+    }
+    if (!read_len)
+        warn(com, "Nothing read", 13, c);
+    release_keys(com, modifiers);
+}
+
+// Puts the rest of the line in the text section as UTF-8, whatever it was read as, to be sent as Unicode chars. In a
+// mouse group or an array, where inputs are stored, it is typed like "k" instead
+void read_text(compiler *const com, source *const src, size_t *const at)
+{
+    if (com->group_state & 4 || com->brackets.len)
+    {
+        read_keys(com, src, at, 'u');
+        return;
+    }
+    size_t start = com->p.text.len;
+    while (1)
+    {
+        size_t end = *at + scan_run(src->data + *at, src->len - *at, 0);
+        int more = end == src->len && !src->eof;
+        reserve(&com->p.text, com->p.text.len + (end - *at) * 2 + 1);
+        uint8_t *out = com->p.text.data;
+        while (*at < end)
+        {
+            uint32_t c;
+            size_t n = next_char((const uint8_t *)src->data + *at, end - *at, more, &c);
+            if (!n)
+                break;
+            *at += n;
+            // Latin-1 takes 2 bytes as UTF-8, so the text is never more than twice as long as what was read
+            if (!c)
+                warn_char(com, "Invalid key, ignored", c);
+            else if (c < 0x80)
+                out[com->p.text.len++] = c;
+            else if (c < 0x800)
+            {
+                out[com->p.text.len++] = 0xC0 | c >> 6;
+                out[com->p.text.len++] = 0x80 | (c & 0x3F);
+            }
+            else
+            {
+                memcpy(out + com->p.text.len, src->data + *at - n, n);
+                com->p.text.len += n;
+            }
+        }
+        if (!more)
+            break;
+        *at -= refill(src, *at - 1);
+    }
+    if (com->p.text.len == start)
+        warn(com, "Nothing read", 13, 'u');
+    else
+        add_event(com, 12, (uintmax_t[]){start});
+}
+
+void compile(compiler *const com, source *const src)
+{
+    static const int mouse[] = {mouse_left_down, mouse_left_up, mouse_middle_down, mouse_middle_up, mouse_right_down, mouse_right_up};
+    size_t at = 0;
+    uint64_t begin = phase_start(com);
+    uint64_t others = com->profile ? com->profile->ns[phase_keys] + com->profile->ns[phase_expand] : 0;
+    while (1)
+    {
+        if (at == src->len)
+        {
+            if (src->eof)
+                break;
+            at -= refill(src, at);
+            continue;
+        }
+        release_source(src, at);
+        char c = src->data[at++];
+        if (c == '\n' || c == '\r')
+            continue;
+        int state = commands[(uint8_t)c] - 1;
+        if (state < 0)
+        {
+            warn(com, "Unknown command, ignored", 25, c);
+            continue;
+        }
+        if (state < 11)
+        {
+            if (state < 5)
+            {
+                size_t read_len = read_arg(com, src, &at, state < 2 ? 4 : 1);
+                uintmax_t num = state < 2 ? parse_sleep(com, src->data + at, read_len) : parse_num(com, src->data + at, read_len, 0);
+                at += read_len;
+                switch (state)
+                {
+                case 0:
+                    add_event(com, 4, (uintmax_t[]){num});
+                    break;
+                case 1:
+                    add_event(com, 3, (uintmax_t[]){num});
+                    break;
+                case 2:
+                    add_event(com, 2, (uintmax_t[]){0, mouse_wheel, num});
+                    break;
+                default:
+                {
+                    read_len = next_arg(com, src, &at, 1);
+                    uintmax_t num2 = parse_num(com, src->data + at, read_len, 0);
+                    at += read_len;
+                    add_event(com, 2, (uintmax_t[]){0, mouse_move, num, num2, state == 3});
+                    break;
+                }
+                }
+            }
+            else
+                add_event(com, 2, (uintmax_t[]){0, mouse[state - 5]});
+        }
+        else
+        {
+            if (state < 16)
+            {
+                if (state == 11)
+                {
+                    size_t read_len = read_arg(com, src, &at, 2);
+                    for (size_t j = 0; j < read_len; j++, at++)
+                    {
+                        int key = src->data[at];
+                        if (key < 48)
+                            key = key - 42 + vk_multiply;
+                        else
+                            key = key - 48 + vk_numpad0;
+                        add_event(com, 2, (uintmax_t[]){1, src->data[at] - 48 + vk_numpad0, 0});
+                        add_event(com, 2, (uintmax_t[]){1, src->data[at] - 48 + vk_numpad0, 1});
+                    }
+                }
+                else if (state == 12)
+                    read_keys(com, src, &at, c);
+                else
+                {
+                    size_t read_len = read_arg(com, src, &at, 3);
+                    if (state == 13)
+                    {
+                        load_keymap(com, to_string(com, src->data + at, read_len));
+                        at += read_len;
+                    }
+                    else
+                    {
+                        if (read_len & 1)
+                        {
+                            add_event(com, 2, (uintmax_t[]){1, parse_num(com, src->data + at, 1, 1), state == 15});
+                            at++;
+                        }
+                        read_len >>= 1;
+                        for (size_t j = 0; j < read_len; j++, at += 2)
+                            add_event(com, 2, (uintmax_t[]){1, parse_num(com, src->data + at, 2, 1), state == 15});
+                    }
+                }
+            }
+            else
+            {
+                if (state == 16)
+                    add_event(com, 5, (uintmax_t[]){0});
+                else if (state == 17)
+                    add_event(com, 5, (uintmax_t[]){1});
+                else if (state == 18)
+                    add_event(com, 6, (uintmax_t[]){0});
+                else if (state == 19)
+                {
+                    size_t read_len = read_arg(com, src, &at, 1);
+                    uintmax_t num = parse_num(com, src->data + at, read_len, 0);
+                    at += read_len;
+                    uint64_t expand_start = phase_start(com);
+                    add_event(com, 6, (uintmax_t[]){1, num});
+                    phase_end(com, phase_expand, expand_start);
+                }
+                else if (state == 20)
+                {
+                    size_t read_len = read_arg(com, src, &at, 1);
+                    uintmax_t num = parse_num(com, src->data + at, read_len, 0);
+                    at += read_len;
+                    add_event(com, 0, (uintmax_t[]){num});
+                }
+                else if (state == 21)
+                {
+                    uint64_t expand_start = phase_start(com);
+                    add_event(com, 1, NULL);
+                    phase_end(com, phase_expand, expand_start);
+                }
+                else if (state == 24)
+                    add_event(com, 10, NULL);
+                else if (state == 27)
+                    read_text(com, src, &at);
+                else if (state > 24)
+                    read_path(com, src, &at, state == 25);
+                else
+                {
+                    size_t read_len = read_arg(com, src, &at, 1);
+                    uintmax_t num = parse_num(com, src->data + at, read_len, 0);
+                    at += read_len;
+                    add_event(com, state == 22 ? 8 : 9, (uintmax_t[]){num});
+                }
+            }
+        }
+    }
+    uint64_t finalize_start = phase_start(com);
+    add_event(com, 7, NULL);
+    phase_end(com, phase_finalize, finalize_start);
+    if (com->profile)
+        com->profile->ns[phase_lex] += finalize_start - begin - (com->profile->ns[phase_keys] + com->profile->ns[phase_expand] - others);
+}
+
+compiler *new_compiler(const si_options *const options)
+{
+    compiler *com = calloc(1, sizeof(compiler));
+    if (!com)
+        handle_error("Error compiling");
+    arena *a = new_arena();
+    com->p = (program){{NULL, 0, 0, instruction_size, a}, {NULL, 0, 0, sequence_size, a}, {NULL, 0, 0, event_size, a}, {NULL, 0, 0, repeat_size, a}, {NULL, 0, 0, motion_size, a}, {NULL, 0, 0, path_size, a}, {NULL, 0, 0, 1, a}, 0, 0, a};
+    com->loop = (vector){NULL, 0, 0, sizet_size, a};
+    com->brackets = (vector){NULL, 0, 0, sizet_size, a};
+    com->slice = (vector){NULL, 0, 0, 1, a};
+    com->tracks = (vector){NULL, 0, 0, sizeof(track_code), a};
+    com->group_state = 9;
+    if (options)
+    {
+        com->report = options->report;
+        com->user = options->user;
+    }
+    return com;
+}
+
+// The arena stays with the program
+void free_compiler(compiler *const com)
+{
+    free(com->shared.entries);
+    free(com);
+}
+
+void free_program(program *const p)
+{
+    if (p->memory)
+    {
+        free_arena(p->memory);
+        return;
+    }
+    free(p->codes.data);
+    free(p->inputs.data);
+    free(p->events.data);
+    free(p->repeats.data);
+    free(p->motions.data);
+    free(p->paths.data);
+    free(p->text.data);
+}
+
+// Threads run a function once and are then joined, falling back to running it on the caller if one can't start
+typedef struct
+{
+    void (*run)(void *arg);
+    void *arg;
+    int started;
+#ifdef _WIN32
+    HANDLE handle;
+#else
+    pthread_t handle;
+#endif
+} thread;
+
+#ifdef _WIN32
+DWORD WINAPI thread_main(void *const arg)
+{
+    ((thread *)arg)->run(((thread *)arg)->arg);
+    return 0;
+}
+#else
+void *thread_main(void *const arg)
+{
+    ((thread *)arg)->run(((thread *)arg)->arg);
+    return NULL;
+}
+#endif
+
+// Returns 0 without running anything if the thread can't start
+int spawn_thread(thread *const t, void (*const run)(void *arg), void *const arg)
+{
+    t->run = run;
+    t->arg = arg;
+#ifdef _WIN32
+    t->started = (t->handle = CreateThread(NULL, 0, thread_main, t, 0, NULL)) != NULL;
+#else
+    t->started = !pthread_create(&t->handle, NULL, thread_main, t);
+#endif
+    return t->started;
+}
+
+void start_thread(thread *const t, void (*const run)(void *arg), void *const arg)
+{
+    if (!spawn_thread(t, run, arg))
+        run(arg);
+}
+
+void join_thread(thread *const t)
+{
+    if (!t->started)
+        return;
+#ifdef _WIN32
+    WaitForSingleObject(t->handle, INFINITE);
+    CloseHandle(t->handle);
+#else
+    pthread_join(t->handle, NULL);
+#endif
+}
+
+#ifdef _WIN32
+typedef SRWLOCK mutex;
+#else
+typedef pthread_mutex_t mutex;
+#endif
+
+void init_mutex(mutex *const m)
+{
+#ifdef _WIN32
+    InitializeSRWLock(m);
+#else
+    pthread_mutex_init(m, NULL);
+#endif
+}
+
+void lock_mutex(mutex *const m)
+{
+#ifdef _WIN32
+    AcquireSRWLockExclusive(m);
+#else
+    pthread_mutex_lock(m);
+#endif
+}
+
+void unlock_mutex(mutex *const m)
+{
+#ifdef _WIN32
+    ReleaseSRWLockExclusive(m);
+#else
+    pthread_mutex_unlock(m);
+#endif
+}
+
+void free_mutex(mutex *const m)
+{
+#ifndef _WIN32
+    pthread_mutex_destroy(m);
+#else
+    (void)m;
+#endif
+}
+
+// Big sources are split where nothing is open, so each chunk compiles to the same code it would as part of the whole
+// source. Only the "S" sleep and the "K" layout carry over, so those are found with a quick scan first
+enum
+{
+    chunk_min = 1 << 16,
+};
+
+typedef struct
+{
+    const char *data;
+    size_t len;
+    uintmax_t sleep;
+    const char *layout;
+    size_t layout_len;
+    compiler *com;
+    vector messages;
+    int failed;
+    int recoverable;
+    program *out;
+    size_t offsets[section_count];
+    compile_profile profile;
+} chunk;
+
+size_t arg_len(const char *const data, const size_t len, const size_t at, const int char_set)
+{
+    if (at == len || !arg_char(data[at], char_set, 1))
+        return 0;
+    return 1 + scan_run(data + at + 1, len - at - 1, char_set);
+}
+
+// What is open where a chunk could start, and the "S" sleep and "K" layout a chunk starting there gets
+typedef struct
+{
+    int group;
+    size_t brackets;
+    size_t loops;
+    uintmax_t sleep;
+    const char *layout;
+    size_t layout_len;
+} split_state;
+
+// Reads past one command, returning 0 if it closes a loop that was never opened or switches tracks, as tracks are only
+// put together at the end of a compile. Groups are opened and closed the way add_event does, including the ones it
+// closes or ignores with a warning
+int scan_command(split_state *const s, const char *const data, const size_t len, size_t *const pos)
+{
+    size_t at = *pos;
+    size_t read_len;
+    switch (data[at++])
+    {
+    case 'k':
+    case 'u':
+        at += scan_run(data + at, len - at, 0);
+        break;
+    case 'S':
+        read_len = arg_len(data, len, at, 4);
+        s->sleep = parse_sleep(NULL, data + at, read_len);
+        at += read_len;
+        break;
+    case 's':
+        at += arg_len(data, len, at, 4);
+        break;
+    case 'w':
+    case 'T':
+        at += arg_len(data, len, at, 1);
+        break;
+    case 'P':
+    case 'p':
+        at += arg_len(data, len, at, 1);
+        at += at < len;
+        at += arg_len(data, len, at, 1);
+        break;
+    case 'D':
+    case 'd':
+    {
+        size_t count = (at < len && data[at] == 'b' ? 7 : 3) + (data[at - 1] == 'D' ? 2 : 0);
+        at += at < len && (data[at] == 'l' || data[at] == 'e' || data[at] == 'b');
+        at += arg_len(data, len, at, 1);
+        for (size_t i = 1; i < count; i++)
+        {
+            at += at < len;
+            at += arg_len(data, len, at, 1);
+        }
+        if (at < len && data[at] == ',')
+            at += 1 + arg_len(data, len, at + 1, 4);
+        break;
+    }
+    case 'n':
+        at += arg_len(data, len, at, 2);
+        break;
+    case 'K':
+        s->layout = data + at;
+        s->layout_len = arg_len(data, len, at, 3);
+        at += s->layout_len;
+        break;
+    case 'C':
+    case 'c':
+        at += arg_len(data, len, at, 3);
+        break;
+    case '(':
+        s->group = 1;
+        break;
+    case ')':
+        s->group = 0;
+        break;
+    case '[':
+        s->group = 0;
+        s->brackets++;
+        break;
+    case ']':
+        at += arg_len(data, len, at, 1);
+        if (s->brackets)
+        {
+            s->group = 0;
+            s->brackets--;
+        }
+        break;
+    case '{':
+        at += arg_len(data, len, at, 1);
+        s->group = 0;
+        s->brackets = 0;
+        s->loops++;
+        break;
+    case '}':
+        s->group = 0;
+        s->brackets = 0;
+        if (!s->loops)
+            return 0;
+        s->loops--;
+        break;
+    case 't':
+        return 0;
+    }
+    *pos = at;
+    return 1;
+}
+
+// Returns the number of chunks, or 0 if the source has to be compiled as a whole
+size_t split_source(const char *const data, const size_t len, chunk *const chunks, const size_t count)
+{
+    size_t n = 0;
+    size_t at = 0;
+    size_t next = 0;
+    split_state s = {0, 0, 0, 0, NULL, 0};
+    while (at < len)
+    {
+        if (at >= next && !s.group && !s.brackets && !s.loops && n < count)
+        {
+            if (n)
+                chunks[n - 1].len = data + at - chunks[n - 1].data;
+            chunks[n] = (chunk){.data = data + at, .sleep = s.sleep, .layout = s.layout, .layout_len = s.layout_len};
+            n++;
+            next = len / count * n;
+        }
+        if (!scan_command(&s, data, len, &at))
+            return 0;
+    }
+    if (n)
+        chunks[n - 1].len = data + len - chunks[n - 1].data;
+    return n;
+}
+
+void collect(void *const user, const char *const message)
+{
+    vector *v = user;
+    for (const char *c = message;; c++)
+    {
+        expand(v);
+        ((char *)v->data)[v->len++] = *c;
+        if (!*c)
+            break;
+    }
+}
+
+void compile_chunk(void *const arg)
+{
+    chunk *c = arg;
+    source src;
+    open_buffer(&src, c->data, c->len);
+    c->com->sleep = c->sleep;
+    // Under a library call a failure fails just this chunk like an error does, as the other chunks are still running
+    jmp_buf *outer = recover;
+    if (c->recoverable)
+        recover = &c->com->fail;
+    if (setjmp(c->com->fail))
+        c->failed = 1;
+    else
+    {
+        if (c->layout)
+            use_keymap(c->com, find_keymap(to_string(c->com, c->layout, c->layout_len), c->com->key_cache));
+        compile(c->com, &src);
+    }
+    recover = outer;
+}
+
+// Copies lens[k] entries of each section of one program from from_offsets to to_offsets in another that has room for
+// them, moving the loop targets and indices in them along
+void copy_block(program *const to, const size_t *const to_offsets, const program *const from, const size_t *const from_offsets, const size_t *const lens)
+{
+    vector *const into[] = {&to->codes, &to->inputs, &to->events, &to->repeats, &to->motions, &to->paths, &to->text};
+    const vector *const out_of[] = {&from->codes, &from->inputs, &from->events, &from->repeats, &from->motions, &from->paths, &from->text};
+    size_t moved[section_count];
+    for (int k = 0; k < section_count; k++)
+    {
+        if (lens[k])
+            memcpy((char *)into[k]->data + to_offsets[k] * into[k]->unit, (const char *)out_of[k]->data + from_offsets[k] * out_of[k]->unit, lens[k] * into[k]->unit);
+        moved[k] = to_offsets[k] - from_offsets[k];
+    }
+    instruction *codes = (instruction *)to->codes.data + to_offsets[0];
+    sequence *inputs = (sequence *)to->inputs.data + to_offsets[1];
+    for (size_t i = 0; i < lens[0]; i++)
+    {
+        if (codes[i].opcode == 1)
+            codes[i].immediate += moved[0];
+        else if (codes[i].opcode == 2)
+            codes[i].immediate += moved[1];
+        else if (codes[i].opcode == 8)
+            codes[i].immediate += moved[5];
+        else if (codes[i].opcode == 9)
+            codes[i].immediate += moved[6];
+    }
+    for (size_t i = 0; i < lens[1]; i++)
+    {
+        inputs[i].start += moved[2];
+        inputs[i].repeat += moved[3];
+    }
+    if (lens[4] && moved[4])
+    {
+        event *events = (event *)to->events.data + to_offsets[2];
+        for (size_t i = 0; i < lens[2]; i++)
+            if (events[i].type == event_motion)
+                events[i].motion += moved[4];
+    }
+}
+
+// Copies a compiled chunk to its place in the whole program
+void join_chunk(void *const arg)
+{
+    chunk *c = arg;
+    program *p = &c->com->p;
+    const size_t from[section_count] = {0};
+    const size_t lens[section_count] = {p->codes.len, p->inputs.len, p->events.len, p->repeats.len, p->motions.len, p->paths.len, p->text.len};
+    copy_block(c->out, c->offsets, p, from, lens);
+    free_program(p);
+}
+
+void run_chunks(chunk *const chunks, const size_t n, void (*const run)(void *arg))
+{
+    thread *workers = malloc(n * sizeof(thread));
+    if (!workers)
+        handle_error("Error compiling");
+    for (size_t i = 1; i < n; i++)
+        start_thread(&workers[i], run, &chunks[i]);
+    run(&chunks[0]);
+    for (size_t i = 1; i < n; i++)
+        join_thread(&workers[i]);
+    free(workers);
+}
+
+// The first chunk is grown in place to hold the others, so it is never copied
+void grow_vector(vector *const v, const size_t len)
+{
+    if (len > v->cap)
+    {
+        v->data = arena_grow(v->arena, v->data, v->cap * v->unit, len * v->unit);
+        v->cap = len;
+    }
+    v->len = len;
+}
+
+// Compiles with up to threads chunks at once when the whole source is in memory. Messages are kept until every chunk
+// is done and then reported in order, stopping at the first error
+void compile_source(compiler *const com, source *const src, const size_t threads)
+{
+    size_t count = src->buffer ? 0 : src->len / chunk_min;
+    if (count > threads)
+        count = threads;
+    chunk *chunks = count > 1 ? malloc(count * sizeof(chunk)) : NULL;
+    size_t n = chunks ? split_source(src->data, src->len, chunks, count) : 0;
+    if (n < 2)
+    {
+        free(chunks);
+        compile(com, src);
+        return;
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        chunks[i].com = new_compiler(NULL);
+        chunks[i].com->report = collect;
+        chunks[i].com->user = &chunks[i].messages;
+        chunks[i].com->key_cache = com->key_cache;
+        memset(&chunks[i].profile, 0, sizeof(compile_profile));
+        chunks[i].com->profile = com->profile ? &chunks[i].profile : NULL;
+        chunks[i].messages = (vector){NULL, 0, 0, 1, chunks[i].com->p.memory};
+        chunks[i].failed = 0;
+        chunks[i].recoverable = recover != NULL;
+        chunks[i].out = &com->p;
+    }
+    run_chunks(chunks, n, compile_chunk);
+    uint64_t join_start = phase_start(com);
+    if (com->profile)
+        for (size_t i = 0; i < n; i++)
+            for (int j = phase_lex; j < phase_count; j++)
+                com->profile->ns[j] += chunks[i].profile.ns[j];
+
+    size_t failed = n;
+    size_t lens[section_count] = {0};
+    for (size_t i = 0; i < n; i++)
+    {
+        const char *messages = chunks[i].messages.data;
+        for (size_t at = 0; at < chunks[i].messages.len; at += strlen(messages + at) + 1)
+            report(com, messages + at);
+        if (chunks[i].failed)
+        {
+            failed = i;
+            break;
+        }
+        program *p = &chunks[i].com->p;
+        com->p.warnings += p->warnings;
+        com->sequences += chunks[i].com->sequences;
+        com->shared_bytes += chunks[i].com->shared_bytes;
+        if (p->depth > com->p.depth)
+            com->p.depth = p->depth;
+        const size_t chunk_lens[section_count] = {p->codes.len, p->inputs.len, p->events.len, p->repeats.len, p->motions.len, p->paths.len, p->text.len};
+        for (int j = 0; j < section_count; j++)
+        {
+            chunks[i].offsets[j] = lens[j];
+            lens[j] += chunk_lens[j];
+        }
+    }
+    if (failed < n)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            free_program(&chunks[i].com->p);
+            free_compiler(chunks[i].com);
+        }
+        free(chunks);
+        longjmp(com->fail, 1);
+    }
+    program *first = &chunks[0].com->p;
+    grow_vector(&first->codes, lens[0]);
+    grow_vector(&first->inputs, lens[1]);
+    grow_vector(&first->events, lens[2]);
+    grow_vector(&first->repeats, lens[3]);
+    grow_vector(&first->motions, lens[4]);
+    grow_vector(&first->paths, lens[5]);
+    grow_vector(&first->text, lens[6]);
+    // The whole program lives in the first chunk's arena, the one of com was never used
+    free_arena(com->p.memory);
+    com->p.codes = first->codes;
+    com->p.inputs = first->inputs;
+    com->p.events = first->events;
+    com->p.repeats = first->repeats;
+    com->p.motions = first->motions;
+    com->p.paths = first->paths;
+    com->p.text = first->text;
+    com->p.memory = first->memory;
+    com->loop.arena = com->brackets.arena = com->slice.arena = com->tracks.arena = first->memory;
+    run_chunks(chunks + 1, n - 1, join_chunk);
+    for (size_t i = 0; i < n; i++)
+        free_compiler(chunks[i].com);
+    free(chunks);
+    // Each chunk only shared sequences within itself
+    com->shared_bytes += share_program(&com->p);
+    phase_end(com, phase_finalize, join_start);
+}
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t units[section_count];
+    uint64_t key;
+    uint64_t depth;
+    uint64_t warnings;
+    uint64_t lens[section_count];
+    uint64_t offsets[section_count];
+} program_header;
+
+int write_program(const program *const p, const uint64_t key, const char *const path)
+{
+    static const char zeros[program_align] = {0};
+    const vector *sections[] = {&p->codes, &p->inputs, &p->events, &p->repeats, &p->motions, &p->paths, &p->text};
+    program_header header = {.magic = "SIPROG", .version = program_version, .key = key, .depth = p->depth, .warnings = p->warnings};
+    uint64_t offset = sizeof(header);
+    for (int i = 0; i < section_count; i++)
+    {
+        offset = (offset + program_align - 1) / program_align * program_align;
+        header.units[i] = sections[i]->unit;
+        header.lens[i] = sections[i]->len;
+        header.offsets[i] = offset;
+        offset += sections[i]->len * sections[i]->unit;
+    }
+    FILE *file = fopen(path, "wb");
+    if (!file)
+        return 0;
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    offset = sizeof(header);
+    for (int i = 0; i < section_count && ok; i++)
+    {
+        ok = fwrite(zeros, 1, header.offsets[i] - offset, file) == header.offsets[i] - offset;
+        if (sections[i]->len)
+            ok = ok && fwrite(sections[i]->data, sections[i]->unit, sections[i]->len, file) == sections[i]->len;
+        offset = header.offsets[i] + sections[i]->len * sections[i]->unit;
+    }
+    return !fclose(file) && ok;
+}
+
+// Points the program into the mapped file after checking that everything in it is in range
+int load_program(program *const p, const mapping *const m, const uint64_t key)
+{
+    static const size_t units[] = {instruction_size, sequence_size, event_size, repeat_size, motion_size, path_size, 1};
+    vector *sections[] = {&p->codes, &p->inputs, &p->events, &p->repeats, &p->motions, &p->paths, &p->text};
+    program_header header;
+    if (m->len < sizeof(header))
+        return 0;
+    memcpy(&header, m->data, sizeof(header));
+    if (memcmp(header.magic, "SIPROG", 7) || header.version != program_version || (key && header.key != key))
+        return 0;
+    for (int i = 0; i < section_count; i++)
+    {
+        if (header.units[i] != units[i] || header.offsets[i] % program_align || header.offsets[i] > m->len)
+            return 0;
+        if (header.lens[i] > (m->len - header.offsets[i]) / units[i])
+            return 0;
+        *sections[i] = (vector){(void *)(m->data + header.offsets[i]), header.lens[i], 0, units[i], NULL};
+    }
+    p->depth = header.depth;
+    p->warnings = header.warnings;
+    p->memory = NULL;
+
+    const instruction *ins = p->codes.data;
+    const sequence *seq = p->inputs.data;
+    const repeat *rep = p->repeats.data;
+    // Each loop end has to go back to the innermost loop still open, or loops would cross and run past the counters the
+    // depth makes room for. Tracks start where no loop is open, so loops end in the track they start in
+    size_t *starts = malloc((p->depth < p->codes.len ? p->depth : p->codes.len) * sizet_size + 1);
+    if (!starts)
+        handle_error("Error loading program");
+    size_t open = 0;
+    int valid = 1;
+    for (size_t i = 0; i < p->codes.len && valid; i++)
+    {
+        if (ins[i].opcode == 0)
+        {
+            if (open == p->depth)
+                valid = 0;
+            else
+                starts[open++] = i;
+        }
+        else if (ins[i].opcode == 1 && (!open || ins[i].immediate != starts[--open]))
+            valid = 0;
+        if ((ins[i].opcode == 2 && ins[i].immediate >= p->inputs.len) || ins[i].opcode < 0 || ins[i].opcode > 9 || ins[i].opcode == 5)
+            valid = 0;
+        if (ins[i].opcode == 8 && ins[i].immediate >= p->paths.len)
+            valid = 0;
+        if (ins[i].opcode == 9 && (ins[i].immediate >= p->text.len || (((const uint8_t *)p->text.data)[ins[i].immediate] & 0xC0) == 0x80))
+            valid = 0;
+        if (ins[i].opcode == 6 && open)
+            valid = 0;
+    }
+    free(starts);
+    if (!valid)
+        return 0;
+    const event *events = p->events.data;
+    for (size_t i = 0; i < p->events.len; i++)
+        if (events[i].type > event_motion || (events[i].type == event_motion && events[i].motion >= p->motions.len))
+            return 0;
+    for (size_t i = 0; i < p->paths.len; i++)
+        if (!path_fits((const path *)p->paths.data + i))
+            return 0;
+    if (!text_fits(p->text.data, p->text.len))
+        return 0;
+    // Repeats have to be nested in the order their brackets were opened
+    size_t *ends = malloc(p->repeats.len * sizet_size + 1);
+    if (!ends)
+        handle_error("Error loading program");
+    int ok = 1;
+    for (size_t i = 0; i < p->inputs.len && ok; i++)
+    {
+        if (seq[i].start > p->events.len || seq[i].len > p->events.len - seq[i].start)
+            ok = 0;
+        else if (seq[i].repeat > p->repeats.len || seq[i].repeats > p->repeats.len - seq[i].repeat)
+            ok = 0;
+        size_t open_len = 0;
+        for (size_t j = seq[i].repeat; j < seq[i].repeat + seq[i].repeats && ok; j++)
+        {
+            while (open_len && ends[open_len - 1] <= rep[j].begin)
+                open_len--;
+            if (rep[j].begin >= rep[j].end || rep[j].end > seq[i].len || !rep[j].count)
+                ok = 0;
+            else if (open_len && (rep[j].end > ends[open_len - 1] || rep[j].begin < rep[j - 1].begin))
+                ok = 0;
+            ends[open_len++] = rep[j].end;
+        }
+    }
+    free(ends);
+    return ok;
+}
+
+typedef struct sink
+{
+    size_t (*send)(struct sink *const out, const event *const events, const size_t len);
+    // Waits until a time from now_ns and returns the time it woke up, or returns 0 if the output does not wait
+    uint64_t (*sleep)(struct sink *const out, const uint64_t until);
+    void (*flush)(struct sink *const out);
+    void (*close)(struct sink *const out);
+    void *data;
+    const motion *motions;
+    // How late the system has been waking up lately
+    uint64_t slack;
+    // The most events given to send at once, 0 for the default
+    size_t max_batch;
+    // Sends from a thread of its own while the program runs ahead
+    int pipelined;
+    // Set by an output that can not send anymore, so what is left of a batch is given up on instead of sent again
+    int broken;
+#ifdef _WIN32
+    // The timer sleep_until waits on, made by the first sleep and kept until the output is closed
+    HANDLE timer;
+#endif
+} sink;
+
+// Unpacks the movement of an input, which is all 0 for keys and text
+motion unpack_motion(const sink *const out, const event *const e)
+{
+    motion m = {0, 0, 0};
+    if (e->type == event_motion)
+        return out->motions[e->motion];
+    if (e->type == event_text)
+        return m;
+    if (e->flags & mouse_wheel)
+        m.wheel = e->wheel;
+    else if (e->flags & mouse_absolute)
+    {
+        m.dx = e->move.dx;
+        m.dy = e->move.dy;
+    }
+    else
+    {
+        m.dx = (int16_t)e->move.dx;
+        m.dy = (int16_t)e->move.dy;
+    }
+    return m;
+}
+
+enum
+{
+    spin_ns = 50000,
+};
+
+#if defined(_WIN32) && !defined(CREATE_WAITABLE_TIMER_HIGH_RESOLUTION)
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+// Sleeps are waited for on an absolute timeline, so time spent sending and waking up late is not added up. The system
+// is asked to wake up early by how late it has been, and the last microseconds are spun
+uint64_t sleep_until(struct sink *const out, const uint64_t until)
+{
+    uint64_t now = now_ns();
+    if (now < until && until - now > out->slack + spin_ns)
+    {
+        uint64_t wake = until - out->slack - spin_ns;
+#ifdef _WIN32
+        if (!out->timer)
+            out->timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+        LARGE_INTEGER due;
+        due.QuadPart = -(LONGLONG)((wake - now) / 100);
+        if (out->timer && SetWaitableTimer(out->timer, &due, 0, NULL, NULL, FALSE))
+            WaitForSingleObject(out->timer, INFINITE);
+        else
+            Sleep((DWORD)((wake - now) / 1000000));
+#elif defined(TIMER_ABSTIME)
+        struct timespec t = {wake / 1000000000, wake % 1000000000};
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR)
+            ;
+#else
+        struct timespec t = {(wake - now) / 1000000000, (wake - now) % 1000000000};
+        while (nanosleep(&t, &t) && errno == EINTR)
+            ;
+#endif
+        now = now_ns();
+        uint64_t late = now > wake ? now - wake : 0;
+        out->slack = out->slack - out->slack / 8 + late / 8;
+    }
+    while (now < until)
+        now = now_ns();
+    return now;
+}
+
+void no_flush(struct sink *const out)
+{
+    (void)out;
+}
+
+// Closes what sleep_until kept for the output, for every output that sleeps with it
+void close_timer(struct sink *const out)
+{
+#ifdef _WIN32
+    if (out->timer)
+        CloseHandle(out->timer);
+    out->timer = NULL;
+#else
+    (void)out;
+#endif
+}
+
+void free_close(struct sink *const out)
+{
+    close_timer(out);
+    if (out->data)
+        free(((vector *)out->data)->data);
+    free(out->data);
+}
+
+size_t null_send(struct sink *const out, const event *const events, const size_t len)
+{
+    (void)out;
+    (void)events;
+    return len;
+}
+
+uint64_t null_sleep(struct sink *const out, const uint64_t until)
+{
+    (void)out;
+    (void)until;
+    return 0;
+}
+
+// Trace files are a header followed by one record per event, timed from when the sink was opened
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+} trace_header;
+
+typedef struct
+{
+    uint64_t time;
+    uint32_t flags;
+    uint16_t key;
+    uint8_t keyboard;
+    uint8_t reserved;
+    int32_t dx;
+    int32_t dy;
+    int32_t wheel;
+} trace_record;
+
+typedef struct
+{
+    FILE *file;
+    uint64_t start;
+} recorder;
+
+size_t record_send(struct sink *const out, const event *const events, const size_t len)
+{
+    recorder *r = out->data;
+    trace_record rec = {.time = now_ns() - r->start};
+    for (size_t i = 0; i < len; i++)
+    {
+        motion m = unpack_motion(out, &events[i]);
+        rec.flags = events[i].flags;
+        rec.key = events[i].key;
+        // Text is recorded as keyboard 2 with the char in dx
+        rec.keyboard = events[i].type == event_text ? 2 : events[i].type == event_key;
+        rec.dx = events[i].type == event_text ? (int32_t)events[i].text : m.dx;
+        rec.dy = m.dy;
+        rec.wheel = m.wheel;
+        if (fwrite(&rec, sizeof(rec), 1, r->file) != 1)
+            return i;
+    }
+    return len;
+}
+
+void record_flush(struct sink *const out)
+{
+    fflush(((recorder *)out->data)->file);
+}
+
+void record_close(struct sink *const out)
+{
+    close_timer(out);
+    fclose(((recorder *)out->data)->file);
+    free(out->data);
+}
+
+#ifdef _WIN32
+// Text is sent as KEYEVENTF_UNICODE, which types the char whatever the layout and without touching the modifiers.
+// Chars past U+FFFF take an INPUT for each half of their surrogate pair
+size_t sendinput_send(struct sink *const out, const event *const events, const size_t len)
+{
+    vector *staging = out->data;
+    reserve(staging, len * 2);
+    INPUT *in = staging->data;
+    memset(in, 0, len * 2 * staging->unit);
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++, n++)
+    {
+        if (events[i].type == event_text)
+        {
+            uint32_t c = events[i].text;
+            in[n].type = INPUT_KEYBOARD;
+            in[n].ki.wScan = c < 0x10000 ? c : 0xD800 | (c - 0x10000) >> 10;
+            in[n].ki.dwFlags = KEYEVENTF_UNICODE | (events[i].flags & key_up ? KEYEVENTF_KEYUP : 0);
+            if (c >= 0x10000)
+            {
+                in[n + 1] = in[n];
+                in[++n].ki.wScan = 0xDC00 | (c & 0x3FF);
+            }
+        }
+        else if (events[i].type == event_key)
+        {
+            in[n].type = INPUT_KEYBOARD;
+            in[n].ki.wVk = events[i].key;
+            in[n].ki.dwFlags = events[i].flags;
+        }
+        else
+        {
+            motion m = unpack_motion(out, &events[i]);
+            in[n].type = INPUT_MOUSE;
+            in[n].mi.dwFlags = events[i].flags;
+            in[n].mi.dx = m.dx;
+            in[n].mi.dy = m.dy;
+            in[n].mi.mouseData = m.wheel;
+        }
+    }
+    size_t sent = SendInput(n, in, sizeof(INPUT));
+    if (n == len || sent == n)
+        return sent == n ? len : sent;
+    // Only inputs whose every INPUT went in count as sent
+    size_t done = 0;
+    for (n = 0; done < len; done++)
+    {
+        n += events[done].type == event_text && events[done].text >= 0x10000 ? 2 : 1;
+        if (n > sent)
+            break;
+    }
+    return done;
+}
+#endif
+
+#ifdef __linux__
+// Linux key codes by virtual key code, 0 where there is no equivalent
+static const unsigned short linux_keys[256] = {
+    [0x08] = KEY_BACKSPACE, [0x09] = KEY_TAB, [0x0D] = KEY_ENTER, [0x10] = KEY_LEFTSHIFT, [0x11] = KEY_LEFTCTRL,
+    [0x12] = KEY_LEFTALT, [0x13] = KEY_PAUSE, [0x14] = KEY_CAPSLOCK, [0x1B] = KEY_ESC, [0x20] = KEY_SPACE,
+    [0x21] = KEY_PAGEUP, [0x22] = KEY_PAGEDOWN, [0x23] = KEY_END, [0x24] = KEY_HOME, [0x25] = KEY_LEFT, [0x26] = KEY_UP,
+    [0x27] = KEY_RIGHT, [0x28] = KEY_DOWN, [0x2C] = KEY_SYSRQ, [0x2D] = KEY_INSERT, [0x2E] = KEY_DELETE,
+    [0x30] = KEY_0, [0x31] = KEY_1, [0x32] = KEY_2, [0x33] = KEY_3, [0x34] = KEY_4, [0x35] = KEY_5, [0x36] = KEY_6,
+    [0x37] = KEY_7, [0x38] = KEY_8, [0x39] = KEY_9, [0x41] = KEY_A, [0x42] = KEY_B, [0x43] = KEY_C, [0x44] = KEY_D,
+    [0x45] = KEY_E, [0x46] = KEY_F, [0x47] = KEY_G, [0x48] = KEY_H, [0x49] = KEY_I, [0x4A] = KEY_J, [0x4B] = KEY_K,
+    [0x4C] = KEY_L, [0x4D] = KEY_M, [0x4E] = KEY_N, [0x4F] = KEY_O, [0x50] = KEY_P, [0x51] = KEY_Q, [0x52] = KEY_R,
+    [0x53] = KEY_S, [0x54] = KEY_T, [0x55] = KEY_U, [0x56] = KEY_V, [0x57] = KEY_W, [0x58] = KEY_X, [0x59] = KEY_Y,
+    [0x5A] = KEY_Z, [0x5B] = KEY_LEFTMETA, [0x5C] = KEY_RIGHTMETA, [0x5D] = KEY_COMPOSE, [0x60] = KEY_KP0,
+    [0x61] = KEY_KP1, [0x62] = KEY_KP2, [0x63] = KEY_KP3, [0x64] = KEY_KP4, [0x65] = KEY_KP5, [0x66] = KEY_KP6,
+    [0x67] = KEY_KP7, [0x68] = KEY_KP8, [0x69] = KEY_KP9, [0x6A] = KEY_KPASTERISK, [0x6B] = KEY_KPPLUS,
+    [0x6C] = KEY_KPCOMMA, [0x6D] = KEY_KPMINUS, [0x6E] = KEY_KPDOT, [0x6F] = KEY_KPSLASH, [0x70] = KEY_F1,
+    [0x71] = KEY_F2, [0x72] = KEY_F3, [0x73] = KEY_F4, [0x74] = KEY_F5, [0x75] = KEY_F6, [0x76] = KEY_F7,
+    [0x77] = KEY_F8, [0x78] = KEY_F9, [0x79] = KEY_F10, [0x7A] = KEY_F11, [0x7B] = KEY_F12, [0x7C] = KEY_F13,
+    [0x7D] = KEY_F14, [0x7E] = KEY_F15, [0x7F] = KEY_F16, [0x80] = KEY_F17, [0x81] = KEY_F18, [0x82] = KEY_F19,
+    [0x83] = KEY_F20, [0x84] = KEY_F21, [0x85] = KEY_F22, [0x86] = KEY_F23, [0x87] = KEY_F24, [0x90] = KEY_NUMLOCK,
+    [0x91] = KEY_SCROLLLOCK, [0xA0] = KEY_LEFTSHIFT, [0xA1] = KEY_RIGHTSHIFT, [0xA2] = KEY_LEFTCTRL,
+    [0xA3] = KEY_RIGHTCTRL, [0xA4] = KEY_LEFTALT, [0xA5] = KEY_RIGHTALT, [0xAD] = KEY_MUTE, [0xAE] = KEY_VOLUMEDOWN,
+    [0xAF] = KEY_VOLUMEUP, [0xB0] = KEY_NEXTSONG, [0xB1] = KEY_PREVIOUSSONG, [0xB2] = KEY_STOPCD,
+    [0xB3] = KEY_PLAYPAUSE, [0xBA] = KEY_SEMICOLON, [0xBB] = KEY_EQUAL, [0xBC] = KEY_COMMA, [0xBD] = KEY_MINUS,
+    [0xBE] = KEY_DOT, [0xBF] = KEY_SLASH, [0xC0] = KEY_GRAVE, [0xDB] = KEY_LEFTBRACE, [0xDC] = KEY_BACKSLASH,
+    [0xDD] = KEY_RIGHTBRACE, [0xDE] = KEY_APOSTROPHE, [0xE2] = KEY_102ND};
+
+// Relative mouse and keys go to one device and absolute positions to a tablet-like one, since mixing both confuses input stacks
+typedef struct
+{
+    vector staging;
+    int fd;
+    int keys;
+    int pointer;
+    // Whether shift is held for the text being typed
+    int shift;
+    // The inputs of the current send whose events are all staged, and how many of them were written
+    size_t staged;
+    size_t written;
+    int broken;
+} uinput_state;
+
+// Programs that read inputs only start reading a new device a while after it appears, and drop what they have not read
+// yet from one that goes away, so the devices are left alone for this long after they are made and before they go
+enum
+{
+    uinput_settle_ns = 200000000,
+};
+
+int uinput_open(const char *const name, const int absolute)
+{
+    int fd = open("/dev/uinput", O_WRONLY);
+    if (fd < 0)
+    {
+        perror("Error opening /dev/uinput");
+        return -1;
+    }
+    int ok = !ioctl(fd, UI_SET_EVBIT, EV_KEY) && !ioctl(fd, UI_SET_EVBIT, EV_SYN);
+    ok = ok && !ioctl(fd, UI_SET_KEYBIT, BTN_LEFT) && !ioctl(fd, UI_SET_KEYBIT, BTN_RIGHT) && !ioctl(fd, UI_SET_KEYBIT, BTN_MIDDLE);
+    if (absolute)
+    {
+        struct uinput_abs_setup axis = {ABS_X, {.maximum = 65535}};
+        ok = ok && !ioctl(fd, UI_SET_EVBIT, EV_ABS) && !ioctl(fd, UI_ABS_SETUP, &axis);
+        axis.code = ABS_Y;
+        ok = ok && !ioctl(fd, UI_ABS_SETUP, &axis);
+    }
+    else
+    {
+        for (int i = 0; i < 256 && ok; i++)
+            if (linux_keys[i])
+                ok = !ioctl(fd, UI_SET_KEYBIT, linux_keys[i]);
+        ok = ok && !ioctl(fd, UI_SET_EVBIT, EV_REL) && !ioctl(fd, UI_SET_RELBIT, REL_X) && !ioctl(fd, UI_SET_RELBIT, REL_Y);
+        ok = ok && !ioctl(fd, UI_SET_RELBIT, REL_WHEEL) && !ioctl(fd, UI_SET_RELBIT, REL_WHEEL_HI_RES);
+    }
+    struct uinput_setup setup = {.id = {BUS_VIRTUAL, 0x1212, absolute + 1, 1}};
+    strcpy(setup.name, name);
+    if (!ok || ioctl(fd, UI_DEV_SETUP, &setup) || ioctl(fd, UI_DEV_CREATE))
+    {
+        perror("Error creating uinput device");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Once a write fails the devices are taken to be gone, and nothing more is staged or written
+void uinput_write(uinput_state *const u)
+{
+    size_t size = u->staging.len * u->staging.unit;
+    if (size && !u->broken && write(u->fd, u->staging.data, size) != (ssize_t)size)
+        u->broken = 1;
+    if (!u->broken)
+        u->written = u->staged;
+    u->staging.len = 0;
+}
+
+void uinput_emit(uinput_state *const u, const int fd, const int type, const int code, const int value)
+{
+    if (fd != u->fd)
+    {
+        uinput_write(u);
+        u->fd = fd;
+    }
+    if (u->broken)
+        return;
+    expand(&u->staging);
+    struct input_event *e = &((struct input_event *)u->staging.data)[u->staging.len++];
+    memset(e, 0, sizeof(*e));
+    e->type = type;
+    e->code = code;
+    e->value = value;
+}
+
+void uinput_shift(uinput_state *const u, const int shift)
+{
+    if (u->shift == shift)
+        return;
+    u->shift = shift;
+    uinput_emit(u, u->keys, EV_KEY, KEY_LEFTSHIFT, shift);
+    uinput_emit(u, u->keys, EV_SYN, SYN_REPORT, 0);
+}
+
+void uinput_tap(uinput_state *const u, const int key)
+{
+    uinput_emit(u, u->keys, EV_KEY, key, 1);
+    uinput_emit(u, u->keys, EV_SYN, SYN_REPORT, 0);
+    uinput_emit(u, u->keys, EV_KEY, key, 0);
+    uinput_emit(u, u->keys, EV_SYN, SYN_REPORT, 0);
+}
+
+// Types a char of text. uinput only has key codes, so chars on the US layout are typed with its keys, keeping shift
+// held for as long as the chars next to each other need it. Others are typed all on the press as ctrl+shift+u, the
+// char in hex and space, which GTK and IBus read as that char
+void uinput_text(uinput_state *const u, const event *const e)
+{
+    static const key_table us;
+    const uint32_t c = e->text;
+    const int key = c < 128 ? scan_key(&us, c) : 0xFFFF;
+    if (key != 0xFFFF && !(key >> 9) && linux_keys[key & 255])
+    {
+        if (!(e->flags & key_up))
+            uinput_shift(u, key >> 8);
+        uinput_emit(u, u->keys, EV_KEY, linux_keys[key & 255], !(e->flags & key_up));
+        uinput_emit(u, u->keys, EV_SYN, SYN_REPORT, 0);
+        return;
+    }
+    if (e->flags & key_up)
+        return;
+    uinput_shift(u, 1);
+    uinput_emit(u, u->keys, EV_KEY, KEY_LEFTCTRL, 1);
+    uinput_tap(u, KEY_U);
+    uinput_emit(u, u->keys, EV_KEY, KEY_LEFTCTRL, 0);
+    uinput_shift(u, 0);
+    int digits = 1;
+    while (digits < 6 && c >> 4 * digits)
+        digits++;
+    while (digits--)
+    {
+        int d = c >> 4 * digits & 15;
+        uinput_tap(u, linux_keys[d < 10 ? '0' + d : 'A' + d - 10]);
+    }
+    uinput_tap(u, KEY_SPACE);
+}
+
+// Returns how many inputs from the start were written whole. Keys uinput has no code for are taken without sending
+// anything, and a failed write stops the output so the batch is not sent again
+size_t uinput_send(struct sink *const out, const event *const events, const size_t len)
+{
+    static const int buttons[] = {BTN_LEFT, BTN_RIGHT, BTN_MIDDLE};
+    uinput_state *u = out->data;
+    u->staged = u->written = 0;
+    for (size_t i = 0; i < len && !u->broken; u->staged = ++i)
+    {
+        const event *e = &events[i];
+        if (e->type == event_text)
+        {
+            uinput_text(u, e);
+            continue;
+        }
+        uinput_shift(u, 0);
+        if (e->type == event_key)
+        {
+            if (linux_keys[e->key & 255])
+            {
+                uinput_emit(u, u->keys, EV_KEY, linux_keys[e->key & 255], !(e->flags & key_up));
+                uinput_emit(u, u->keys, EV_SYN, SYN_REPORT, 0);
+            }
+            continue;
+        }
+        motion m = unpack_motion(out, e);
+        if (e->flags & mouse_move && e->flags & mouse_absolute)
+        {
+            uinput_emit(u, u->pointer, EV_ABS, ABS_X, m.dx);
+            uinput_emit(u, u->pointer, EV_ABS, ABS_Y, m.dy);
+            uinput_emit(u, u->pointer, EV_SYN, SYN_REPORT, 0);
+        }
+        else if (e->flags & mouse_move)
+        {
+            uinput_emit(u, u->keys, EV_REL, REL_X, m.dx);
+            uinput_emit(u, u->keys, EV_REL, REL_Y, m.dy);
+        }
+        if (e->flags & mouse_wheel)
+        {
+            if (m.wheel / 120)
+                uinput_emit(u, u->keys, EV_REL, REL_WHEEL, m.wheel / 120);
+            uinput_emit(u, u->keys, EV_REL, REL_WHEEL_HI_RES, m.wheel);
+        }
+        for (int j = 0; j < 6; j++)
+            if (e->flags & mouse_left_down << j)
+                uinput_emit(u, u->keys, EV_KEY, buttons[j >> 1], !(j & 1));
+        uinput_emit(u, u->keys, EV_SYN, SYN_REPORT, 0);
+    }
+    uinput_shift(u, 0);
+    uinput_write(u);
+    out->broken = u->broken;
+    return u->written;
+}
+
+void uinput_close(struct sink *const out)
+{
+    uinput_state *u = out->data;
+    sleep_until(out, now_ns() + uinput_settle_ns);
+    ioctl(u->keys, UI_DEV_DESTROY);
+    ioctl(u->pointer, UI_DEV_DESTROY);
+    close(u->keys);
+    close(u->pointer);
+    free(u->staging.data);
+    free(u);
+}
+#endif
+
+// Returns 0 if the output is unknown or could not be opened
+int open_sink(sink *const out, const char *const name)
+{
+    *out = (sink){.send = null_send, .sleep = null_sleep, .flush = no_flush, .close = free_close, .data = NULL};
+    if (!strcmp(name, "null"))
+        return 1;
+    if (!strncmp(name, "record:", 7))
+    {
+        recorder *r = malloc(sizeof(recorder));
+        if (!r || !(r->file = fopen(name + 7, "wb")))
+        {
+            perror("Error opening trace file");
+            free(r);
+            return 0;
+        }
+        trace_header header = {"SITRACE", 1, sizeof(trace_record)};
+        fwrite(&header, sizeof(header), 1, r->file);
+        r->start = now_ns();
+        *out = (sink){.send = record_send, .sleep = sleep_until, .flush = record_flush, .close = record_close, .data = r};
+        return 1;
+    }
+#ifdef _WIN32
+    if (!strcmp(name, "sendinput"))
+    {
+        vector *staging = calloc(1, sizeof(vector));
+        if (!staging)
+            handle_error("Error opening output");
+        staging->unit = sizeof(INPUT);
+        *out = (sink){.send = sendinput_send, .sleep = sleep_until, .flush = no_flush, .close = free_close, .data = staging};
+        return 1;
+    }
+#endif
+#ifdef __linux__
+    if (!strcmp(name, "uinput"))
+    {
+        uinput_state *u = calloc(1, sizeof(uinput_state));
+        if (!u)
+            handle_error("Error opening output");
+        u->staging.unit = sizeof(struct input_event);
+        u->keys = uinput_open("SimulateInput", 0);
+        u->pointer = u->keys < 0 ? -1 : uinput_open("SimulateInput pointer", 1);
+        if (u->pointer < 0)
+        {
+            if (u->keys >= 0)
+            {
+                ioctl(u->keys, UI_DEV_DESTROY);
+                close(u->keys);
+            }
+            free(u);
+            return 0;
+        }
+        u->fd = u->keys;
+        *out = (sink){.send = uinput_send, .sleep = sleep_until, .flush = no_flush, .close = uinput_close, .data = u};
+        sleep_until(out, now_ns() + uinput_settle_ns);
+        return 1;
+    }
+#endif
+    puts("Error: Unknown output");
+    return 0;
+}
+
+enum
+{
+    batch_size = 4096,
+    slow_part_ns = 1000000,
+    retry_limit = 16,
+    retry_wait_ns = 10000,
+};
+
+typedef struct
+{
+    sink *out;
+    const event *events;
+    const repeat *repeats;
+    size_t repeats_len;
+    size_t next;
+    size_t len;
+    size_t failed;
+    // Events per second set by "T", 0 for no limit, and when everything sent so far is allowed to have been sent
+    uintmax_t rate;
+    uint64_t ready;
+    // Events given to the output at once, which shrinks when it takes less or slows down and grows back up to cap
+    size_t size;
+    size_t cap;
+    size_t size_min;
+    uint64_t fastest;
+    uint64_t sends;
+    uint64_t inputs;
+    uint64_t retries;
+    uint64_t dropped;
+    struct pipeline *pipe;
+    event *staging;
+} batch;
+
+void resize_batch(batch *const b, const size_t size)
+{
+    b->size = size < 1 ? 1 : size > b->cap ? b->cap : size;
+    if (b->size < b->size_min)
+        b->size_min = b->size;
+}
+
+// Batches are sent in parts of the current size. With a rate, parts are also at most a hundredth of a second of
+// events. The bucket holds that many, and each part waits until the bucket has refilled enough for it. Returns the
+// length of the part from at, and sets when to the time it can be sent, or 0 if that is now
+size_t next_part(batch *const b, const size_t at, uint64_t *const when)
+{
+    size_t n = b->len - at;
+    if (n > b->size)
+        n = b->size;
+    *when = 0;
+    if (b->rate)
+    {
+        uint64_t burst = b->rate / 100 ? b->rate / 100 : 1;
+        if (n > burst)
+            n = burst;
+        uint64_t cost = n * 1000000000 / b->rate;
+        uint64_t depth = burst * 1000000000 / b->rate;
+        const uint64_t now = now_ns();
+        if (b->ready < now)
+            b->ready = now;
+        if (b->ready + cost > now + depth)
+            *when = b->ready + cost - depth;
+    }
+    return n;
+}
+
+// Sends the part of n events from *at and moves *at past what the output took. Whatever it does not take is sent
+// again, waiting longer each time it takes nothing, until it has taken nothing too often. Returns 0 once the rest of
+// the batch is given up on
+int send_part(batch *const b, size_t *const at, const size_t n, int *const waits)
+{
+    if (b->rate)
+        b->ready += n * 1000000000 / b->rate;
+    uint64_t start = now_ns();
+    size_t sent = b->out->send(b->out, b->staging + *at, n);
+    uint64_t time = now_ns() - start;
+    b->sends++;
+    b->inputs += sent;
+    *at += sent;
+    if (sent < n && b->out->broken)
+    {
+        b->dropped += b->len - *at;
+        b->failed = 1;
+        return 0;
+    }
+    if (sent < n)
+    {
+        b->retries++;
+        if (sent)
+        {
+            resize_batch(b, sent);
+            *waits = 0;
+        }
+        else if (++*waits == retry_limit)
+        {
+            b->dropped += b->len - *at;
+            b->failed = 1;
+            return 0;
+        }
+        else
+            b->out->sleep(b->out, now_ns() + ((uint64_t)retry_wait_ns << (*waits - 1)));
+        return 1;
+    }
+    // A part that is slow for its size means the output is falling behind
+    if (time / n < b->fastest)
+        b->fastest = time / n;
+    if (time > slow_part_ns && time / n > b->fastest * 2)
+        resize_batch(b, b->size / 2);
+    else if (n == b->size)
+        resize_batch(b, b->size * 2);
+    return 1;
+}
+
+void send_batch(batch *const b)
+{
+    int waits = 0;
+    for (size_t at = 0; at < b->len;)
+    {
+        uint64_t when;
+        size_t n = next_part(b, at, &when);
+        if (when)
+            b->out->sleep(b->out, when);
+        if (!send_part(b, &at, n, &waits))
+            break;
+    }
+    b->len = 0;
+}
+
+void pass_batch(batch *const b);
+
+// Copies events begin to end of a sequence into the batch, sending it whenever it is full
+void stream(batch *const b, size_t begin, const size_t end)
+{
+    while (begin < end)
+    {
+        if (b->next < b->repeats_len && b->repeats[b->next].begin == begin)
+        {
+            const repeat *r = &b->repeats[b->next++];
+            size_t first = b->next;
+            for (uintmax_t i = 0; i < r->count; i++)
+            {
+                b->next = first;
+                stream(b, r->begin, r->end);
+            }
+            begin = r->end;
+            continue;
+        }
+        size_t stop = end;
+        if (b->next < b->repeats_len && b->repeats[b->next].begin < end)
+            stop = b->repeats[b->next].begin;
+        while (begin < stop)
+        {
+            size_t n = stop - begin;
+            if (n > b->cap - b->len)
+                n = b->cap - b->len;
+            memcpy(&b->staging[b->len], &b->events[begin], n * event_size);
+            b->len += n;
+            begin += n;
+            if (b->len == b->cap)
+                pass_batch(b);
+        }
+    }
+}
+
+// How late every sleep woke up, kept as a histogram with 16 steps for each power of 2 so the 99th percentile can be
+// found without keeping every sleep
+enum
+{
+    lateness_steps = 16,
+    lateness_buckets = 64 * lateness_steps,
+};
+
+typedef struct
+{
+    uint64_t count;
+    uint64_t min;
+    uint64_t max;
+    uint64_t total;
+    uint64_t buckets[lateness_buckets];
+} lateness;
+
+size_t lateness_bucket(const uint64_t ns)
+{
+    if (ns < lateness_steps)
+        return ns;
+    int bits = 4;
+    while (ns >> (bits + 1))
+        bits++;
+    return (bits - 3) * lateness_steps + (ns >> (bits - 4) & (lateness_steps - 1));
+}
+
+void add_lateness(lateness *const late, const uint64_t ns)
+{
+    if (!late->count || ns < late->min)
+        late->min = ns;
+    if (ns > late->max)
+        late->max = ns;
+    late->count++;
+    late->total += ns;
+    late->buckets[lateness_bucket(ns)]++;
+}
+
+// The largest lateness in the bucket the 99th percentile falls in, kept between the min and max so a bucket wider
+// than what was seen does not show a p99 outside of them
+uint64_t lateness_p99(const lateness *const late)
+{
+    uint64_t seen = 0;
+    uint64_t rank = late->count - late->count / 100;
+    size_t i = 0;
+    while ((seen += late->buckets[i]) < rank)
+        i++;
+    uint64_t p99 = i;
+    if (i >= lateness_steps)
+        p99 = ((uint64_t)(lateness_steps + i % lateness_steps + 1) << (i / lateness_steps - 1)) - 1;
+    if (p99 < late->min)
+        return late->min;
+    return p99 > late->max ? late->max : p99;
+}
+
+// What --profile collects while running, in nanoseconds. Every instruction is counted and every send of a sequence is
+// timed into a histogram with a bucket for each power of 2. Sends and sleeps are timed on the thread running the
+// program, so with --pipeline they are the time it takes to hand them to the sender
+enum
+{
+    send_buckets = 32,
+};
+
+typedef struct
+{
+    uint64_t *counts;
+    uint32_t (*sends)[send_buckets];
+    uint64_t *send_ns;
+    uint64_t run_ns;
+    uint64_t send_total;
+    uint64_t sleep_total;
+} run_profile;
+
+run_profile *new_run_profile(const program *const p)
+{
+    run_profile *r = calloc(1, sizeof(run_profile));
+    if (!r || !(r->counts = calloc(p->codes.len + 1, sizeof(uint64_t))) ||
+        !(r->sends = calloc(p->inputs.len + 1, sizeof(*r->sends))) ||
+        !(r->send_ns = calloc(p->inputs.len + 1, sizeof(uint64_t))))
+        handle_error("Error executing");
+    return r;
+}
+
+void free_run_profile(run_profile *const r)
+{
+    free(r->counts);
+    free(r->sends);
+    free(r->send_ns);
+    free(r);
+}
+
+// Adds what another run of the same program collected, for tracks that each profile on their own
+void add_run_profile(run_profile *const to, const run_profile *const from, const program *const p)
+{
+    for (size_t i = 0; i < p->codes.len; i++)
+        to->counts[i] += from->counts[i];
+    for (size_t i = 0; i < p->inputs.len; i++)
+    {
+        for (int j = 0; j < send_buckets; j++)
+            to->sends[i][j] += from->sends[i][j];
+        to->send_ns[i] += from->send_ns[i];
+    }
+    to->send_total += from->send_total;
+    to->sleep_total += from->sleep_total;
+}
+
+void add_send_time(run_profile *const r, const size_t index, const uint64_t ns)
+{
+    size_t bucket = 0;
+    while (bucket < send_buckets - 1 && ns >> (bucket + 1))
+        bucket++;
+    r->sends[index][bucket]++;
+    r->send_ns[index] += ns;
+    r->send_total += ns;
+}
+
+// What a track did, its run time lasting until it ended and its wait at barriers counted on its timeline
+typedef struct
+{
+    uintmax_t number;
+    uint64_t inputs;
+    uint64_t sends;
+    uint64_t dropped;
+    uint64_t run_ns;
+    uint64_t barrier_ns;
+} track_stats;
+
+// What a run did, for the summary printed after it
+typedef struct
+{
+    lateness late;
+    uint64_t sends;
+    uint64_t inputs;
+    uint64_t retries;
+    uint64_t dropped;
+    size_t batch_min;
+    size_t batch_last;
+    uint64_t producer_stalls;
+    uint64_t producer_stall_ns;
+    uint64_t sender_stalls;
+    uint64_t sender_stall_ns;
+    // Filled in if it is not NULL
+    run_profile *profile;
+    // For programs with tracks, what each did, kept until the caller frees it, and how far apart their first sends
+    // were each time they started together
+    track_stats *tracks;
+    size_t track_count;
+    uint64_t barriers;
+    uint64_t skews;
+    uint64_t skew_total;
+    uint64_t skew_max;
+} run_stats;
+
+// With --pipeline, one thread runs the program and fills a ring of batches while another sends them, so working out
+// the next batch overlaps with sending the last one. Sequences with nothing between them share a batch, and sleeps
+// and rate changes go through the ring as well, so they happen in order with the inputs around them. Each position
+// is only written by one side, so the ring needs no lock
+enum
+{
+    ring_slots = 8,
+    slot_events = 0,
+    slot_sleep,
+    slot_rate,
+    slot_barrier,
+    slot_end,
+};
+
+typedef struct
+{
+    int kind;
+    size_t len;
+    // The time to wait until, or the rate
+    uint64_t value;
+    event *events;
+} slot;
+
+typedef struct pipeline
+{
+    slot slots[ring_slots];
+    // Slots filled by the program and slots sent, on separate cache lines as each side keeps writing its own
+    volatile uint64_t filled;
+    char pad[64];
+    volatile uint64_t sent;
+    char pad2[64];
+    // How often and for how long the program waited for a free slot and the sender waited for a full one
+    uint64_t producer_stalls;
+    uint64_t producer_stall_ns;
+    uint64_t sender_stalls;
+    uint64_t sender_stall_ns;
+    size_t failed;
+    lateness *late;
+    thread sender;
+    batch *out;
+} pipeline;
+
+#ifdef _WIN32
+uint64_t load_position(volatile uint64_t *const at)
+{
+    return ReadAcquire64((volatile LONG64 *)at);
+}
+
+void store_position(volatile uint64_t *const at, const uint64_t value)
+{
+    WriteRelease64((volatile LONG64 *)at, value);
+}
+#else
+uint64_t load_position(volatile uint64_t *const at)
+{
+    return __atomic_load_n(at, __ATOMIC_ACQUIRE);
+}
+
+void store_position(volatile uint64_t *const at, const uint64_t value)
+{
+    __atomic_store_n(at, value, __ATOMIC_RELEASE);
+}
+#endif
+
+// Spins at first, then yields, then sleeps, so a side that waits for long does not keep a core busy
+void back_off(const unsigned tries)
+{
+    if (tries < 64)
+        return;
+#ifdef _WIN32
+    if (tries < 128)
+        SwitchToThread();
+    else
+        Sleep(1);
+#else
+    if (tries < 128)
+        sched_yield();
+    else
+    {
+        struct timespec t = {0, tries < 1024 ? 20000 : 1000000};
+        nanosleep(&t, NULL);
+    }
+#endif
+}
+
+// Waits until a slot the other side fills or frees moves past at, adding to the stall counts if it has to
+void wait_position(volatile uint64_t *const position, const uint64_t at, uint64_t *const stalls, uint64_t *const ns)
+{
+    if (load_position(position) > at)
+        return;
+    uint64_t start = now_ns();
+    for (unsigned tries = 0; load_position(position) <= at; tries++)
+        back_off(tries);
+    (*stalls)++;
+    *ns += now_ns() - start;
+}
+
+// Keeps the sender on the core it started on, so its caches stay warm between batches
+void pin_thread()
+{
+#ifdef _WIN32
+    SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << GetCurrentProcessorNumber());
+#elif defined(__linux__)
+    int cpu = sched_getcpu();
+    if (cpu >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+#endif
+}
+
+void run_sender(void *const arg)
+{
+    pipeline *q = arg;
+    batch *b = q->out;
+    pin_thread();
+    for (uint64_t at = 0;; at++)
+    {
+        wait_position(&q->filled, at, &q->sender_stalls, &q->sender_stall_ns);
+        slot *s = &q->slots[at % ring_slots];
+        if (s->kind == slot_end)
+            return;
+        if (s->kind == slot_events)
+        {
+            b->staging = s->events;
+            b->len = s->len;
+            send_batch(b);
+            if (b->failed)
+            {
+                puts("Warning: some inputs failed to send");
+                q->failed++;
+                b->failed = 0;
+            }
+        }
+        else if (s->kind == slot_sleep)
+        {
+            uint64_t woke = b->out->sleep(b->out, s->value);
+            if (woke && q->late)
+                add_lateness(q->late, woke - s->value);
+        }
+        else
+            b->rate = s->value;
+        store_position(&q->sent, at + 1);
+    }
+}
+
+batch *new_batch(sink *const out, const size_t cap)
+{
+    batch *b = malloc(sizeof(batch) + cap * event_size);
+    if (!b)
+        handle_error("Error executing");
+    *b = (batch){.out = out};
+    b->size = b->cap = b->size_min = cap;
+    b->fastest = UINT64_MAX;
+    b->staging = (event *)(b + 1);
+    return b;
+}
+
+// Makes a ring for the batch to be passed through, with a batch of its own to send what is taken out of it
+pipeline *new_pipeline(sink *const out, batch *const b, lateness *const late)
+{
+    pipeline *q = calloc(1, sizeof(pipeline));
+    event *events = malloc(ring_slots * b->cap * event_size);
+    if (!q || !events)
+        handle_error("Error executing");
+    for (size_t i = 0; i < ring_slots; i++)
+        q->slots[i].events = events + i * b->cap;
+    q->late = late;
+    q->out = new_batch(out, b->cap);
+    b->pipe = q;
+    b->staging = q->slots[0].events;
+    return q;
+}
+
+void free_pipeline(pipeline *const q)
+{
+    free(q->out);
+    free(q->slots[0].events);
+    free(q);
+}
+
+// Starts the sender, or returns NULL to send from the calling thread if it can't start
+pipeline *start_pipeline(sink *const out, batch *const b, lateness *const late)
+{
+    pipeline *q = new_pipeline(out, b, late);
+    if (!spawn_thread(&q->sender, run_sender, q))
+    {
+        b->pipe = NULL;
+        b->staging = (event *)(b + 1);
+        free_pipeline(q);
+        return NULL;
+    }
+    return q;
+}
+
+// Hands the slot being filled to the sender, and unless it is the last waits for the next one to be free. Inputs
+// waiting to be sent go first
+void pass_slot(batch *const b, const int kind, const uint64_t value)
+{
+    pipeline *q = b->pipe;
+    if (kind != slot_events && b->len)
+        pass_slot(b, slot_events, 0);
+    slot *s = &q->slots[q->filled % ring_slots];
+    s->kind = kind;
+    s->len = b->len;
+    s->value = value;
+    store_position(&q->filled, q->filled + 1);
+    b->len = 0;
+    if (kind == slot_end)
+        return;
+    if (q->filled >= ring_slots)
+        wait_position(&q->sent, q->filled - ring_slots, &q->producer_stalls, &q->producer_stall_ns);
+    b->staging = q->slots[q->filled % ring_slots].events;
+}
+
+void pass_batch(batch *const b)
+{
+    if (b->pipe)
+        pass_slot(b, slot_events, 0);
+    else
+        send_batch(b);
+}
+
+// Waits for the sender to finish, and puts what it did in stats
+size_t stop_pipeline(batch *const b, run_stats *const stats)
+{
+    pipeline *q = b->pipe;
+    pass_slot(b, slot_end, 0);
+    join_thread(&q->sender);
+    b->out->flush(b->out);
+    if (stats)
+    {
+        stats->producer_stalls = q->producer_stalls;
+        stats->producer_stall_ns = q->producer_stall_ns;
+        stats->sender_stalls = q->sender_stalls;
+        stats->sender_stall_ns = q->sender_stall_ns;
+    }
+    size_t failed = q->failed;
+    *b = *q->out;
+    free_pipeline(q);
+    return failed;
+}
+
+// Moves the timeline on by a sleep in microseconds and waits for it, timing how late the output woke up
+void wait_sleep(sink *const out, uint64_t *const deadline, const uintmax_t us, lateness *const late)
+{
+    *deadline = us > (UINT64_MAX - *deadline) / 1000 ? UINT64_MAX : *deadline + us * 1000;
+    uint64_t woke = out->sleep(out, *deadline);
+    if (woke && late)
+        add_lateness(late, woke - *deadline);
+}
+
+// Same as wait_sleep, but the sender does the waiting when there is one
+void sleep_batch(batch *const b, uint64_t *const deadline, const uintmax_t us, lateness *const late)
+{
+    if (!b->pipe)
+    {
+        wait_sleep(b->out, deadline, us, late);
+        return;
+    }
+    *deadline = us > (UINT64_MAX - *deadline) / 1000 ? UINT64_MAX : *deadline + us * 1000;
+    pass_slot(b, slot_sleep, *deadline);
+}
+
+void set_rate(batch *const b, const uintmax_t rate)
+{
+    if (b->pipe)
+        pass_slot(b, slot_rate, rate);
+    else
+        b->rate = rate;
+}
+
+// Sends every input of a sequence, returning 1 if some failed. When there is a sender, the inputs are only handed to
+// it once the batch is full or something else comes after them, and it reports failures once for each batch
+size_t send_sequence(const program *const p, batch *const b, const sequence *const s)
+{
+    b->events = &((const event *)p->events.data)[s->start];
+    b->repeats = &((const repeat *)p->repeats.data)[s->repeat];
+    b->repeats_len = s->repeats;
+    b->next = 0;
+    b->failed = 0;
+    stream(b, 0, s->len);
+    if (b->len && !b->pipe)
+        send_batch(b);
+    if (b->failed)
+    {
+        puts("Warning: some inputs failed to send");
+        return 1;
+    }
+    return 0;
+}
+
+// Where a path has got to as its moves are worked out. The points are clamped to what an input can hold, and each
+// input is the header of a move with its position or, for a relative path, how far it is from the last one
+typedef struct
+{
+    cubic k;
+    double low;
+    double high;
+    double scale;
+    int32_t last[2];
+    uint32_t header;
+    int absolute;
+} curve;
+
+enum
+{
+    path_chunk = 64,
+};
+
+curve start_curve(const path *const w)
+{
+    curve c = {path_cubic(w), 0, UINT16_MAX, 1.0 / w->steps, {w->points[0], w->points[1]}, w->flags,
+               w->flags & mouse_absolute};
+    if (!c.absolute)
+    {
+        c.low = INT32_MIN;
+        c.high = INT32_MAX;
+    }
+    // The type and key of a mouse input are 0, which leaves the flags
+    c.header = w->flags | event_mouse << 16;
+    return c;
+}
+
+#ifdef lane_count
+// Works out two steps at a time from step i on, and packs them into inputs with 32 bit lanes: x and y are rounded to
+// the nearest, taken from the last point for relative moves, and packed to 16 bits next to the header
+void curve_events(curve *const c, uint64_t i, const size_t n, event *const events)
+{
+#if defined(__AVX2__)
+    const __m256d a = _mm256_broadcast_pd((const __m128d *)c->k.a), b = _mm256_broadcast_pd((const __m128d *)c->k.b);
+    const __m256d cc = _mm256_broadcast_pd((const __m128d *)c->k.c), d = _mm256_broadcast_pd((const __m128d *)c->k.d);
+    const __m256d low = _mm256_set1_pd(c->low), high = _mm256_set1_pd(c->high);
+#else
+    const __m128d a = _mm_loadu_pd(c->k.a), b = _mm_loadu_pd(c->k.b), cc = _mm_loadu_pd(c->k.c), d = _mm_loadu_pd(c->k.d);
+    const __m128d low = _mm_set1_pd(c->low), high = _mm_set1_pd(c->high);
+#endif
+    const __m128i header = _mm_set1_epi32(c->header);
+    // Absolute positions go from 0 to 65535, so they are moved down to be packed with signed saturation
+    const __m128i bias = _mm_set1_epi32(0x8000), flip = _mm_set1_epi16((short)0x8000);
+    __m128i last = _mm_set_epi32(c->last[1], c->last[0], 0, 0);
+    for (size_t k = 0; k < n; k += 2, i += 2)
+    {
+        double t0 = (double)i * c->scale, t1 = (double)(i + 1) * c->scale;
+#if defined(__AVX2__)
+        __m256d t = _mm256_set_pd(t1, t1, t0, t0);
+        __m256d p = _mm256_add_pd(a, _mm256_mul_pd(t, _mm256_add_pd(b, _mm256_mul_pd(t, _mm256_add_pd(cc, _mm256_mul_pd(t, d))))));
+        __m128i xy = _mm256_cvtpd_epi32(_mm256_min_pd(_mm256_max_pd(p, low), high));
+#else
+        __m128d s = _mm_set1_pd(t0), t = _mm_set1_pd(t1);
+        __m128d p = _mm_add_pd(a, _mm_mul_pd(s, _mm_add_pd(b, _mm_mul_pd(s, _mm_add_pd(cc, _mm_mul_pd(s, d))))));
+        __m128d q = _mm_add_pd(a, _mm_mul_pd(t, _mm_add_pd(b, _mm_mul_pd(t, _mm_add_pd(cc, _mm_mul_pd(t, d))))));
+        __m128i xy = _mm_unpacklo_epi64(_mm_cvtpd_epi32(_mm_min_pd(_mm_max_pd(p, low), high)),
+                                        _mm_cvtpd_epi32(_mm_min_pd(_mm_max_pd(q, low), high)));
+#endif
+        __m128i moves;
+        if (c->absolute)
+        {
+            moves = _mm_sub_epi32(xy, bias);
+            moves = _mm_xor_si128(_mm_packs_epi32(moves, moves), flip);
+        }
+        else
+        {
+            // The point before each is the last one of the pair before, then the first of this pair
+            moves = _mm_sub_epi32(xy, _mm_unpacklo_epi64(_mm_unpackhi_epi64(last, last), xy));
+            moves = _mm_packs_epi32(moves, moves);
+        }
+        __m128i pair = _mm_unpacklo_epi32(header, moves);
+        if (k + 1 < n)
+        {
+            _mm_storeu_si128((__m128i *)(events + k), pair);
+            last = xy;
+        }
+        else
+        {
+            _mm_storel_epi64((__m128i *)(events + k), pair);
+            last = _mm_unpacklo_epi64(xy, xy);
+        }
+    }
+    int32_t lanes_out[4];
+    _mm_storeu_si128((__m128i *)lanes_out, last);
+    c->last[0] = lanes_out[2];
+    c->last[1] = lanes_out[3];
+}
+#else
+// Rounds halfway to even, like the vector conversions do
+int32_t round_point(const double v)
+{
+    double f = magnitude(v);
+    int64_t n = (int64_t)(f + 0.5);
+    if (n - f == 0.5 && n & 1)
+        n--;
+    return v < 0 ? -n : n;
+}
+
+void curve_events(curve *const c, uint64_t i, const size_t n, event *const events)
+{
+    for (size_t k = 0; k < n; k++, i++)
+    {
+        double t = (double)i * c->scale;
+        int32_t xy[2];
+        for (int j = 0; j < 2; j++)
+        {
+            double p = c->k.a[j] + t * (c->k.b[j] + t * (c->k.c[j] + t * c->k.d[j]));
+            xy[j] = round_point(p < c->low ? c->low : p > c->high ? c->high : p);
+        }
+        events[k] = (event){c->header & 0xFFFF};
+        events[k].move.dx = c->absolute ? xy[0] : xy[0] - c->last[0];
+        events[k].move.dy = c->absolute ? xy[1] : xy[1] - c->last[1];
+        c->last[0] = xy[0];
+        c->last[1] = xy[1];
+    }
+}
+#endif
+
+// Sends the moves of a path, working them out a part at a time straight into the batch, returning 1 if some failed.
+// Without a duration they are sent together like an array. Otherwise the duration is split over the steps as evenly
+// as whole microseconds go, and each step waits for its share on the timeline before it is sent
+size_t send_path(batch *const b, const path *const w, uint64_t *const deadline, lateness *const late)
+{
+    curve c = start_curve(w);
+    b->failed = 0;
+    if (!w->duration)
+    {
+        for (uint64_t i = 1; i <= w->steps;)
+        {
+            size_t n = b->cap - b->len;
+            if (n > w->steps - i + 1)
+                n = w->steps - i + 1;
+            curve_events(&c, i, n, b->staging + b->len);
+            b->len += n;
+            i += n;
+            if (b->len == b->cap)
+                pass_batch(b);
+        }
+        if (b->len && !b->pipe)
+            send_batch(b);
+    }
+    else
+    {
+        event moves[path_chunk];
+        uint64_t share = w->duration / w->steps, left = w->duration % w->steps, owed = 0;
+        for (uint64_t i = 1; i <= w->steps;)
+        {
+            size_t n = w->steps - i + 1 < path_chunk ? w->steps - i + 1 : path_chunk;
+            curve_events(&c, i, n, moves);
+            i += n;
+            for (size_t k = 0; k < n; k++)
+            {
+                uint64_t us = share;
+                if ((owed += left) >= w->steps)
+                {
+                    owed -= w->steps;
+                    us++;
+                }
+                sleep_batch(b, deadline, us, late);
+                b->staging[b->len++] = moves[k];
+                if (!b->pipe || b->len == b->cap)
+                    pass_batch(b);
+            }
+        }
+    }
+    if (b->failed)
+    {
+        puts("Warning: some inputs failed to send");
+        return 1;
+    }
+    return 0;
+}
+
+// Sends the chars of a text as a press and a release each, decoding them straight into the batch like an array,
+// returning 1 if some failed
+size_t send_text(batch *const b, const char *const text)
+{
+    const uint8_t *at = (const uint8_t *)text;
+    b->failed = 0;
+    while (*at)
+    {
+        uint32_t c;
+        // The text was checked when it was compiled or loaded, so every char is whole
+        at += next_char(at, 4, 0, &c);
+        for (int up = 0; up < 2; up++)
+        {
+            event *e = &b->staging[b->len++];
+            *e = (event){.flags = up ? key_up : 0, .type = event_text};
+            e->text = c;
+            if (b->len == b->cap)
+                pass_batch(b);
+        }
+    }
+    if (b->len && !b->pipe)
+        send_batch(b);
+    if (b->failed)
+    {
+        puts("Warning: some inputs failed to send");
+        return 1;
+    }
+    return 0;
+}
+
+// Programs are run from a copy where each instruction points straight at the code that runs it, and the commonest
+// runs of instructions are fused into one. GCC and Clang jump between handlers with computed goto, others or builds
+// with SI_SWITCH_DISPATCH use a switch
+#if defined(__GNUC__) && !defined(SI_SWITCH_DISPATCH)
+#define computed_goto
+#endif
+
+enum
+{
+    op_loop,
+    op_end,
+    op_send,
+    op_sleep,
+    op_send_sleep,
+    op_loop_send,
+    op_loop_send_sleep,
+    op_rate,
+    op_count,
+    op_profile_send,
+    op_profile_sleep,
+    op_barrier,
+    op_path,
+    op_text,
+    op_exit,
+};
+
+typedef struct
+{
+#ifdef computed_goto
+    const void *handler;
+#else
+    int handler;
+#endif
+    // The loop count, or for the end of a loop the index of its start
+    uintmax_t count;
+    uintmax_t sleep;
+    const sequence *s;
+    const path *path;
+    const char *text;
+} threaded;
+
+#ifdef computed_goto
+#define set_handler(t, op) (t).handler = handlers[op]
+#else
+#define set_handler(t, op) (t).handler = op
+#endif
+
+// Loops that only send one sequence, with or without a sleep after it, and sends followed by a sleep become one
+// instruction. Loop ends only jump to loop starts, so nothing jumps into the middle of a fused instruction. For
+// profiling, nothing is fused, every instruction comes after one that counts it, and sends and sleeps are timed, so
+// runs that are not profiled do no extra work. Threads the code from start up to the end of its track, leaving out
+// barriers unless the program is run as tracks
+threaded *thread_program(const program *const p, const void *const *const handlers, const int profile, const size_t start, const int barriers)
+{
+    const instruction *ins = p->codes.data;
+    const sequence *seq = p->inputs.data;
+    threaded *ops = malloc(((profile ? 2 : 1) * p->codes.len + 1) * sizeof(threaded));
+    size_t *index = malloc((p->codes.len + 1) * sizet_size);
+    if (!ops || !index)
+        handle_error("Error executing");
+#ifndef computed_goto
+    (void)handlers;
+#endif
+    size_t n = 0;
+    for (size_t i = start; i < p->codes.len; n++)
+    {
+        int op = ins[i].opcode;
+        threaded t = {0};
+        // Jumps only link the segments of a watched program, and are followed here so running them costs nothing
+        if (op == 5)
+        {
+            i = ins[i].immediate < p->codes.len ? ins[i].immediate : p->codes.len;
+            n--;
+            continue;
+        }
+        if (op == 7 && !barriers)
+        {
+            i++;
+            n--;
+            continue;
+        }
+        if (op == 6)
+            break;
+        if (profile)
+        {
+            set_handler(ops[n], op_count);
+            ops[n++].count = i;
+        }
+        index[i] = n;
+        if (!profile && op == 0 && i + 2 < p->codes.len && ins[i + 1].opcode == 2 && ins[i + 2].opcode == 1 &&
+            ins[i + 2].immediate == i)
+        {
+            op = op_loop_send;
+            t.s = &seq[ins[i + 1].immediate];
+            t.count = ins[i].immediate;
+            i += 3;
+        }
+        else if (!profile && op == 0 && i + 3 < p->codes.len && ins[i + 1].opcode == 2 && ins[i + 2].opcode == 3 &&
+                 ins[i + 3].opcode == 1 && ins[i + 3].immediate == i)
+        {
+            op = op_loop_send_sleep;
+            t.s = &seq[ins[i + 1].immediate];
+            t.sleep = ins[i + 2].immediate;
+            t.count = ins[i].immediate;
+            i += 4;
+        }
+        else if (!profile && op == 2 && i + 1 < p->codes.len && ins[i + 1].opcode == 3)
+        {
+            op = op_send_sleep;
+            t.s = &seq[ins[i].immediate];
+            t.sleep = ins[i + 1].immediate;
+            i += 2;
+        }
+        else
+        {
+            if ((op > 4 && op < 7) || op > 9)
+            {
+                puts("Error: Internal error while executing, please submit the input file with a bug report");
+                exit(EXIT_FAILURE);
+            }
+            if (op == 7)
+                op = op_barrier;
+            else if (op == 8)
+            {
+                op = op_path;
+                t.path = &((const path *)p->paths.data)[ins[i].immediate];
+            }
+            else if (op == 9)
+            {
+                op = op_text;
+                t.text = (const char *)p->text.data + ins[i].immediate;
+            }
+            else if (op == 0)
+                t.count = ins[i].immediate;
+            else if (op == 1)
+                t.count = index[ins[i].immediate];
+            else if (op == 2)
+                t.s = &seq[ins[i].immediate];
+            else if (op == 3)
+                t.sleep = ins[i].immediate;
+            else
+            {
+                op = op_rate;
+                t.count = ins[i].immediate;
+            }
+            if (profile && op == 2)
+                op = op_profile_send;
+            else if (profile && op == 3)
+                op = op_profile_sleep;
+            i++;
+        }
+        set_handler(t, op);
+        ops[n] = t;
+    }
+    set_handler(ops[n], op_exit);
+    free(index);
+    return ops;
+}
+
+#undef set_handler
+
+#ifdef computed_goto
+#define handle(name) name:
+#define next_op() goto *(++op)->handler
+#else
+#define handle(name) case name:
+#define next_op() \
+    op++;         \
+    continue
+#endif
+
+// One run of threaded instructions into a batch, with sleeps timed from began. The counts of the loops it is in are
+// made before it starts, so running out of memory happens on the thread that started it and not in the middle of a run
+typedef struct
+{
+    const program *p;
+    threaded *ops;
+    batch *b;
+    uint64_t began;
+    lateness *late;
+    run_profile *profile;
+    size_t failed;
+    uintmax_t *memory;
+} runner;
+
+uintmax_t *new_loop_counts(const program *const p)
+{
+    uintmax_t *memory = malloc(p->depth * uintmax_size + 1);
+    if (!memory)
+        handle_error("Error executing");
+    return memory;
+}
+
+// Runs r and puts the number of sends where some inputs failed in it. The handlers are only known in here, so when r
+// is NULL it returns them for thread_program instead
+const void *const *run_ops(runner *const r)
+{
+#ifdef computed_goto
+    static const void *const handlers[] = {&&op_loop, &&op_end, &&op_send, &&op_sleep, &&op_send_sleep,
+                                           &&op_loop_send, &&op_loop_send_sleep, &&op_rate, &&op_count,
+                                           &&op_profile_send, &&op_profile_sleep, &&op_barrier, &&op_path, &&op_text,
+                                           &&op_exit};
+    if (!r)
+        return handlers;
+#else
+    if (!r)
+        return NULL;
+#endif
+    const program *const p = r->p;
+    batch *const b = r->b;
+    lateness *const late = r->late;
+    run_profile *const profile = r->profile;
+    const threaded *const ops = r->ops;
+    size_t failed = 0;
+    uintmax_t *top = r->memory - 1;
+    uint64_t deadline = r->began;
+    const threaded *op = ops;
+#ifdef computed_goto
+    goto *op->handler;
+#else
+    while (1)
+    {
+        switch (op->handler)
+        {
+#endif
+    handle(op_loop)
+    {
+        *++top = op->count;
+        next_op();
+    }
+    handle(op_end)
+    {
+        if (--*top)
+            op = ops + op->count;
+        else
+            top--;
+        next_op();
+    }
+    handle(op_send)
+    {
+        failed += send_sequence(p, b, op->s);
+        next_op();
+    }
+    handle(op_sleep)
+    {
+        sleep_batch(b, &deadline, op->sleep, late);
+        next_op();
+    }
+    handle(op_send_sleep)
+    {
+        failed += send_sequence(p, b, op->s);
+        sleep_batch(b, &deadline, op->sleep, late);
+        next_op();
+    }
+    handle(op_loop_send)
+    {
+        // Counts of 0 wrap around like they do in a loop that is not fused
+        uintmax_t count = op->count;
+        do
+            failed += send_sequence(p, b, op->s);
+        while (--count);
+        next_op();
+    }
+    handle(op_loop_send_sleep)
+    {
+        uintmax_t count = op->count;
+        do
+        {
+            failed += send_sequence(p, b, op->s);
+            sleep_batch(b, &deadline, op->sleep, late);
+        } while (--count);
+        next_op();
+    }
+    handle(op_rate)
+    {
+        set_rate(b, op->count);
+        next_op();
+    }
+    handle(op_count)
+    {
+        profile->counts[op->count]++;
+        next_op();
+    }
+    handle(op_profile_send)
+    {
+        uint64_t start = now_ns();
+        failed += send_sequence(p, b, op->s);
+        add_send_time(profile, op->s - (const sequence *)p->inputs.data, now_ns() - start);
+        next_op();
+    }
+    handle(op_profile_sleep)
+    {
+        uint64_t start = now_ns();
+        sleep_batch(b, &deadline, op->sleep, late);
+        profile->sleep_total += now_ns() - start;
+        next_op();
+    }
+    handle(op_barrier)
+    {
+        pass_slot(b, slot_barrier, 0);
+        next_op();
+    }
+    handle(op_path)
+    {
+        failed += send_path(b, op->path, &deadline, late);
+        next_op();
+    }
+    handle(op_text)
+    {
+        failed += send_text(b, op->text);
+        next_op();
+    }
+    handle(op_exit)
+    {
+        r->failed = failed;
+        return NULL;
+    }
+#ifndef computed_goto
+        }
+    }
+#endif
+}
+
+// Finds the code of each track, following the jumps of a watched program, and puts where it starts and its number in
+// starts and numbers when they are not NULL. Code before the first track is track 0, which is left out when there is
+// none. Returns the number of tracks, 0 for a program without any
+size_t find_tracks(const program *const p, size_t *const starts, uintmax_t *const numbers)
+{
+    const instruction *ins = p->codes.data;
+    size_t n = 0;
+    int before = 0;
+    for (size_t i = 0; i < p->codes.len;)
+    {
+        if (ins[i].opcode == 5)
+        {
+            i = ins[i].immediate < p->codes.len ? ins[i].immediate : p->codes.len;
+            continue;
+        }
+        if (ins[i].opcode == 6)
+        {
+            if (!n && before)
+            {
+                if (starts)
+                {
+                    starts[n] = 0;
+                    numbers[n] = 0;
+                }
+                n++;
+            }
+            if (starts)
+            {
+                starts[n] = i + 1;
+                numbers[n] = ins[i].immediate;
+            }
+            n++;
+        }
+        else if (!n)
+            before = 1;
+        i++;
+    }
+    return n;
+}
+
+size_t execute_tracks(const program *const p, sink *const out, run_stats *const stats, const size_t count);
+
+// Returns the number of sends where some inputs failed. Sleeps are timed from when the run started. If stats is not
+// NULL, how late each sleep woke up and how inputs were batched are put in it
+size_t execute(const program *const p, sink *const out, run_stats *const stats)
+{
+    size_t tracks = find_tracks(p, NULL, NULL);
+    if (tracks)
+        return execute_tracks(p, out, stats, tracks);
+    lateness *late = stats ? &stats->late : NULL;
+    run_profile *profile = stats ? stats->profile : NULL;
+    size_t cap = out->max_batch ? out->max_batch : batch_size;
+    runner r = {p, thread_program(p, run_ops(NULL), profile != NULL, 0, 0), new_batch(out, cap), 0, late, profile, 0,
+                new_loop_counts(p)};
+    out->motions = p->motions.data;
+    if (out->pipelined)
+        start_pipeline(out, r.b, late);
+    r.began = now_ns();
+    run_ops(&r);
+    free(r.memory);
+    batch *b = r.b;
+    size_t failed = r.failed;
+    if (b->pipe)
+        failed += stop_pipeline(b, stats);
+    else
+        out->flush(out);
+    if (profile)
+        profile->run_ns = now_ns() - r.began;
+    if (stats)
+    {
+        stats->sends = b->sends;
+        stats->inputs = b->inputs;
+        stats->retries = b->retries;
+        stats->dropped = b->dropped;
+        stats->batch_min = b->size_min;
+        stats->batch_last = b->size;
+    }
+    free(r.ops);
+    free(b);
+    return failed;
+}
+
+#undef handle
+#undef next_op
+
+// Programs with tracks run each track on a thread of its own into a ring like the one --pipeline uses, and the
+// calling thread takes what they pass in the order it is meant to happen, so the inputs of every track reach the
+// output in order without a lock. A track is at the time its last sleep ends on a clock every track shares, moved on
+// by its rate and by waiting at barriers. The track with the earliest time goes next, the one that comes first in the
+// script when times are the same, and its inputs are sent once the clock has reached its time. A track that reaches a
+// barrier waits until every track still running has reached one, and then all of them carry on from the latest time
+enum
+{
+    track_running,
+    track_waiting,
+    track_done,
+};
+
+typedef struct
+{
+    runner r;
+    thread runs;
+    pipeline *q;
+    int state;
+    // Slots taken from the ring, and how far the one being sent has got
+    uint64_t taken;
+    size_t done;
+    int waits;
+    uint64_t time;
+    // Added to the sleeps the track passes, which end on its own timeline
+    uint64_t moved;
+    // Whether its first send since it started or last left a barrier is still to be timed
+    int unmeasured;
+} track;
+
+void run_track(void *const arg)
+{
+    runner *r = arg;
+    run_ops(r);
+    pass_slot(r->b, slot_end, 0);
+}
+
+// Waits until the clock reaches time, unless it already waited for a later time
+void wait_track(sink *const out, uint64_t *const waited, const uint64_t time, lateness *const late)
+{
+    if (time <= *waited)
+        return;
+    uint64_t woke = out->sleep(out, time);
+    if (woke && late)
+        add_lateness(late, woke - time);
+    *waited = time;
+}
+
+// The skew of a start is how far apart the tracks' first sends after it were, each counted from when it was meant to go
+void add_skew(run_stats *const stats, uint64_t *const low, uint64_t *const high, size_t *const measured)
+{
+    if (*measured > 1)
+    {
+        stats->skews++;
+        stats->skew_total += *high - *low;
+        if (*high - *low > stats->skew_max)
+            stats->skew_max = *high - *low;
+    }
+    *low = *high = *measured = 0;
+}
+
+size_t execute_tracks(const program *const p, sink *const out, run_stats *const stats, const size_t count)
+{
+    size_t *starts = malloc(count * sizet_size);
+    uintmax_t *numbers = malloc(count * uintmax_size);
+    track *tracks = calloc(count, sizeof(track));
+    track_stats *done = calloc(count, sizeof(track_stats));
+    if (!starts || !numbers || !tracks || !done)
+        handle_error("Error executing");
+    find_tracks(p, starts, numbers);
+    lateness *late = stats ? &stats->late : NULL;
+    run_profile *profile = stats ? stats->profile : NULL;
+    size_t cap = out->max_batch ? out->max_batch : batch_size;
+    const void *const *handlers = run_ops(NULL);
+    out->motions = p->motions.data;
+    for (size_t k = 0; k < count; k++)
+    {
+        track *t = &tracks[k];
+        t->r = (runner){.p = p, .ops = thread_program(p, handlers, profile != NULL, starts[k], 1), .b = new_batch(out, cap),
+                        .memory = new_loop_counts(p)};
+        t->r.profile = profile ? new_run_profile(p) : NULL;
+        t->q = new_pipeline(out, t->r.b, NULL);
+        t->unmeasured = 1;
+        done[k].number = numbers[k];
+    }
+    const uint64_t began = now_ns();
+    // Tracks that can't get a thread are left out and counted as failed, since the ones already going can't be stopped
+    size_t started = 0;
+    for (; started < count; started++)
+    {
+        tracks[started].r.began = tracks[started].time = began;
+        if (!spawn_thread(&tracks[started].runs, run_track, &tracks[started].r))
+            break;
+    }
+    size_t failed = count - started;
+    if (failed)
+    {
+        puts("Warning: could not start every track, running the rest");
+        for (size_t k = started; k < count; k++)
+            tracks[k].state = track_done;
+    }
+
+    uint64_t waited = began;
+    uint64_t low = 0, high = 0;
+    size_t measured = 0;
+    size_t last = 0;
+    while (1)
+    {
+        track *t = NULL;
+        for (size_t k = 0; k < count; k++)
+            if (tracks[k].state == track_running && (!t || tracks[k].time < t->time))
+                t = &tracks[k];
+        if (!t)
+        {
+            // Every track still running is at a barrier
+            uint64_t latest = 0;
+            int waiting = 0;
+            for (size_t k = 0; k < count; k++)
+                if (tracks[k].state == track_waiting)
+                {
+                    waiting = 1;
+                    if (tracks[k].time > latest)
+                        latest = tracks[k].time;
+                }
+            if (!waiting)
+                break;
+            if (stats)
+            {
+                add_skew(stats, &low, &high, &measured);
+                stats->barriers++;
+            }
+            for (size_t k = 0; k < count; k++)
+                if (tracks[k].state == track_waiting)
+                {
+                    done[k].barrier_ns += latest - tracks[k].time;
+                    tracks[k].moved = latest - tracks[k].time > UINT64_MAX - tracks[k].moved ? UINT64_MAX : tracks[k].moved + latest - tracks[k].time;
+                    tracks[k].time = latest;
+                    tracks[k].state = track_running;
+                    tracks[k].unmeasured = 1;
+                }
+            continue;
+        }
+        pipeline *q = t->q;
+        wait_position(&q->filled, t->taken, &q->sender_stalls, &q->sender_stall_ns);
+        slot *s = &q->slots[t->taken % ring_slots];
+        if (s->kind == slot_events)
+        {
+            batch *b = q->out;
+            wait_track(out, &waited, t->time, late);
+            if (!t->done)
+            {
+                b->staging = s->events;
+                b->len = s->len;
+            }
+            // A part held back by the rate moves the track on to when it can go, so earlier ones go first
+            uint64_t when;
+            size_t n = next_part(b, t->done, &when);
+            if (when > t->time)
+            {
+                t->time = when;
+                continue;
+            }
+            if (stats && t->unmeasured)
+            {
+                uint64_t now = now_ns();
+                uint64_t lag = now > t->time ? now - t->time : 0;
+                if (!measured || lag < low)
+                    low = lag;
+                if (!measured || lag > high)
+                    high = lag;
+                measured++;
+                t->unmeasured = 0;
+            }
+            if (send_part(b, &t->done, n, &t->waits) && t->done < b->len)
+                continue;
+            if (b->failed)
+            {
+                puts("Warning: some inputs failed to send");
+                failed++;
+                b->failed = 0;
+            }
+            b->len = 0;
+            t->done = 0;
+            t->waits = 0;
+        }
+        else if (s->kind == slot_sleep)
+        {
+            uint64_t time = s->value > UINT64_MAX - t->moved ? UINT64_MAX : s->value + t->moved;
+            if (time > t->time)
+                t->time = time;
+        }
+        else if (s->kind == slot_rate)
+            q->out->rate = s->value;
+        else if (s->kind == slot_barrier)
+            t->state = track_waiting;
+        else
+        {
+            // A track lasts until its last sleep has ended
+            wait_track(out, &waited, t->time, late);
+            t->state = track_done;
+            done[t - tracks].run_ns = now_ns() - began;
+            last = t - tracks;
+        }
+        store_position(&q->sent, ++t->taken);
+    }
+    out->flush(out);
+    if (profile)
+        profile->run_ns = now_ns() - began;
+
+    for (size_t k = 0; k < count; k++)
+    {
+        track *t = &tracks[k];
+        const batch *b = t->q->out;
+        if (k < started)
+            join_thread(&t->runs);
+        failed += t->r.failed;
+        done[k].inputs = b->inputs;
+        done[k].sends = b->sends;
+        done[k].dropped = b->dropped;
+        if (stats)
+        {
+            stats->sends += b->sends;
+            stats->inputs += b->inputs;
+            stats->retries += b->retries;
+            stats->dropped += b->dropped;
+            if (!k || b->size_min < stats->batch_min)
+                stats->batch_min = b->size_min;
+            if (k == last)
+                stats->batch_last = b->size;
+            stats->producer_stalls += t->q->producer_stalls;
+            stats->producer_stall_ns += t->q->producer_stall_ns;
+            stats->sender_stalls += t->q->sender_stalls;
+            stats->sender_stall_ns += t->q->sender_stall_ns;
+        }
+        if (profile)
+        {
+            add_run_profile(profile, t->r.profile, p);
+            free_run_profile(t->r.profile);
+        }
+        free(t->r.ops);
+        free(t->r.memory);
+        free_pipeline(t->q);
+        free(t->r.b);
+    }
+    if (stats)
+    {
+        add_skew(stats, &low, &high, &measured);
+        stats->tracks = done;
+        stats->track_count = count;
+    }
+    else
+        free(done);
+    free(tracks);
+    free(starts);
+    free(numbers);
+    return failed;
+}
+
+uintmax_t add_sat(const uintmax_t a, const uintmax_t b)
+{
+    return a > UINTMAX_MAX - b ? UINTMAX_MAX : a + b;
+}
+
+uintmax_t mul_sat(const uintmax_t a, const uintmax_t b)
+{
+    return b && a > UINTMAX_MAX / b ? UINTMAX_MAX : a * b;
+}
+
+// Number of events sent from begin to end of a sequence once its repeats are expanded, saturating on overflow
+uintmax_t count_events(const repeat *const r, const size_t len, size_t *const next, size_t begin, const size_t end)
+{
+    uintmax_t total = 0;
+    while (begin < end)
+    {
+        if (*next < len && r[*next].begin == begin)
+        {
+            const repeat *body = &r[(*next)++];
+            total = add_sat(total, mul_sat(count_events(r, len, next, body->begin, body->end), body->count));
+            begin = body->end;
+            continue;
+        }
+        size_t stop = end;
+        if (*next < len && r[*next].begin < end)
+            stop = r[*next].begin;
+        total = add_sat(total, stop - begin);
+        begin = stop;
+    }
+    return total;
+}
+
+uintmax_t sequence_events(const program *const p, const size_t index)
+{
+    const sequence *s = &((const sequence *)p->inputs.data)[index];
+    size_t next = 0;
+    return count_events(&((const repeat *)p->repeats.data)[s->repeat], s->repeats, &next, 0, s->len);
+}
+
+// Counts the instructions and the sends and sleeps a program will go through, multiplying through its loops
+void count_program(const program *const p, uintmax_t *const executed, uintmax_t *const calls)
+{
+    const instruction *ins = p->codes.data;
+    uintmax_t *outer = malloc(p->depth * uintmax_size + 1);
+    if (!outer)
+        handle_error("Error optimizing");
+    uintmax_t times = 1;
+    size_t m = 0;
+    *executed = 0;
+    *calls = 0;
+    for (size_t i = 0; i < p->codes.len; i++)
+    {
+        if (ins[i].opcode == 6)
+            continue;
+        *executed = add_sat(*executed, times);
+        if (ins[i].opcode == 0)
+        {
+            outer[m++] = times;
+            times = mul_sat(times, ins[i].immediate);
+        }
+        else if (ins[i].opcode == 1)
+            times = outer[--m];
+        else if (ins[i].opcode == 2)
+        {
+            uintmax_t len = sequence_events(p, ins[i].immediate);
+            *calls = add_sat(*calls, mul_sat(times, len / batch_size + (len % batch_size != 0)));
+        }
+        else if (ins[i].opcode == 3)
+            *calls = add_sat(*calls, times);
+        else if (ins[i].opcode == 8)
+        {
+            // A path with a duration sleeps before each step
+            const path *w = (const path *)p->paths.data + ins[i].immediate;
+            uintmax_t steps = w->duration ? mul_sat(w->steps, 2) : w->steps / batch_size + (w->steps % batch_size != 0);
+            *calls = add_sat(*calls, mul_sat(times, steps));
+        }
+        else if (ins[i].opcode == 9)
+        {
+            uintmax_t len = text_events((const char *)p->text.data + ins[i].immediate);
+            *calls = add_sat(*calls, mul_sat(times, len / batch_size + (len % batch_size != 0)));
+        }
+    }
+    free(outer);
+}
+
+// What a program will do when run, worked out from its instructions without running it. Each sequence is counted once
+// and multiplied by the loops around it, so this takes time in the size of the program rather than of what it sends.
+// Sends are split into batches of cap inputs, or of a hundredth of a second with a rate, and the size a batch would
+// have if every array were written out in full is counted too. "T" is taken to apply to everything after it in its
+// track. Tracks run at once, so the run takes at least as long as the longest one, not counting waits at barriers.
+// Totals that do not fit saturate and set overflow
+typedef struct
+{
+    uintmax_t executed;
+    uintmax_t inputs;
+    uintmax_t sends;
+    uintmax_t sleeps;
+    uintmax_t largest_batch;
+    uintmax_t largest_sequence;
+    uintmax_t sleep_us;
+    uintmax_t paced_us;
+    uintmax_t run_us;
+    uintmax_t tracks;
+    uintmax_t stored_bytes;
+    uintmax_t expanded_bytes;
+    int overflow;
+} program_stats;
+
+void analyze_program(const program *const p, const size_t cap, program_stats *const s)
+{
+    const instruction *ins = p->codes.data;
+    uintmax_t *outer = malloc(p->depth * uintmax_size + 1);
+    uintmax_t *lens = malloc(p->inputs.len * uintmax_size + 1);
+    if (!outer || !lens)
+        handle_error("Error analyzing");
+    *s = (program_stats){0};
+    for (size_t i = 0; i < p->inputs.len; i++)
+    {
+        lens[i] = sequence_events(p, i);
+        s->expanded_bytes = add_sat(s->expanded_bytes, mul_sat(lens[i], event_size));
+    }
+    const path *paths = p->paths.data;
+    for (size_t i = 0; i < p->paths.len; i++)
+        s->expanded_bytes = add_sat(s->expanded_bytes, mul_sat(paths[i].steps, event_size));
+    for (size_t i = 0; i < p->text.len; i += strlen((const char *)p->text.data + i) + 1)
+        s->expanded_bytes = add_sat(s->expanded_bytes, mul_sat(text_events((const char *)p->text.data + i), event_size));
+    s->stored_bytes = p->codes.len * instruction_size + p->inputs.len * sequence_size + p->events.len * event_size +
+                      p->repeats.len * repeat_size + p->motions.len * motion_size + p->paths.len * path_size + p->text.len;
+    uintmax_t times = 1;
+    uintmax_t rate = 0;
+    uintmax_t track_sleep = 0;
+    uintmax_t track_paced = 0;
+    size_t m = 0;
+    for (size_t i = 0; i <= p->codes.len; i++)
+    {
+        if (i == p->codes.len || ins[i].opcode == 6)
+        {
+            uintmax_t track_us = track_sleep > track_paced ? track_sleep : track_paced;
+            if (track_us > s->run_us)
+                s->run_us = track_us;
+            // Code before the first track is track 0
+            if (i < p->codes.len)
+                s->tracks += s->tracks || !i ? 1 : 2;
+            track_sleep = track_paced = rate = 0;
+            continue;
+        }
+        s->executed = add_sat(s->executed, times);
+        if (ins[i].opcode == 0)
+        {
+            outer[m++] = times;
+            times = mul_sat(times, ins[i].immediate);
+        }
+        else if (ins[i].opcode == 1)
+            times = outer[--m];
+        else if (ins[i].opcode == 2 || (ins[i].opcode == 8 && !paths[ins[i].immediate].duration) || ins[i].opcode == 9)
+        {
+            // A path without a duration is sent like a sequence of its steps, and text like one of its presses and
+            // releases
+            uintmax_t len = ins[i].opcode == 2   ? lens[ins[i].immediate]
+                            : ins[i].opcode == 8 ? paths[ins[i].immediate].steps
+                                                 : text_events((const char *)p->text.data + ins[i].immediate);
+            uintmax_t part = cap;
+            if (rate && (rate / 100 ? rate / 100 : 1) < part)
+                part = rate / 100 ? rate / 100 : 1;
+            s->inputs = add_sat(s->inputs, mul_sat(times, len));
+            s->sends = add_sat(s->sends, mul_sat(times, len / part + (len % part != 0)));
+            if (times && len > s->largest_sequence)
+                s->largest_sequence = len;
+            if (times && (len < part ? len : part) > s->largest_batch)
+                s->largest_batch = len < part ? len : part;
+            // A burst can go out early after every sleep, so only the rest has to wait for the rate
+            if (rate && len > part)
+            {
+                uintmax_t paced = mul_sat(times, mul_sat(len - part, 1000000) / rate);
+                s->paced_us = add_sat(s->paced_us, paced);
+                track_paced = add_sat(track_paced, paced);
+            }
+        }
+        else if (ins[i].opcode == 3)
+        {
+            s->sleeps = add_sat(s->sleeps, times);
+            s->sleep_us = add_sat(s->sleep_us, mul_sat(times, ins[i].immediate));
+            track_sleep = add_sat(track_sleep, mul_sat(times, ins[i].immediate));
+        }
+        else if (ins[i].opcode == 4)
+            rate = ins[i].immediate;
+        else if (ins[i].opcode == 8)
+        {
+            // Each step of a path with a duration is sent on its own after a sleep, so it is never held back by the rate
+            const path *w = &paths[ins[i].immediate];
+            uintmax_t steps = mul_sat(times, w->steps);
+            s->inputs = add_sat(s->inputs, steps);
+            s->sends = add_sat(s->sends, steps);
+            s->sleeps = add_sat(s->sleeps, steps);
+            s->sleep_us = add_sat(s->sleep_us, mul_sat(times, w->duration));
+            track_sleep = add_sat(track_sleep, mul_sat(times, w->duration));
+            if (times && w->steps > s->largest_sequence)
+                s->largest_sequence = w->steps;
+            if (times && !s->largest_batch)
+                s->largest_batch = 1;
+        }
+    }
+    const uintmax_t totals[] = {s->executed, s->inputs, s->sends, s->sleeps, s->sleep_us, s->paced_us, s->expanded_bytes};
+    for (size_t i = 0; i < sizeof(totals) / sizeof(totals[0]); i++)
+        if (totals[i] == UINTMAX_MAX)
+            s->overflow = 1;
+    free(outer);
+    free(lens);
+}
+
+enum
+{
+    optimize_budget = 1 << 20,
+};
+
+// Joins the last sequence of the program onto the one before it, which end next to each other in the pools. A
+// modifier released at the end of the first and pressed again at the start of the second is left held instead
+void merge_last(program *const o)
+{
+    sequence *s = (sequence *)o->inputs.data + o->inputs.len - 2;
+    sequence *t = s + 1;
+    event *e = o->events.data;
+    repeat *r = o->repeats.data;
+    size_t cut = 0;
+    while (cut < s->len && cut < t->len)
+    {
+        const event *up = &e[s->start + s->len - 1 - cut];
+        const event *down = &e[t->start + cut];
+        if (up->type != event_key || down->type != event_key || up->key != down->key || up->key < vk_shift || up->key > vk_menu)
+            break;
+        if (up->flags != key_up || down->flags)
+            break;
+        int covered = 0;
+        for (size_t i = s->repeat; i < s->repeat + s->repeats; i++)
+            covered |= r[i].end > s->len - 1 - cut;
+        for (size_t i = t->repeat; i < t->repeat + t->repeats; i++)
+            covered |= r[i].begin <= cut;
+        if (covered)
+            break;
+        cut++;
+    }
+    for (size_t i = t->repeat; i < t->repeat + t->repeats; i++)
+    {
+        r[i].begin += s->len - 2 * cut;
+        r[i].end += s->len - 2 * cut;
+    }
+    memmove(&e[s->start + s->len - cut], &e[t->start + cut], (t->len - cut) * event_size);
+    s->len += t->len - 2 * cut;
+    s->repeats += t->repeats;
+    o->events.len -= 2 * cut;
+    o->inputs.len--;
+}
+
+// Repeats the last sequence of the program count times, as the loop around it would have done
+void wrap_last(program *const o, const uintmax_t count)
+{
+    sequence *s = (sequence *)o->inputs.data + o->inputs.len - 1;
+    repeat *r = (repeat *)o->repeats.data + s->repeat;
+    if (s->repeats && !r->begin && r->end == s->len)
+    {
+        r->count *= count;
+        return;
+    }
+    expand(&o->repeats);
+    r = (repeat *)o->repeats.data + s->repeat;
+    memmove(r + 1, r, s->repeats * repeat_size);
+    r->begin = 0;
+    r->end = s->len;
+    r->count = count;
+    s->repeats++;
+    o->repeats.len++;
+}
+
+// Merges sends that have nothing between them, folds sleeps together, and turns loops that only send into one
+// repeated send when it is not too big. The program is rebuilt into new vectors
+void optimize_program(program *const p)
+{
+    const instruction *ins = p->codes.data;
+    const sequence *seq = p->inputs.data;
+    arena *a = new_arena();
+    program o = {{NULL, 0, 0, instruction_size, a}, {NULL, 0, 0, sequence_size, a}, {NULL, 0, 0, event_size, a}, {NULL, 0, 0, repeat_size, a}, {NULL, 0, 0, motion_size, a}, {NULL, 0, 0, path_size, a}, {NULL, 0, 0, 1, a}, 0, p->warnings, a};
+    vector loops = {NULL, 0, 0, sizet_size, a};
+    reserve(&o.motions, p->motions.len);
+    if (p->motions.len)
+        memcpy(o.motions.data, p->motions.data, p->motions.len * motion_size);
+    o.motions.len = p->motions.len;
+    for (size_t i = 0; i < p->codes.len; i++)
+    {
+        instruction *code = o.codes.data;
+        size_t last = o.codes.len - 1;
+        switch (ins[i].opcode)
+        {
+        case 0:
+            expand(&loops);
+            ((size_t *)loops.data)[loops.len++] = o.codes.len;
+            if (loops.len > o.depth)
+                o.depth = loops.len;
+            add_code(&o.codes, 0, ins[i].immediate);
+            break;
+        case 1:
+        {
+            size_t begin = ((size_t *)loops.data)[--loops.len];
+            uintmax_t count = code[begin].immediate;
+            if (last == begin)
+            {
+                o.codes.len--;
+                break;
+            }
+            if (last != begin + 1 || code[last].opcode > 6 ||
+                (code[last].opcode == 2 && mul_sat(sequence_events(&o, o.inputs.len - 1), count) > optimize_budget))
+            {
+                add_code(&o.codes, 1, begin);
+                break;
+            }
+            code[begin] = code[last];
+            o.codes.len--;
+            if (code[begin].opcode == 4)
+                break;
+            if (code[begin].opcode == 2)
+            {
+                wrap_last(&o, count);
+                if (begin && code[begin - 1].opcode == 2)
+                {
+                    merge_last(&o);
+                    o.codes.len--;
+                }
+            }
+            else
+            {
+                code[begin].immediate = mul_sat(code[begin].immediate, count);
+                if (begin && code[begin - 1].opcode == 3)
+                {
+                    code[begin - 1].immediate = add_sat(code[begin - 1].immediate, code[begin].immediate);
+                    o.codes.len--;
+                }
+            }
+            break;
+        }
+        case 2:
+        {
+            const sequence *s = &seq[ins[i].immediate];
+            expand(&o.inputs);
+            ((sequence *)o.inputs.data)[o.inputs.len++] = (sequence){o.events.len, s->len, o.repeats.len, s->repeats};
+            reserve(&o.events, o.events.len + s->len);
+            if (s->len)
+                memcpy((event *)o.events.data + o.events.len, (const event *)p->events.data + s->start, s->len * event_size);
+            o.events.len += s->len;
+            reserve(&o.repeats, o.repeats.len + s->repeats);
+            if (s->repeats)
+                memcpy((repeat *)o.repeats.data + o.repeats.len, (const repeat *)p->repeats.data + s->repeat, s->repeats * repeat_size);
+            o.repeats.len += s->repeats;
+            if (!o.codes.len || code[last].opcode != 2)
+            {
+                add_code(&o.codes, 2, o.inputs.len - 1);
+                break;
+            }
+            merge_last(&o);
+            if (!((sequence *)o.inputs.data)[o.inputs.len - 1].len)
+            {
+                o.codes.len--;
+                o.inputs.len--;
+            }
+            break;
+        }
+        case 3:
+            if (!ins[i].immediate)
+                break;
+            if (o.codes.len && code[last].opcode == 3)
+                code[last].immediate = add_sat(code[last].immediate, ins[i].immediate);
+            else
+                add_code(&o.codes, 3, ins[i].immediate);
+            break;
+        case 4:
+            // Only the last of rates next to each other matters
+            if (o.codes.len && code[last].opcode == 4)
+                code[last].immediate = ins[i].immediate;
+            else
+                add_code(&o.codes, 4, ins[i].immediate);
+            break;
+        case 6:
+        case 7:
+            // Nothing is merged across the start of a track or a barrier
+            add_code(&o.codes, ins[i].opcode, ins[i].immediate);
+            break;
+        case 8:
+            expand(&o.paths);
+            ((path *)o.paths.data)[o.paths.len++] = ((const path *)p->paths.data)[ins[i].immediate];
+            add_code(&o.codes, 8, o.paths.len - 1);
+            break;
+        case 9:
+        {
+            const char *text = (const char *)p->text.data + ins[i].immediate;
+            size_t len = strlen(text) + 1;
+            reserve(&o.text, o.text.len + len);
+            memcpy((char *)o.text.data + o.text.len, text, len);
+            add_code(&o.codes, 9, o.text.len);
+            o.text.len += len;
+            break;
+        }
+        }
+    }
+    free_program(p);
+    share_program(&o);
+    *p = o;
+}
+
+char *cache_file(const char *const dir, const uint64_t key)
+{
+    // Cached programs are named after the hash of what they were compiled from
+    size_t dir_len = strlen(dir);
+    char *path = malloc(dir_len + 26);
+    if (!path)
+        handle_error("Error opening cache");
+    memcpy(path, dir, dir_len);
+    path[dir_len] = '/';
+    for (int i = 0; i < 16; i++)
+        path[dir_len + 1 + i] = "0123456789abcdef"[key >> (60 - 4 * i) & 15];
+    memcpy(path + dir_len + 17, ".sip", 5);
+    return path;
+}
+
+void store_cache(const program *const p, const char *const dir, const uint64_t key)
+{
+#ifdef _WIN32
+    CreateDirectoryA(dir, NULL);
+#else
+    mkdir(dir, 0777);
+#endif
+    char *path = cache_file(dir, key);
+    char *temp = cache_file(dir, key);
+    memcpy(temp + strlen(temp), ".tmp", 5);
+    if (!write_program(p, key, temp) || rename(temp, path))
+    {
+        remove(temp);
+        puts("Warning: could not write to the cache");
+    }
+    free(temp);
+    free(path);
+}
+
+si_program *si_compile_buffer(const char *const script, const size_t len, const si_options *const options)
+{
+    // Running out of memory fails the compile like an error in the script does, rather than ending the process
+    jmp_buf failed;
+    jmp_buf *outer = recover;
+    recover = &failed;
+    if (setjmp(failed))
+    {
+        recover = outer;
+        return NULL;
+    }
+    compiler *com = new_compiler(options);
+    si_program *out = malloc(sizeof(si_program));
+    if (!out)
+        handle_error("Error compiling");
+    source src;
+    open_buffer(&src, script, len);
+    recover = &com->fail;
+    if (!setjmp(com->fail))
+    {
+        compile_source(com, &src, options ? options->threads : 1);
+        if (options && options->optimize)
+            optimize_program(&com->p);
+        out->p = com->p;
+        out->mapped = 0;
+    }
+    else
+    {
+        free_program(&com->p);
+        free(out);
+        out = NULL;
+    }
+    free_compiler(com);
+    recover = outer;
+    return out;
+}
+
+size_t si_program_warnings(const si_program *const program)
+{
+    return program->p.warnings;
+}
+
+int si_program_execute(const si_program *const program, const char *const output)
+{
+    // Running out of memory or threads stops the run and closes the output, rather than ending the process
+    jmp_buf failed;
+    jmp_buf *outer = recover;
+    recover = &failed;
+    sink out;
+    volatile int opened = 0;
+    volatile int result = -1;
+    if (!setjmp(failed) && (opened = open_sink(&out, output)))
+        result = execute(&program->p, &out, NULL) != 0;
+    if (opened)
+        out.close(&out);
+    recover = outer;
+    return result;
+}
+
+void si_program_free(si_program *const program)
+{
+    if (!program)
+        return;
+    if (program->mapped == 2)
+        free((void *)program->map.data);
+    else if (program->mapped)
+        unmap_file(&program->map);
+    else
+        free_program(&program->p);
+    free(program);
+}
+
+// A program kept up to date with a source that keeps changing. The source is split into segments the way chunks are,
+// and each segment is compiled on its own into a place of its own in every section of the program, with its codes
+// ending in a jump to the next segment. After an edit only the segments around it are compiled again, going back into
+// their old places when they fit and to the end of the sections when they don't, so nothing else moves. Once more
+// than half of a section is left unused, every segment is moved back next to the one before it
+enum
+{
+    segment_size = 1 << 14,
+    compare_block = 1 << 12,
+};
+
+typedef struct
+{
+    size_t start;
+    size_t len;
+    uintmax_t sleep;
+    // The "K" in effect, as an offset into the source so it stays valid when the source is replaced
+    int has_layout;
+    size_t layout_at;
+    size_t layout_len;
+    // Where the segment is in each section, how much of it it uses, and how much room it has there
+    size_t offsets[section_count];
+    size_t lens[section_count];
+    size_t caps[section_count];
+    size_t depth;
+    size_t warnings;
+} segment;
+
+typedef struct
+{
+    program p;
+    segment *segments;
+    size_t count;
+    char *data;
+    size_t len;
+    int optimize;
+    size_t threads;
+    const char *key_cache;
+    void (*report)(void *user, const char *message);
+    void *user;
+    // The room taken by segments in each section, counting the jump to the first segment
+    size_t used[section_count];
+    // What the last update compiled
+    size_t compiled_segments;
+    size_t compiled_bytes;
+} watch;
+
+program empty_program()
+{
+    arena *a = new_arena();
+    return (program){{NULL, 0, 0, instruction_size, a}, {NULL, 0, 0, sequence_size, a}, {NULL, 0, 0, event_size, a}, {NULL, 0, 0, repeat_size, a}, {NULL, 0, 0, motion_size, a}, {NULL, 0, 0, path_size, a}, {NULL, 0, 0, 1, a}, 0, 0, a};
+}
+
+// The program starts with a jump to the first segment, which goes past the end while there are none
+void new_watch(watch *const w)
+{
+    memset(w, 0, sizeof(*w));
+    w->p = empty_program();
+    add_code(&w->p.codes, 5, UINTMAX_MAX);
+    w->used[0] = 1;
+    w->threads = 1;
+}
+
+void free_watch(watch *const w)
+{
+    free_program(&w->p);
+    free(w->segments);
+    free(w->data);
+}
+
+// Whether a segment of the old source gets the same "S" and "K" as one starting with s in the new one
+int same_start(const watch *const w, const segment *const old, const split_state *const s)
+{
+    if (old->sleep != s->sleep || old->has_layout != (s->layout != NULL))
+        return 0;
+    return !s->layout || (old->layout_len == s->layout_len && !memcmp(w->data + old->layout_at, s->layout, s->layout_len));
+}
+
+// Finds the segment with the byte at
+size_t find_segment(const watch *const w, const size_t at)
+{
+    size_t low = 0, high = w->count;
+    while (high - low > 1)
+    {
+        size_t mid = low + (high - low) / 2;
+        if (w->segments[mid].start <= at)
+            low = mid;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+// Points the jumps before segments first up to last at them, where the one after the last segment ends the program
+void link_segments(watch *const w, const size_t first, const size_t last)
+{
+    instruction *codes = w->p.codes.data;
+    for (size_t k = first; k <= last; k++)
+    {
+        size_t at = k ? w->segments[k - 1].offsets[0] + w->segments[k - 1].lens[0] - 1 : 0;
+        codes[at] = (instruction){5, k < w->count ? w->segments[k].offsets[0] : UINTMAX_MAX};
+    }
+}
+
+// Moves every segment next to the one before it in new sections
+void compact_watch(watch *const w)
+{
+    program p = empty_program();
+    p.depth = w->p.depth;
+    p.warnings = w->p.warnings;
+    vector *sections[] = {&p.codes, &p.inputs, &p.events, &p.repeats, &p.motions, &p.paths, &p.text};
+    size_t at[section_count] = {1};
+    for (size_t k = 0; k < w->count; k++)
+        for (int v = 0; v < section_count; v++)
+            at[v] += w->segments[k].lens[v];
+    for (int v = 0; v < section_count; v++)
+    {
+        reserve(sections[v], at[v]);
+        sections[v]->len = w->used[v] = at[v];
+        at[v] = !v;
+    }
+    for (size_t k = 0; k < w->count; k++)
+    {
+        segment *s = &w->segments[k];
+        copy_block(&p, at, &w->p, s->offsets, s->lens);
+        for (int v = 0; v < section_count; v++)
+        {
+            s->offsets[v] = at[v];
+            s->caps[v] = s->lens[v];
+            at[v] += s->lens[v];
+        }
+    }
+    free_program(&w->p);
+    w->p = p;
+    link_segments(w, 0, w->count);
+}
+
+// Compiles what changed between the source the program was made from and data, which the watch takes over. The
+// segments from the one before the first change are split again, until a segment start after the last change is
+// reached with nothing open and the same "S" and "K" as before, and only those are compiled. Returns 0 and keeps the
+// program as it was if there is an error
+int update_watch(watch *const w, char *const data, const size_t len)
+{
+    size_t same = len < w->len ? len : w->len;
+    size_t prefix = 0;
+    while (prefix + compare_block <= same && !memcmp(data + prefix, w->data + prefix, compare_block))
+        prefix += compare_block;
+    while (prefix < same && data[prefix] == w->data[prefix])
+        prefix++;
+    size_t suffix = 0;
+    while (suffix + compare_block <= same - prefix &&
+           !memcmp(data + len - suffix - compare_block, w->data + w->len - suffix - compare_block, compare_block))
+        suffix += compare_block;
+    while (suffix < same - prefix && data[len - 1 - suffix] == w->data[w->len - 1 - suffix])
+        suffix++;
+    w->compiled_segments = w->compiled_bytes = 0;
+    if (prefix == len && len == w->len && w->count)
+    {
+        free(data);
+        return 1;
+    }
+
+    // A command in the segment before the change can run into it, so that segment is compiled again too
+    size_t i = w->count ? find_segment(w, prefix ? prefix - 1 : 0) : 0;
+    size_t at = i < w->count ? w->segments[i].start : 0;
+    split_state s = {0, 0, 0, i < w->count ? w->segments[i].sleep : 0, NULL, 0};
+    if (i < w->count && w->segments[i].has_layout)
+    {
+        s.layout = data + w->segments[i].layout_at;
+        s.layout_len = w->segments[i].layout_len;
+    }
+    size_t j = i + 1;
+    size_t cap = 16, n = 0, next = at;
+    chunk *chunks = malloc(cap * sizeof(chunk));
+    if (!chunks)
+        handle_error("Error compiling");
+    for (;;)
+    {
+        // Segments after the change start at the same place counting from the end
+        while (j < w->count && (w->segments[j].start < w->len - suffix || w->segments[j].start + len - w->len < at))
+            j++;
+        int open = s.group || s.brackets || s.loops;
+        if (j < w->count && !open && at == w->segments[j].start + len - w->len && same_start(w, &w->segments[j], &s))
+            break;
+        if (at == len)
+        {
+            j = w->count;
+            break;
+        }
+        if (at >= next && !open)
+        {
+            if (n == cap && !(chunks = realloc(chunks, (cap *= 2) * sizeof(chunk))))
+                handle_error("Error compiling");
+            chunks[n++] = (chunk){.data = data + at, .sleep = s.sleep, .layout = s.layout, .layout_len = s.layout_len};
+            next = at + segment_size;
+        }
+        if (!scan_command(&s, data, len, &at))
+        {
+            // A "}" without a loop is left to the compiler, and tracks to one compile, so everything from the first
+            // segment on is one segment
+            j = w->count;
+            n = 1;
+            at = len;
+            break;
+        }
+    }
+    for (size_t k = 0; k < n; k++)
+        chunks[k].len = (k + 1 < n ? chunks[k + 1].data : data + at) - chunks[k].data;
+
+    for (size_t k = 0; k < n; k++)
+    {
+        chunks[k].com = new_compiler(NULL);
+        chunks[k].com->report = collect;
+        chunks[k].com->user = &chunks[k].messages;
+        chunks[k].com->key_cache = w->key_cache;
+        chunks[k].messages = (vector){NULL, 0, 0, 1, chunks[k].com->p.memory};
+        chunks[k].failed = 0;
+        chunks[k].out = &w->p;
+        w->compiled_bytes += chunks[k].len;
+    }
+    for (size_t k = 0; k < n; k += w->threads)
+        run_chunks(chunks + k, n - k < w->threads ? n - k : w->threads, compile_chunk);
+    int failed = 0;
+    for (size_t k = 0; k < n && !failed; k++)
+    {
+        const char *messages = chunks[k].messages.data;
+        for (size_t m = 0; m < chunks[k].messages.len; m += strlen(messages + m) + 1)
+        {
+            if (w->report)
+                w->report(w->user, messages + m);
+            else
+                puts(messages + m);
+        }
+        failed = chunks[k].failed;
+    }
+    if (failed)
+    {
+        for (size_t k = 0; k < n; k++)
+        {
+            free_program(&chunks[k].com->p);
+            free_compiler(chunks[k].com);
+        }
+        free(chunks);
+        free(data);
+        return 0;
+    }
+
+    // Each new segment takes the place of the old one in the same position where it fits
+    segment *segments = malloc((n + 1) * sizeof(segment));
+    if (!segments)
+        handle_error("Error compiling");
+    vector *sections[] = {&w->p.codes, &w->p.inputs, &w->p.events, &w->p.repeats, &w->p.motions, &w->p.paths, &w->p.text};
+    for (size_t k = 0; k < n; k++)
+    {
+        program *p = &chunks[k].com->p;
+        size_t depth = p->depth;
+        if (w->optimize)
+            optimize_program(p);
+        const size_t lens[section_count] = {p->codes.len + 1, p->inputs.len, p->events.len, p->repeats.len, p->motions.len, p->paths.len, p->text.len};
+        segment *seg = &segments[k];
+        *seg = (segment){.start = chunks[k].data - data, .len = chunks[k].len, .sleep = chunks[k].sleep,
+                         .has_layout = chunks[k].layout != NULL, .layout_at = chunks[k].layout ? chunks[k].layout - data : 0,
+                         .layout_len = chunks[k].layout_len};
+        seg->depth = depth;
+        seg->warnings = p->warnings;
+        for (int v = 0; v < section_count; v++)
+        {
+            seg->lens[v] = lens[v];
+            if (i + k < j && w->segments[i + k].caps[v] >= lens[v])
+            {
+                seg->offsets[v] = w->segments[i + k].offsets[v];
+                seg->caps[v] = w->segments[i + k].caps[v];
+            }
+            else
+            {
+                seg->offsets[v] = sections[v]->len;
+                seg->caps[v] = lens[v];
+                reserve(sections[v], sections[v]->len + lens[v]);
+                sections[v]->len += lens[v];
+            }
+            chunks[k].offsets[v] = seg->offsets[v];
+            w->used[v] += seg->caps[v];
+        }
+    }
+    for (size_t k = i; k < j; k++)
+        for (int v = 0; v < section_count; v++)
+            w->used[v] -= w->segments[k].caps[v];
+    for (size_t k = 0; k < n; k += w->threads)
+        run_chunks(chunks + k, n - k < w->threads ? n - k : w->threads, join_chunk);
+    for (size_t k = 0; k < n; k++)
+        free_compiler(chunks[k].com);
+    free(chunks);
+
+    size_t count = w->count - (j - i) + n;
+    if (!(w->segments = realloc(w->segments, ((count > w->count ? count : w->count) + 1) * sizeof(segment))))
+        handle_error("Error compiling");
+    memmove(w->segments + i + n, w->segments + j, (w->count - j) * sizeof(segment));
+    memcpy(w->segments + i, segments, n * sizeof(segment));
+    free(segments);
+    // A "K" before the change stays where it was, and the one the rest starts with was just found
+    for (size_t k = i + n; k < count; k++)
+    {
+        w->segments[k].start += len - w->len;
+        if (w->segments[k].layout_at >= w->len - suffix)
+            w->segments[k].layout_at += len - w->len;
+        else if (s.layout)
+            w->segments[k].layout_at = s.layout - data;
+    }
+    w->count = count;
+    link_segments(w, i, i + n);
+    w->p.depth = w->p.warnings = 0;
+    for (size_t k = 0; k < count; k++)
+    {
+        if (w->segments[k].depth > w->p.depth)
+            w->p.depth = w->segments[k].depth;
+        w->p.warnings += w->segments[k].warnings;
+    }
+    for (int v = 0; v < section_count; v++)
+        if (sections[v]->len / 2 > w->used[v])
+        {
+            compact_watch(w);
+            break;
+        }
+    free(w->data);
+    w->data = data;
+    w->len = len;
+    w->compiled_segments = n;
+    return 1;
+}
+
+// Waits for changes to a file. Editors often save by replacing the file, so its directory is watched instead of the
+// file itself
+typedef struct
+{
+    const char *path;
+#ifdef _WIN32
+    HANDLE directory;
+#elif defined(__linux__)
+    int fd;
+    const char *name;
+#else
+    struct stat last;
+#endif
+} watcher;
+
+// Returns 0 if the directory can't be watched
+int open_watcher(watcher *const f, const char *const path)
+{
+    f->path = path;
+#ifdef _WIN32
+    char directory[MAX_PATH];
+    char *name;
+    DWORD len = GetFullPathNameA(path, MAX_PATH, directory, &name);
+    if (!len || len >= MAX_PATH || !name)
+        return 0;
+    *name = 0;
+    f->directory = CreateFileA(directory, FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+    return f->directory != INVALID_HANDLE_VALUE;
+#elif defined(__linux__)
+    const char *slash = strrchr(path, '/');
+    f->name = slash ? slash + 1 : path;
+    char *directory = slash ? malloc(slash - path + 2) : NULL;
+    if (slash)
+    {
+        if (!directory)
+            return 0;
+        // "/name" is in "/"
+        memcpy(directory, path, slash - path + 1);
+        directory[slash - path + (slash == path)] = 0;
+    }
+    f->fd = inotify_init1(IN_CLOEXEC);
+    int watched = f->fd >= 0 && inotify_add_watch(f->fd, directory ? directory : ".", IN_CLOSE_WRITE | IN_MOVED_TO) >= 0;
+    free(directory);
+    return watched;
+#else
+    return !stat(path, &f->last);
+#endif
+}
+
+// Returns 0 if watching failed. Changes to other files in the directory can wake it too, except with inotify
+int wait_change(watcher *const f)
+{
+#ifdef _WIN32
+    DWORD buffer[1024];
+    DWORD len;
+    return ReadDirectoryChangesW(f->directory, buffer, sizeof(buffer), FALSE, FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE, &len, NULL, NULL);
+#elif defined(__linux__)
+    _Alignas(struct inotify_event) char buffer[4096];
+    for (;;)
+    {
+        ssize_t len = read(f->fd, buffer, sizeof(buffer));
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len <= 0)
+            return 0;
+        int changed = 0;
+        for (char *at = buffer; at < buffer + len; at += sizeof(struct inotify_event) + ((struct inotify_event *)at)->len)
+        {
+            struct inotify_event *e = (struct inotify_event *)at;
+            changed |= e->len && !strcmp(e->name, f->name);
+        }
+        if (changed)
+            return 1;
+    }
+#else
+    // Polls when there is nothing to wait on
+    for (;;)
+    {
+        struct timespec t = {0, 100000000};
+        nanosleep(&t, NULL);
+        struct stat info;
+        if (stat(f->path, &info))
+            continue;
+        if (info.st_mtime != f->last.st_mtime || info.st_size != f->last.st_size || info.st_ino != f->last.st_ino)
+        {
+            f->last = info;
+            return 1;
+        }
+    }
+#endif
+}
+
+void close_watcher(watcher *const f)
+{
+#ifdef _WIN32
+    CloseHandle(f->directory);
+#elif defined(__linux__)
+    close(f->fd);
+#else
+    (void)f;
+#endif
+}
+
+// Returns a copy of the file, which update_watch takes over, or NULL if it can't be read
+char *read_file(const char *const path, size_t *const len)
+{
+    mapping m;
+    if (!map_file(&m, path))
+        return NULL;
+    char *data = malloc(m.len ? m.len : 1);
+    if (!data)
+        handle_error("Error compiling");
+    memcpy(data, m.data, m.len);
+    *len = m.len;
+    unmap_file(&m);
+    return data;
+}
+
+// A server keeps compiled programs and plays them when a client asks, so a job does not wait for a process to start
+// and compile. Clients send a request followed by len bytes of script or the path of a compiled program, and get back
+// a reply followed by len bytes of messages from compiling, each ending in a 0
+enum
+{
+    // Compiles the script unless the same one was compiled before
+    serve_script,
+    // Loads a compiled program from a path the server can open, unless the same program was loaded before
+    serve_compiled,
+    // Plays the program with the key from an earlier request
+    serve_run,
+    // Stops the server once the plays it is running are done, and disconnects every client
+    serve_stop,
+};
+
+enum
+{
+    serve_ok,
+    // The script has an error or the compiled program could not be loaded, the messages say which
+    serve_failed,
+    // No program has the key
+    serve_unknown,
+    // The request is not one of the above or is too long, the server disconnects after replying
+    serve_invalid,
+};
+
+enum
+{
+    // Plays the program right after compiling or loading it
+    serve_start = 1,
+    serve_max_len = 1 << 30,
+};
+
+typedef struct
+{
+    uint32_t kind;
+    uint32_t flags;
+    uint64_t key;
+    uint64_t len;
+} serve_request;
+
+// Times are in nanoseconds, 0 for what the request did not do. The output plays one program at a time, so queueing
+// is the time spent behind plays that were asked for earlier
+typedef struct
+{
+    uint32_t status;
+    uint32_t cached;
+    uint64_t key;
+    uint64_t compile_ns;
+    uint64_t queue_ns;
+    uint64_t run_ns;
+    uint64_t failed;
+    uint64_t len;
+} serve_reply;
+
+// Unix domain sockets, or named pipes on Windows
+#ifdef _WIN32
+typedef HANDLE channel;
+#else
+typedef int channel;
+#endif
+
+int read_channel(const channel c, void *const data, size_t len)
+{
+    char *at = data;
+    while (len)
+    {
+#ifdef _WIN32
+        DWORD n;
+        if (!ReadFile(c, at, len < 1 << 30 ? (DWORD)len : 1 << 30, &n, NULL) || !n)
+            return 0;
+#else
+        ssize_t n = read(c, at, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return 0;
+#endif
+        at += n;
+        len -= n;
+    }
+    return 1;
+}
+
+// Writing to a socket whose other end has gone fails instead of raising SIGPIPE, which would end the process, so
+// signals are left to whoever runs it. Systems without MSG_NOSIGNAL set SO_NOSIGPIPE on each socket instead
+#ifndef _WIN32
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+void quiet_channel(const channel c)
+{
+#ifdef SO_NOSIGPIPE
+    int on = 1;
+    setsockopt(c, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#else
+    (void)c;
+#endif
+}
+#endif
+
+int write_channel(const channel c, const void *const data, size_t len)
+{
+    const char *at = data;
+    while (len)
+    {
+#ifdef _WIN32
+        DWORD n;
+        if (!WriteFile(c, at, len < 1 << 30 ? (DWORD)len : 1 << 30, &n, NULL))
+            return 0;
+#else
+        ssize_t n = send(c, at, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return 0;
+#endif
+        at += n;
+        len -= n;
+    }
+    return 1;
+}
+
+// Lets the other side see the end of the channel while it stays open on this side
+void end_channel(const channel c)
+{
+#ifdef _WIN32
+    FlushFileBuffers(c);
+    DisconnectNamedPipe(c);
+#else
+    shutdown(c, SHUT_RDWR);
+#endif
+}
+
+void close_channel(const channel c)
+{
+#ifdef _WIN32
+    CloseHandle(c);
+#else
+    close(c);
+#endif
+}
+
+#ifdef _WIN32
+// Names that are not already a pipe path are put under \\.\pipe\ .
+char *pipe_name(const char *const name)
+{
+    static const char prefix[] = "\\\\.\\pipe\\";
+    size_t len = strlen(name);
+    size_t prefix_len = strncmp(name, prefix, sizeof(prefix) - 1) ? sizeof(prefix) - 1 : 0;
+    char *path = malloc(prefix_len + len + 1);
+    if (!path)
+        handle_error("Error connecting");
+    memcpy(path, prefix, prefix_len);
+    memcpy(path + prefix_len, name, len + 1);
+    return path;
+}
+#else
+// Returns 0 if the path does not fit in a socket address
+int socket_address(struct sockaddr_un *const address, const char *const name)
+{
+    size_t len = strlen(name);
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if (len >= sizeof(address->sun_path))
+        return 0;
+    memcpy(address->sun_path, name, len + 1);
+    return 1;
+}
+#endif
+
+// Returns 0 if nothing is listening on name
+int connect_channel(channel *const c, const char *const name)
+{
+#ifdef _WIN32
+    char *path = pipe_name(name);
+    // Every instance is taken while the server is between accepting one client and making an instance for the next
+    while ((*c = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL)) == INVALID_HANDLE_VALUE &&
+           GetLastError() == ERROR_PIPE_BUSY && WaitNamedPipeA(path, 1000))
+        ;
+    free(path);
+    return *c != INVALID_HANDLE_VALUE;
+#else
+    struct sockaddr_un address;
+    if (!socket_address(&address, name) || (*c = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        return 0;
+    quiet_channel(*c);
+    if (!connect(*c, (struct sockaddr *)&address, sizeof(address)))
+        return 1;
+    close(*c);
+    return 0;
+#endif
+}
+
+typedef struct
+{
+    uint64_t key;
+    si_program *program;
+    size_t size;
+    // When the program was last asked for, and how many requests are using it now
+    uint64_t used;
+    size_t users;
+} cached_program;
+
+typedef struct connection
+{
+    struct connection *next;
+    struct server *s;
+    channel c;
+    thread worker;
+    volatile uint64_t done;
+} connection;
+
+typedef struct server
+{
+    const char *name;
+    sink *out;
+    int optimize;
+    size_t threads;
+    mutex lock;
+    // Programs by key. Scripts are keyed like the cache, compiled programs by the hash of the file. Once they take up
+    // more than limit bytes, the ones asked for longest ago are freed until they fit, unless a request is using them
+    cached_program *programs;
+    size_t cap;
+    size_t len;
+    size_t bytes;
+    size_t limit;
+    uint64_t uses;
+    // Plays take a ticket and go once played reaches it, so they go in the order they were asked for
+    uint64_t tickets;
+    volatile uint64_t played;
+    volatile uint64_t stopping;
+    connection *connections;
+    // Totals over every request
+    uint64_t requests;
+    uint64_t compiles;
+    uint64_t hits;
+    uint64_t evictions;
+    uint64_t plays;
+    uint64_t compile_ns;
+    uint64_t queue_ns;
+    uint64_t run_ns;
+#ifdef _WIN32
+    char *path;
+#else
+    int listener;
+#endif
+} server;
+
+void new_server(server *const s, const char *const name, sink *const out)
+{
+    memset(s, 0, sizeof(*s));
+    s->name = name;
+    s->out = out;
+    s->threads = 1;
+    init_mutex(&s->lock);
+}
+
+// The slot of the program with key, or the empty one it would go in. Called with the lock held
+size_t find_slot(const server *const s, const uint64_t key)
+{
+    size_t at = key & (s->cap - 1);
+    while (s->programs[at].program && s->programs[at].key != key)
+        at = (at + 1) & (s->cap - 1);
+    return at;
+}
+
+// Finds a program and holds it until release_program, so it is not freed while the request uses it
+si_program *find_program(server *const s, const uint64_t key)
+{
+    si_program *found = NULL;
+    lock_mutex(&s->lock);
+    size_t at = s->cap ? find_slot(s, key) : 0;
+    if (s->cap && (found = s->programs[at].program))
+    {
+        s->programs[at].used = ++s->uses;
+        s->programs[at].users++;
+    }
+    unlock_mutex(&s->lock);
+    return found;
+}
+
+// Frees the program in a slot, moving the ones after it that were pushed past it back so none of them are cut off
+// from where they would be looked for. Called with the lock held
+void drop_program(server *const s, size_t at)
+{
+    si_program_free(s->programs[at].program);
+    s->bytes -= s->programs[at].size;
+    s->len--;
+    s->evictions++;
+    for (size_t next = (at + 1) & (s->cap - 1); s->programs[next].program; next = (next + 1) & (s->cap - 1))
+    {
+        size_t home = s->programs[next].key & (s->cap - 1);
+        if (((next - home) & (s->cap - 1)) >= ((next - at) & (s->cap - 1)))
+        {
+            s->programs[at] = s->programs[next];
+            at = next;
+        }
+    }
+    s->programs[at] = (cached_program){0};
+}
+
+// Frees the programs asked for longest ago until the rest fit in the limit, or only ones in use are left. Called
+// with the lock held
+void evict_programs(server *const s)
+{
+    while (s->limit && s->bytes > s->limit)
+    {
+        size_t oldest = s->cap;
+        for (size_t i = 0; i < s->cap; i++)
+        {
+            const cached_program *c = &s->programs[i];
+            if (c->program && !c->users && (oldest == s->cap || c->used < s->programs[oldest].used))
+                oldest = i;
+        }
+        if (oldest == s->cap)
+            return;
+        drop_program(s, oldest);
+    }
+}
+
+// Called with the lock held
+void release_program(server *const s, const uint64_t key)
+{
+    s->programs[find_slot(s, key)].users--;
+    evict_programs(s);
+}
+
+size_t program_bytes(const si_program *const program)
+{
+    if (program->mapped)
+        return program->map.len;
+    return program->p.memory ? program->p.memory->reserved : 0;
+}
+
+// Two clients can compile the same script at once, so the one that finishes second gets the first one's program.
+// Either way the program is held like find_program holds it
+si_program *keep_program(server *const s, const uint64_t key, si_program *const program)
+{
+    lock_mutex(&s->lock);
+    if (s->len * 2 >= s->cap)
+    {
+        size_t cap = s->cap ? s->cap * 2 : 64;
+        cached_program *programs = calloc(cap, sizeof(cached_program));
+        if (!programs)
+            handle_error("Error compiling");
+        for (size_t i = 0; i < s->cap; i++)
+        {
+            if (!s->programs[i].program)
+                continue;
+            size_t at = s->programs[i].key & (cap - 1);
+            while (programs[at].program)
+                at = (at + 1) & (cap - 1);
+            programs[at] = s->programs[i];
+        }
+        free(s->programs);
+        s->programs = programs;
+        s->cap = cap;
+    }
+    size_t at = find_slot(s, key);
+    si_program *kept = s->programs[at].program;
+    if (kept)
+    {
+        s->programs[at].used = ++s->uses;
+        s->programs[at].users++;
+    }
+    else
+    {
+        size_t size = program_bytes(program);
+        s->programs[at] = (cached_program){key, program, size, ++s->uses, 1};
+        s->len++;
+        s->bytes += size;
+        evict_programs(s);
+    }
+    unlock_mutex(&s->lock);
+    if (!kept)
+        return program;
+    si_program_free(program);
+    return kept;
+}
+
+// Takes over the copy of the file read by read_file, which is freed if the program is invalid
+si_program *load_compiled(const mapping *const m, vector *const messages)
+{
+    si_program *program = malloc(sizeof(si_program));
+    if (!program)
+        handle_error("Error loading program");
+    program->map = *m;
+    program->mapped = 2;
+    if (!load_program(&program->p, &program->map, 0))
+    {
+        collect(messages, "Error: Invalid compiled file");
+        si_program_free(program);
+        return NULL;
+    }
+    return program;
+}
+
+// Waits for the plays asked for earlier, then plays the program
+void serve_play(server *const s, const si_program *const program, serve_reply *const r)
+{
+    lock_mutex(&s->lock);
+    uint64_t ticket = s->tickets++;
+    unlock_mutex(&s->lock);
+    uint64_t start = now_ns();
+    for (unsigned tries = 0; load_position(&s->played) < ticket; tries++)
+        back_off(tries);
+    uint64_t run_start = now_ns();
+    r->queue_ns = run_start - start;
+    r->failed = execute(&program->p, s->out, NULL);
+    r->run_ns = now_ns() - run_start;
+    store_position(&s->played, ticket + 1);
+}
+
+// Answers one request, returning 0 if the client should be disconnected
+int serve_request_from(server *const s, const channel c, const serve_request *const q)
+{
+    serve_reply r = {serve_ok};
+    vector messages = {NULL, 0, 0, 1, NULL};
+    char *data = NULL;
+    si_program *program = NULL;
+    uint32_t kind = q->kind;
+    // Only scripts and paths have anything after the request
+    if (q->len > serve_max_len || (q->len && kind != serve_script && kind != serve_compiled))
+        kind = UINT32_MAX;
+    if (kind == serve_script || kind == serve_compiled)
+    {
+        // Paths are read as strings, so they get a 0 at the end
+        data = malloc(q->len + 1);
+        if (!data)
+            handle_error("Error reading request");
+        if (!read_channel(c, data, q->len))
+        {
+            free(data);
+            return 0;
+        }
+        data[q->len] = 0;
+    }
+    uint64_t start = now_ns();
+    if (kind == serve_script)
+    {
+        r.key = hash(key_prefix(s->optimize), data, q->len);
+        if ((program = find_program(s, r.key)))
+            r.cached = 1;
+        else
+        {
+            si_options options = {s->optimize, collect, &messages, s->threads};
+            if ((program = si_compile_buffer(data, q->len, &options)))
+                program = keep_program(s, r.key, program);
+            else
+                r.status = serve_failed;
+            r.compile_ns = now_ns() - start;
+        }
+    }
+    else if (kind == serve_compiled)
+    {
+        // The file is read rather than mapped, so a program that was checked once can't change under the cache
+        mapping m = {NULL, 0};
+        if (!(m.data = read_file(data, &m.len)))
+        {
+            collect(&messages, "Error: Could not open compiled file");
+            r.status = serve_failed;
+        }
+        else if ((program = find_program(s, r.key = hash(0xCBF29CE484222325, m.data, m.len))))
+        {
+            free((void *)m.data);
+            r.cached = 1;
+        }
+        else if ((program = load_compiled(&m, &messages)))
+        {
+            program = keep_program(s, r.key, program);
+            r.compile_ns = now_ns() - start;
+        }
+        else
+            r.status = serve_failed;
+    }
+    else if (kind == serve_run)
+    {
+        r.key = q->key;
+        if (!(program = find_program(s, r.key)))
+            r.status = serve_unknown;
+    }
+    else if (kind == serve_stop)
+        store_position(&s->stopping, 1);
+    else
+        r.status = serve_invalid;
+    free(data);
+    if (program && (kind == serve_run || q->flags & serve_start))
+        serve_play(s, program, &r);
+
+    lock_mutex(&s->lock);
+    if (program)
+        release_program(s, r.key);
+    s->requests++;
+    s->compiles += r.compile_ns != 0;
+    s->hits += r.cached;
+    s->plays += r.run_ns != 0;
+    s->compile_ns += r.compile_ns;
+    s->queue_ns += r.queue_ns;
+    s->run_ns += r.run_ns;
+    unlock_mutex(&s->lock);
+    r.len = messages.len;
+    int sent = write_channel(c, &r, sizeof(r)) && (!messages.len || write_channel(c, messages.data, messages.len));
+    free(messages.data);
+    if (kind == serve_stop)
+    {
+        // Wakes the server up if it is waiting for the next client
+        channel wake;
+        if (connect_channel(&wake, s->name))
+            close_channel(wake);
+        return 0;
+    }
+    return sent && r.status != serve_invalid;
+}
+
+void serve_client(void *const arg)
+{
+    connection *c = arg;
+    serve_request q;
+    while (read_channel(c->c, &q, sizeof(q)) && serve_request_from(c->s, c->c, &q))
+        ;
+    // The channel is closed when the client is joined, so the server can cut off clients without racing this
+    end_channel(c->c);
+    store_position(&c->done, 1);
+}
+
+// Joins the clients that have disconnected, or every client when stopping
+void join_clients(server *const s, const int all)
+{
+    for (connection **at = &s->connections; *at;)
+    {
+        connection *c = *at;
+        if (!all && !load_position(&c->done))
+        {
+            at = &c->next;
+            continue;
+        }
+        join_thread(&c->worker);
+        close_channel(c->c);
+        *at = c->next;
+        free(c);
+    }
+}
+
+// Answers clients on name until one asks it to stop. Returns 0 if it can't listen there
+int serve(server *const s)
+{
+#ifdef _WIN32
+    s->path = pipe_name(s->name);
+#else
+    struct sockaddr_un address;
+    struct stat info;
+    if (!socket_address(&address, s->name))
+        return 0;
+    // A socket left behind by a server that did not stop is taken over, anything else at the path is left alone
+    if (!stat(s->name, &info) && S_ISSOCK(info.st_mode))
+        unlink(s->name);
+    if ((s->listener = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        return 0;
+    if (bind(s->listener, (struct sockaddr *)&address, sizeof(address)) || listen(s->listener, SOMAXCONN))
+    {
+        close(s->listener);
+        return 0;
+    }
+#endif
+    while (!load_position(&s->stopping))
+    {
+        channel c;
+#ifdef _WIN32
+        c = CreateNamedPipeA(s->path, PIPE_ACCESS_DUPLEX, PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT, PIPE_UNLIMITED_INSTANCES, 1 << 16, 1 << 16, 0, NULL);
+        if (c == INVALID_HANDLE_VALUE)
+            break;
+        if (!ConnectNamedPipe(c, NULL) && GetLastError() != ERROR_PIPE_CONNECTED)
+        {
+            CloseHandle(c);
+            continue;
+        }
+#else
+        if ((c = accept(s->listener, NULL, NULL)) < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            break;
+        }
+        quiet_channel(c);
+#endif
+        if (load_position(&s->stopping))
+        {
+            close_channel(c);
+            break;
+        }
+        join_clients(s, 0);
+        connection *n = malloc(sizeof(connection));
+        if (!n)
+            handle_error("Error accepting");
+        *n = (connection){.next = s->connections, .s = s, .c = c};
+        s->connections = n;
+        start_thread(&n->worker, serve_client, n);
+    }
+    // Clients waiting on their next request are cut off, plays that are running finish first
+    for (connection *c = s->connections; c; c = c->next)
+    {
+        if (load_position(&c->done))
+            continue;
+#ifdef _WIN32
+        CancelSynchronousIo(c->worker.handle);
+#endif
+        end_channel(c->c);
+    }
+    join_clients(s, 1);
+#ifdef _WIN32
+    free(s->path);
+#else
+    close(s->listener);
+    unlink(s->name);
+#endif
+    return 1;
+}
+
+void free_server(server *const s)
+{
+    for (size_t i = 0; i < s->cap; i++)
+        si_program_free(s->programs[i].program);
+    free(s->programs);
+    free_mutex(&s->lock);
+}
+
+// Sends a request and waits for the reply. Messages are kept in a string the caller frees, or are NULL if there are
+// none. Returns 0 if the server went away
+int send_request(const channel c, const serve_request *const q, const void *const data, serve_reply *const r, char **const messages)
+{
+    *messages = NULL;
+    if (!write_channel(c, q, sizeof(*q)) || (q->len && !write_channel(c, data, q->len)) || !read_channel(c, r, sizeof(*r)))
+        return 0;
+    if (!r->len)
+        return 1;
+    if (r->len > serve_max_len || !(*messages = malloc(r->len)))
+        return 0;
+    if (read_channel(c, *messages, r->len))
+        return 1;
+    free(*messages);
+    *messages = NULL;
+    return 0;
+}
+
+#ifndef SI_LIBRARY
+
+static const char *const phase_names[] = {"read", "lex", "parse_keys", "expansion", "finalize"};
+
+// Writes everything --profile collected as JSON, leaving out sequences that were never sent
+int write_profile(const char *const path, const program *const p, const compile_profile *const c, const run_stats *const s)
+{
+    FILE *file = fopen(path, "w");
+    if (!file)
+        return 0;
+    const run_profile *r = s->profile;
+    fprintf(file, "{\n  \"compile_ns\": {");
+    for (int i = 0; i < phase_count; i++)
+        fprintf(file, "%s\"%s\": %llu", i ? ", " : "", phase_names[i], (unsigned long long)c->ns[i]);
+    fprintf(file, "},\n  \"run_ns\": %llu,\n  \"send_ns\": %llu,\n  \"sleep_ns\": %llu,\n", (unsigned long long)r->run_ns,
+            (unsigned long long)r->send_total, (unsigned long long)r->sleep_total);
+    fprintf(file, "  \"inputs\": %llu,\n  \"sends\": %llu,\n  \"sleeps\": %llu,\n  \"output_calls\": %llu,\n",
+            (unsigned long long)s->inputs, (unsigned long long)s->sends, (unsigned long long)s->late.count,
+            (unsigned long long)(s->sends + s->late.count));
+    fprintf(file, "  \"instructions\": [");
+    const instruction *ins = p->codes.data;
+    for (size_t i = 0; i < p->codes.len; i++)
+        fprintf(file, "%s\n    {\"opcode\": %u, \"immediate\": %ju, \"count\": %llu}", i ? "," : "", (unsigned)ins[i].opcode,
+                (uintmax_t)ins[i].immediate, (unsigned long long)r->counts[i]);
+    fprintf(file, "\n  ],\n  \"sequences\": [");
+    int first = 1;
+    for (size_t i = 0; i < p->inputs.len; i++)
+    {
+        uint64_t sends = 0;
+        for (int j = 0; j < send_buckets; j++)
+            sends += r->sends[i][j];
+        if (!sends)
+            continue;
+        fprintf(file, "%s\n    {\"index\": %zu, \"sends\": %llu, \"total_ns\": %llu, \"log2_ns_buckets\": [", first ? "" : ",",
+                i, (unsigned long long)sends, (unsigned long long)r->send_ns[i]);
+        for (int j = 0; j < send_buckets; j++)
+            fprintf(file, "%s%u", j ? ", " : "", (unsigned)r->sends[i][j]);
+        fprintf(file, "]}");
+        first = 0;
+    }
+    fprintf(file, "\n  ]\n}\n");
+    return !fclose(file);
+}
+
+void print_profile(const program *const p, const compile_profile *const c, const run_stats *const s)
+{
+    const run_profile *r = s->profile;
+    print_num("Read time: ", " us", 12, 4, c->ns[phase_read] / 1000);
+    print_num("Lex time: ", " us", 11, 4, c->ns[phase_lex] / 1000);
+    print_num("Key lookup time: ", " us", 18, 4, c->ns[phase_keys] / 1000);
+    print_num("Expansion time: ", " us", 17, 4, c->ns[phase_expand] / 1000);
+    print_num("Finalize time: ", " us", 16, 4, c->ns[phase_finalize] / 1000);
+    print_num("Run time: ", " us", 11, 4, r->run_ns / 1000);
+    print_num("Send time: ", " us", 12, 4, r->send_total / 1000);
+    print_num("Sleep time: ", " us", 13, 4, r->sleep_total / 1000);
+    print_num("Inputs sent: ", "", 14, 1, s->inputs);
+    print_num("Output calls: ", "", 15, 1, s->sends + s->late.count);
+    uint64_t executed = 0;
+    for (size_t i = 0; i < p->codes.len; i++)
+        executed += r->counts[i];
+    print_num("Instructions run: ", "", 19, 1, executed);
+    // The sequence that took longest on average, which is where to look first
+    size_t slowest = 0;
+    uint64_t slowest_ns = 0;
+    for (size_t i = 0; i < p->inputs.len; i++)
+    {
+        uint64_t sends = 0;
+        for (int j = 0; j < send_buckets; j++)
+            sends += r->sends[i][j];
+        if (sends && r->send_ns[i] / sends > slowest_ns)
+        {
+            slowest = i;
+            slowest_ns = r->send_ns[i] / sends;
+        }
+    }
+    if (slowest_ns)
+    {
+        print_num("Slowest sequence: ", "", 19, 1, slowest);
+        print_num("Slowest sequence mean send time: ", " ns", 34, 4, slowest_ns);
+    }
+}
+
+// Prints a line like print_num does, after "Track" and the number of the track
+void print_track(const uintmax_t number, const char *const prefix, const char *const suffix, const size_t prefix_len, const size_t suffix_len, const uintmax_t num)
+{
+    char buffer[message_size];
+    memcpy(buffer, "Track ", 6);
+    char *at = put_num(buffer + 6, number);
+    *at++ = ' ';
+    memcpy(at, prefix, prefix_len - 1);
+    memcpy(put_num(at + prefix_len - 1, num), suffix, suffix_len);
+    puts(buffer);
+}
+
+void print_tracks(const run_stats *const s)
+{
+    for (size_t i = 0; i < s->track_count; i++)
+    {
+        const track_stats *t = &s->tracks[i];
+        print_track(t->number, "inputs: ", "", 9, 1, t->inputs);
+        print_track(t->number, "inputs per second: ", "", 20, 1, t->run_ns ? (uintmax_t)(t->inputs * 1e9 / t->run_ns) : 0);
+        print_track(t->number, "run time: ", " us", 11, 4, t->run_ns / 1000);
+        if (s->barriers)
+            print_track(t->number, "barrier wait: ", " us", 15, 4, t->barrier_ns / 1000);
+        if (t->dropped)
+            print_track(t->number, "inputs dropped: ", "", 17, 1, t->dropped);
+    }
+    print_num("Barriers: ", "", 11, 1, s->barriers);
+    if (s->skews)
+    {
+        print_num("Track skew mean: ", " ns", 18, 4, s->skew_total / s->skews);
+        print_num("Track skew max: ", " ns", 17, 4, s->skew_max);
+    }
+}
+
+void print_key(const char *const prefix, const size_t prefix_len, const uint64_t key)
+{
+    char buffer[message_size];
+    memcpy(buffer, prefix, prefix_len - 1);
+    for (int i = 0; i < 16; i++)
+        buffer[prefix_len - 1 + i] = "0123456789abcdef"[key >> (60 - 4 * i) & 15];
+    buffer[prefix_len + 15] = 0;
+    puts(buffer);
+}
+
+// Sends a script, a compiled program or a key to a server and prints what it did. Scripts from stdin are read whole
+// first, compiled programs are sent as a path the server opens
+int run_client(const char *const name, const char *const path, const char *const compiled_path, const char *const key, const int start, const int stop)
+{
+    serve_request q = {serve_script, start ? serve_start : 0, 0, 0};
+    const void *data = NULL;
+    char *buffer = NULL;
+    mapping script;
+    int mapped = 0;
+    if (stop)
+        q.kind = serve_stop;
+    else if (key)
+    {
+        q.kind = serve_run;
+        q.key = strtoull(key, NULL, 16);
+    }
+    else if (compiled_path)
+    {
+        q.kind = serve_compiled;
+#ifdef _WIN32
+        buffer = _fullpath(NULL, compiled_path, 0);
+#else
+        buffer = realpath(compiled_path, NULL);
+#endif
+        if (!buffer)
+            handle_error("Error opening compiled file");
+        data = buffer;
+        q.len = strlen(buffer);
+    }
+    else if (!strcmp(path, "-"))
+    {
+        vector v = {NULL, 0, 0, 1, NULL};
+        for (size_t n = source_window; n == source_window; v.len += n)
+        {
+            reserve(&v, v.len + source_window);
+            n = fread((char *)v.data + v.len, 1, source_window, stdin);
+        }
+        data = buffer = v.data;
+        q.len = v.len;
+    }
+    else
+    {
+        if (!(mapped = map_file(&script, path)))
+            handle_error("Error opening file");
+        data = script.data;
+        q.len = script.len;
+    }
+
+    channel c;
+    if (!connect_channel(&c, name))
+        handle_error("Error connecting to server");
+    serve_reply r;
+    char *messages;
+    uint64_t sent = now_ns();
+    int ok = send_request(c, &q, data, &r, &messages);
+    uint64_t round_trip = now_ns() - sent;
+    close_channel(c);
+    free(buffer);
+    if (mapped)
+        unmap_file(&script);
+    if (!ok)
+    {
+        puts("Error: Lost the connection to the server");
+        return 1;
+    }
+    for (size_t at = 0; at < r.len; at += strlen(messages + at) + 1)
+        puts(messages + at);
+    free(messages);
+    if (r.status == serve_unknown)
+        puts("Error: The server has no program with that key");
+    else if (r.status == serve_invalid)
+        puts("Error: The server did not understand the request");
+    if (r.status != serve_ok)
+        return 1;
+    if (stop)
+    {
+        puts("Server stopped");
+        return 0;
+    }
+    print_key("Program key: ", 14, r.key);
+    if (r.cached)
+        puts("Found in the server's cache");
+    else if (r.compile_ns)
+        print_num("Compile time: ", " us", 15, 4, r.compile_ns / 1000);
+    if (r.run_ns)
+    {
+        print_num("Queue time: ", " us", 13, 4, r.queue_ns / 1000);
+        print_num("Run time: ", " us", 11, 4, r.run_ns / 1000);
+    }
+    print_num("Round trip: ", " us", 13, 4, round_trip / 1000);
+    if (r.failed)
+        print_num("Sends where some inputs failed: ", "", 33, 1, r.failed);
+    return r.failed != 0;
+}
+
+typedef struct
+{
+    watch w;
+    watcher f;
+    mutex lock;
+} watch_state;
+
+// Compiles the file again, returning 0 if it could not be read
+int recompile(watch_state *const s)
+{
+    size_t len;
+    char *data = read_file(s->f.path, &len);
+    if (!data)
+        return 0;
+    lock_mutex(&s->lock);
+    uint64_t start = now_ns();
+    int ok = update_watch(&s->w, data, len);
+    uint64_t end = now_ns();
+    size_t segments = s->w.compiled_segments, bytes = s->w.compiled_bytes, warnings = s->w.p.warnings;
+    unlock_mutex(&s->lock);
+    if (!ok)
+    {
+        puts("Error: Kept the program from before the change");
+        return 1;
+    }
+    if (!segments)
+        return 1;
+    print_num("Compiled segments: ", "", 20, 1, segments);
+    print_num("Compiled bytes: ", "", 17, 1, bytes);
+    print_num("Compile time: ", " us", 15, 4, (end - start) / 1000);
+    if (warnings)
+        print_num("Warnings in the program: ", "", 26, 1, warnings);
+    puts("Ready, press Enter to run");
+    return 1;
+}
+
+void watch_main(void *const arg)
+{
+    watch_state *s = arg;
+    while (wait_change(&s->f))
+        recompile(s);
+    puts("Error: Stopped watching the file");
+}
+
+// Keeps the program compiled while the file changes, playing it each time Enter is pressed
+void run_watch(const char *const path, sink *const out, const int optimize, const size_t threads, const char *const cache)
+{
+    watch_state *s = malloc(sizeof(watch_state));
+    if (!s)
+        handle_error("Error compiling");
+    new_watch(&s->w);
+    s->w.optimize = optimize;
+    s->w.threads = threads ? threads : 1;
+    s->w.key_cache = cache;
+    init_mutex(&s->lock);
+    if (!open_watcher(&s->f, path))
+        handle_error("Error watching file");
+    puts("Compiling...");
+    if (!recompile(s))
+        handle_error("Error opening file");
+    // The watching thread is left blocked when the keyboard is closed, and ends with the process
+    thread t;
+    if (!spawn_thread(&t, watch_main, s))
+        handle_error("Error watching file");
+    for (int c; (c = getc(stdin)) != EOF;)
+    {
+        if (c != '\n')
+            continue;
+        run_stats *stats = calloc(1, sizeof(run_stats));
+        if (!stats)
+            handle_error("Error executing");
+        lock_mutex(&s->lock);
+        execute(&s->w.p, out, stats);
+        unlock_mutex(&s->lock);
+        print_num("Sends: ", "", 8, 1, stats->sends);
+        if (stats->dropped)
+            print_num("Inputs dropped: ", "", 17, 1, stats->dropped);
+        free(stats->tracks);
+        free(stats);
+        puts("Ready, press Enter to run");
+    }
+}
+
+// Compiles the source, or exits if it has an error. The jump back on an error lands in here rather than in main, so it
+// can't clobber main's locals
+void compile_or_exit(compiler *const com, source *const src, const size_t threads)
+{
+    if (setjmp(com->fail))
+        exit(EXIT_FAILURE);
+    compile_source(com, src, threads);
+}
+
+int main(const int argc, const char **const argv)
+{
+#if defined(_WIN32)
+    const char *output = "sendinput";
+#elif defined(__linux__)
+    const char *output = "uinput";
+#else
+    const char *output = "null";
+#endif
+    const char *path = NULL;
+    const char *emit = NULL;
+    const char *compiled_path = NULL;
+    const char *cache = NULL;
+    int crash = 0;
+    int optimize = 0;
+    size_t threads = 1;
+    size_t max_batch = 0;
+    int pipelined = 0;
+    const char *profile_path = NULL;
+    int analyze = 0;
+    const char *serve_name = NULL;
+    size_t serve_cache = 0;
+    const char *server_name = NULL;
+    const char *key = NULL;
+    int submit = 0;
+    int stop = 0;
+    int watching = 0;
+    int unknowns = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-W"))
+        {
+            puts("Enabled error for warnings");
+            crash = 1;
+        }
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+            output = argv[++i];
+        else if (!strcmp(argv[i], "--emit") && i + 1 < argc)
+            emit = argv[++i];
+        else if (!strcmp(argv[i], "--run-compiled") && i + 1 < argc)
+            compiled_path = argv[++i];
+        else if (!strcmp(argv[i], "--cache") && i + 1 < argc)
+            cache = argv[++i];
+        else if (!strcmp(argv[i], "-O"))
+            optimize = 1;
+        else if (!strcmp(argv[i], "-j") && i + 1 < argc)
+            threads = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--max-batch") && i + 1 < argc)
+            max_batch = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--pipeline"))
+            pipelined = 1;
+        else if (!strcmp(argv[i], "--profile") && i + 1 < argc)
+            profile_path = argv[++i];
+        else if (!strcmp(argv[i], "--stats"))
+            analyze = 1;
+        else if (!strcmp(argv[i], "--serve") && i + 1 < argc)
+            serve_name = argv[++i];
+        else if (!strcmp(argv[i], "--serve-cache") && i + 1 < argc)
+            serve_cache = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--connect") && i + 1 < argc)
+            server_name = argv[++i];
+        else if (!strcmp(argv[i], "--key") && i + 1 < argc)
+            key = argv[++i];
+        else if (!strcmp(argv[i], "--submit"))
+            submit = 1;
+        else if (!strcmp(argv[i], "--stop"))
+            stop = 1;
+        else if (!strcmp(argv[i], "--watch"))
+            watching = 1;
+        else if ((argv[i][0] != '-' || !argv[i][1]) && !path)
+            path = argv[i];
+        else
+            unknowns++;
+    }
+    if (unknowns)
+        print_num("Ignored ", " unknown flags", 9, 15, unknowns);
+    if (serve_name)
+    {
+        sink out;
+        if (!open_sink(&out, output))
+            exit(EXIT_FAILURE);
+        out.max_batch = max_batch;
+        out.pipelined = pipelined;
+        server s;
+        new_server(&s, serve_name, &out);
+        s.optimize = optimize;
+        s.threads = threads;
+        s.limit = serve_cache << 20;
+        puts("Serving, stop with --connect and --stop");
+        if (!serve(&s))
+            handle_error("Error listening");
+        print_num("Requests: ", "", 11, 1, s.requests);
+        print_num("Compiled or loaded: ", "", 21, 1, s.compiles);
+        print_num("Found in cache: ", "", 17, 1, s.hits);
+        if (s.limit)
+            print_num("Evicted: ", "", 10, 1, s.evictions);
+        print_num("Plays: ", "", 8, 1, s.plays);
+        if (s.compiles)
+            print_num("Mean compile time: ", " us", 20, 4, s.compile_ns / s.compiles / 1000);
+        if (s.plays)
+        {
+            print_num("Mean queue time: ", " us", 18, 4, s.queue_ns / s.plays / 1000);
+            print_num("Mean run time: ", " us", 16, 4, s.run_ns / s.plays / 1000);
+        }
+        free_server(&s);
+        out.close(&out);
+        return 0;
+    }
+    if (server_name && (stop || key))
+        return run_client(server_name, NULL, NULL, key, 1, stop);
+    if (!path && !compiled_path)
+    {
+        puts("No file entered, defaulting to \"keys.txt\"");
+        path = "keys.txt";
+    }
+    if (server_name)
+        return run_client(server_name, path, compiled_path, NULL, !submit, 0);
+    if (watching)
+    {
+        if (!path || !strcmp(path, "-"))
+        {
+            puts("Error: Only a file can be watched");
+            exit(EXIT_FAILURE);
+        }
+        sink out;
+        if (!open_sink(&out, output))
+            exit(EXIT_FAILURE);
+        out.max_batch = max_batch;
+        out.pipelined = pipelined;
+        run_watch(path, &out, optimize, threads, cache);
+        out.close(&out);
+        return 0;
+    }
+
+    program p;
+    mapping compiled_file;
+    int mapped = 0;
+    char *cache_path = NULL;
+    compile_profile phases = {{0}};
+    uint64_t start = now_ns();
+    if (compiled_path)
+    {
+        if (!(mapped = map_file(&compiled_file, compiled_path)))
+            handle_error("Error opening compiled file");
+        if (!load_program(&p, &compiled_file, 0))
+        {
+            puts("Error: Invalid compiled file");
+            exit(EXIT_FAILURE);
+        }
+        phases.ns[phase_read] = now_ns() - start;
+        print_num("Load time: ", " us", 12, 4, (now_ns() - start) / 1000);
+    }
+    else
+    {
+        source src;
+        open_source(&src, path);
+        phases.ns[phase_read] = now_ns() - start;
+        if (!src.buffer)
+            print_num("Read length: ", "", 14, 1, src.len);
+
+        // Streams can only be hashed while compiling, so they are stored in the cache but never looked up
+        uint64_t key = 0;
+        int cached = 0;
+        if (cache && !src.buffer)
+        {
+            key = hash(key_prefix(optimize), src.data, src.len);
+            cache_path = cache_file(cache, key);
+            mapped = map_file(&compiled_file, cache_path);
+            cached = mapped && load_program(&p, &compiled_file, key);
+            if (!cached && mapped)
+            {
+                unmap_file(&compiled_file);
+                mapped = 0;
+            }
+        }
+        if (cached)
+            print_num("Loaded from cache, load time: ", " us", 31, 4, (now_ns() - start) / 1000);
+        else
+        {
+            puts("Compiling...");
+            compiler *com = new_compiler(NULL);
+            com->key_cache = cache;
+            com->profile = profile_path ? &phases : NULL;
+            if (src.buffer)
+                src.key = key_prefix(optimize);
+            compile_or_exit(com, &src, threads);
+            p = com->p;
+            if (com->shared_bytes)
+            {
+                print_num("Sequences compiled: ", "", 21, 1, com->sequences);
+                print_num("Unique sequences: ", "", 19, 1, p.inputs.len);
+                print_num("Bytes saved by sharing sequences: ", "", 35, 1, com->shared_bytes);
+            }
+            free_compiler(com);
+            if (optimize)
+            {
+                uintmax_t executed, calls;
+                count_program(&p, &executed, &calls);
+                print_num("Before optimizing: ", " instructions", 20, 14, p.codes.len);
+                print_num("Instructions run: ", "", 19, 1, executed);
+                print_num("Sends and sleeps: ", "", 19, 1, calls);
+                uint64_t optimize_start = now_ns();
+                optimize_program(&p);
+                phases.ns[phase_finalize] += now_ns() - optimize_start;
+                count_program(&p, &executed, &calls);
+                print_num("After optimizing: ", " instructions", 19, 14, p.codes.len);
+                print_num("Instructions run: ", "", 19, 1, executed);
+                print_num("Sends and sleeps: ", "", 19, 1, calls);
+            }
+            if (src.buffer)
+            {
+                print_num("Read length: ", "", 14, 1, src.offset + src.len);
+                key = src.key;
+            }
+            print_num("Compile time: ", " us", 15, 4, (now_ns() - start) / 1000);
+            if (cache)
+                store_cache(&p, cache, key);
+        }
+        close_source(&src);
+        free(cache_path);
+    }
+    if (crash && p.warnings)
+    {
+        print_num("Error: ", " warnings generated", 8, 20, p.warnings);
+        exit(EXIT_FAILURE);
+    }
+    if (analyze)
+    {
+        program_stats s;
+        analyze_program(&p, max_batch ? max_batch : batch_size, &s);
+        print_num("Instructions run: ", "", 19, 1, s.executed);
+        print_num("Inputs sent: ", "", 14, 1, s.inputs);
+        print_num("Send calls: ", "", 13, 1, s.sends);
+        print_num("Sleeps: ", "", 9, 1, s.sleeps);
+        print_num("Largest batch: ", "", 16, 1, s.largest_batch);
+        print_num("Largest sequence: ", " inputs", 19, 8, s.largest_sequence);
+        if (s.tracks)
+            print_num("Tracks: ", "", 9, 1, s.tracks);
+        print_num("Minimum run time: ", " us", 19, 4, s.run_us);
+        print_num("Program size: ", " bytes", 15, 7, s.stored_bytes);
+        print_num("Size with arrays written out: ", " bytes", 31, 7, s.expanded_bytes);
+        if (p.warnings)
+            print_num("Warnings: ", "", 11, 1, p.warnings);
+        if (s.overflow)
+        {
+            puts("Error: Counts overflow, the totals above are only lower bounds");
+            exit(EXIT_FAILURE);
+        }
+        return 0;
+    }
+    if (emit)
+    {
+        if (!write_program(&p, 0, emit))
+            handle_error("Error writing compiled file");
+        print_num("Wrote compiled program, instructions: ", "", 39, 1, p.codes.len);
+        return 0;
+    }
+    sink out;
+    if (!open_sink(&out, output))
+        exit(EXIT_FAILURE);
+    out.max_batch = max_batch;
+    out.pipelined = pipelined;
+
+    // A script read from stdin leaves the terminal to wait on
+    FILE *keyboard = stdin;
+    if (path && !strcmp(path, "-"))
+#ifdef _WIN32
+        keyboard = fopen("CONIN$", "r");
+#else
+        keyboard = fopen("/dev/tty", "r");
+#endif
+    int c = '\n';
+    if (keyboard)
+    {
+        puts("Done compiling, press Enter to run");
+        c = getc(keyboard);
+    }
+    else
+        puts("Done compiling, no terminal to wait on so running now");
+    if (c == '\r' || c == '\n')
+    {
+        run_stats *stats = calloc(1, sizeof(run_stats));
+        if (!stats)
+            handle_error("Error executing");
+        if (profile_path)
+            stats->profile = new_run_profile(&p);
+        execute(&p, &out, stats);
+        const lateness *late = &stats->late;
+        if (late->count)
+        {
+            print_num("Sleeps: ", "", 9, 1, late->count);
+            print_num("Lateness min: ", " ns", 15, 4, late->min);
+            print_num("Lateness mean: ", " ns", 16, 4, late->total / late->count);
+            print_num("Lateness p99: ", " ns", 15, 4, lateness_p99(late));
+            print_num("Lateness max: ", " ns", 15, 4, late->max);
+        }
+        print_num("Sends: ", "", 8, 1, stats->sends);
+        print_num("Batch size at the end: ", "", 24, 1, stats->batch_last);
+        print_num("Smallest batch size: ", "", 22, 1, stats->batch_min);
+        print_num("Retries: ", "", 10, 1, stats->retries);
+        if (stats->dropped)
+            print_num("Inputs dropped: ", "", 17, 1, stats->dropped);
+        if (pipelined)
+        {
+            print_num("Producer stalls: ", "", 18, 1, stats->producer_stalls);
+            print_num("Producer stall time: ", " us", 22, 4, stats->producer_stall_ns / 1000);
+            print_num("Sender stalls: ", "", 16, 1, stats->sender_stalls);
+            print_num("Sender stall time: ", " us", 20, 4, stats->sender_stall_ns / 1000);
+        }
+        if (stats->track_count)
+            print_tracks(stats);
+        if (profile_path)
+        {
+            print_profile(&p, &phases, stats);
+            if (!write_profile(profile_path, &p, &phases, stats))
+                handle_error("Error writing profile");
+            free_run_profile(stats->profile);
+        }
+        free(stats->tracks);
+        free(stats);
+    }
+    out.close(&out);
+    if (mapped)
+        unmap_file(&compiled_file);
+}
+#endif
+
+#if defined(SI_LIBRARY) && defined(__GNUC__) && !defined(_WIN32)
+#pragma GCC visibility pop
+#endif
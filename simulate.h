@@ -0,0 +1,71 @@
+/*  A program to simulate keyboard and mouse inputs
+    Copyright (C) 2025 Anonymous1212144
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef SIMULATE_H
+#define SIMULATE_H
+
+#include <stddef.h>
+
+#if defined(_WIN32) && defined(SI_SHARED)
+#ifdef SI_LIBRARY
+#define SI_API __declspec(dllexport)
+#else
+#define SI_API __declspec(dllimport)
+#endif
+#elif defined(__GNUC__)
+// simulate.c hides everything else when built as a library, so only these are seen from outside
+#define SI_API __attribute__((visibility("default")))
+#else
+#define SI_API
+#endif
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef struct si_program si_program;
+
+    typedef struct
+    {
+        // Runs the optimizer after compiling, like -O
+        int optimize;
+        // Called with every warning and error instead of printing it, user is passed back as is
+        void (*report)(void *user, const char *message);
+        void *user;
+        // Compiles big scripts in up to this many parts at once, like -j. 0 and 1 compile on the calling thread
+        size_t threads;
+    } si_options;
+
+    // Compiles len bytes of script, options can be NULL. Returns NULL if the script has an error or memory runs out.
+    // Programs do not share anything, so any number can be compiled and run at once from different threads
+    SI_API si_program *si_compile_buffer(const char *script, size_t len, const si_options *options);
+
+    // Number of warnings generated while compiling
+    SI_API size_t si_program_warnings(const si_program *program);
+
+    // Plays the program into an output, which is named the same as with -o. Returns 0 if everything was sent, 1 if
+    // some inputs failed to send and -1 if the output could not be opened or memory ran out
+    SI_API int si_program_execute(const si_program *program, const char *output);
+
+    SI_API void si_program_free(si_program *program);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif